@@ -42,27 +42,22 @@ int main(int argc, char **argv) {
 
     SceneSpec scene_spec(dialog.Open());
     hand_renderer.LoadScene(scene_spec);
+
+    // In the auto-crop mode the renderer frames the hand tightly, so the
+    // whole rendered image is our Region of Interest (ROI). There is no
+    // need to search the image for the bounding box of the hand.
+    hand_renderer.set_auto_crop(true);
     hand_renderer.RenderHand();
 
     // We use the rendered hand as an input image to the HoG calculator
     cv::Mat in_image = hand_renderer.pixel_buffer_cv();
 
     // This utility routine flags all the non-black pixels as relevant
-    // for the HoG calculation. The Region of Interest (ROI) will be
-    // calculated from this mask.
+    // for the HoG calculation.
     cv::Mat image_mask = ImageUtils::MaskFromNonZero(in_image);
 
-    // Get the bounding box for the ROI. The bounding box will be around
-    // the non-zero pixels in the image.
-    cv::Rect roi_box = ImageUtils::FindBoundingBox(image_mask);
-
-    // Make a reference roi_image to the part of the image bounded by roi_box.
-    // The coordinate 0,0 in roi_image will correspond to the top-left corner
-    // of the roi_box bounding box.
-    cv::Mat roi_image(in_image, roi_box);
-
-    // Similarly make a reference to the image_mask.
-    cv::Mat roi_mask(image_mask, roi_box);
+    cv::Mat roi_image = in_image;
+    cv::Mat roi_mask = image_mask;
 
     // Our output image will contain the input image as a background.
     cv::Mat out_image = in_image.clone();
@@ -0,0 +1,116 @@
+// This example measures how fast hand silhouettes are rendered: once the
+// usual way, as a shaded BGR frame turned into a mask by
+// ImageUtils::MaskFromNonZero, and once in the silhouette mode, which
+// reads the mask back directly.
+//
+// Usage: silhouette_benchmark <path to resource directory>
+//                             [width height [software]]
+
+# include <cstdlib>
+# include <iostream>
+# include <string>
+
+# include "opencv2/opencv.hpp"
+
+# include "hand_pose.h"
+# include "hand_renderer.h"
+# include "image_utils.h"
+# include "scene_spec.h"
+
+using namespace libhand;
+using namespace std;
+
+// The number of frames rendered by every path
+const int kNumFrames = 500;
+
+// Bends every finger joint a bit further for every frame, so that each
+// frame needs a new skinning
+FullHandPose BenchmarkPose(const SceneSpec &scene_spec, int frame) {
+  FullHandPose hand_pose(scene_spec.num_bones());
+  for (int i = 0; i < scene_spec.num_bones(); ++i) {
+    hand_pose.bend(i) = 0.5 * (frame % 100) / 100.0;
+  }
+  return hand_pose;
+}
+
+// Renders kNumFrames masks and returns the frames per second. The last
+// mask is left in mask.
+double RenderMasks(HandRenderer &hand_renderer, const SceneSpec &scene_spec,
+                   bool silhouette_mode, cv::Mat &mask) {
+  hand_renderer.set_silhouette_mode(silhouette_mode);
+  hand_renderer.set_output_format(silhouette_mode ?
+                                  HandRenderer::MASK_FORMAT :
+                                  HandRenderer::BGR_FORMAT);
+
+  const int64 start = cv::getTickCount();
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    hand_renderer.SetHandPose(BenchmarkPose(scene_spec, frame));
+    hand_renderer.RenderHand();
+
+    if (silhouette_mode) {
+      mask = hand_renderer.pixel_buffer_cv();
+    } else {
+      mask = ImageUtils::MaskFromNonZero(hand_renderer.pixel_buffer_cv());
+    }
+  }
+  mask = mask.clone();
+
+  return kNumFrames * cv::getTickFrequency()
+    / (cv::getTickCount() - start);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 4 && argc != 5) {
+    cerr << "Usage: " << argv[0] << " <path to resource directory> "
+         << "[width height [software]]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  try {
+    const int width = argc >= 4 ? atoi(argv[2]) : HandRenderer::kDefaultWidth;
+    const int height = argc >= 4 ? atoi(argv[3]) :
+      HandRenderer::kDefaultHeight;
+    const HandRenderer::Backend backend =
+      argc == 5 && string(argv[4]) == "software" ?
+      HandRenderer::SOFTWARE_BACKEND : HandRenderer::AUTO_BACKEND;
+
+    HandRenderer hand_renderer;
+    hand_renderer.Setup(width, height, backend);
+
+    SceneSpec scene_spec(string(argv[1]) + "/hand_model/scene_spec.yml");
+    hand_renderer.LoadScene(scene_spec);
+
+    cout << "Rendering " << kNumFrames << " frames of " << width << "x"
+         << height << " with the "
+         << (hand_renderer.backend() == HandRenderer::OGRE_BACKEND ?
+             "OGRE" : "software") << " backend" << endl;
+
+    cv::Mat shaded_mask, silhouette_mask;
+    const double shaded_fps = RenderMasks(hand_renderer, scene_spec, false,
+                                          shaded_mask);
+    const double silhouette_fps = RenderMasks(hand_renderer, scene_spec,
+                                              true, silhouette_mask);
+
+    cout << "Shaded frame + MaskFromNonZero: " << shaded_fps
+         << " frames/sec" << endl;
+    cout << "Silhouette mode: " << silhouette_fps << " frames/sec ("
+         << silhouette_fps / shaded_fps << "x)" << endl;
+
+    // The software backend gives identical masks. With OGRE the
+    // silhouette also covers any pixels of the hand that are shaded pure
+    // black, which MaskFromNonZero() misses, so there the masks may
+    // differ by a few pixels.
+    const int num_different = cv::countNonZero(shaded_mask != silhouette_mask);
+    if (num_different) {
+      cout << "The last masks differ in " << num_different << " of "
+           << width * height << " pixels" << endl;
+    } else {
+      cout << "The last masks are identical" << endl;
+    }
+  } catch (const std::exception &e) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
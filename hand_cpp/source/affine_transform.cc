@@ -0,0 +1,123 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// AffineTransform
+
+# include "affine_transform.h"
+
+# include <cmath>
+# include <stdexcept>
+
+namespace libhand {
+
+using namespace std;
+
+AffineTransform MakeAffine(const float *position, const float *q,
+                           const float *scale) {
+  const float w = q[0], x = q[1], y = q[2], z = q[3];
+
+  const float rotation[3][3] = {
+    { 1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y) },
+    { 2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x) },
+    { 2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y) }
+  };
+
+  AffineTransform result;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) result.m[i][j] = rotation[i][j] * scale[j];
+    result.m[i][3] = position[i];
+  }
+  return result;
+}
+
+AffineTransform Multiply(const AffineTransform &a, const AffineTransform &b) {
+  AffineTransform result;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j]
+        + a.m[i][2] * b.m[2][j] + (j == 3 ? a.m[i][3] : 0);
+    }
+  }
+  return result;
+}
+
+AffineTransform Inverse(const AffineTransform &a) {
+  const float (*m)[4] = a.m;
+
+  float cofactor[3][3] = {
+    { m[1][1] * m[2][2] - m[1][2] * m[2][1],
+      m[0][2] * m[2][1] - m[0][1] * m[2][2],
+      m[0][1] * m[1][2] - m[0][2] * m[1][1] },
+    { m[1][2] * m[2][0] - m[1][0] * m[2][2],
+      m[0][0] * m[2][2] - m[0][2] * m[2][0],
+      m[0][2] * m[1][0] - m[0][0] * m[1][2] },
+    { m[1][0] * m[2][1] - m[1][1] * m[2][0],
+      m[0][1] * m[2][0] - m[0][0] * m[2][1],
+      m[0][0] * m[1][1] - m[0][1] * m[1][0] }
+  };
+
+  float determinant = m[0][0] * cofactor[0][0] + m[0][1] * cofactor[1][0]
+    + m[0][2] * cofactor[2][0];
+  if (determinant == 0) {
+    throw runtime_error("AffineTransform: a singular transform");
+  }
+
+  AffineTransform result;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      result.m[i][j] = cofactor[i][j] / determinant;
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    result.m[i][3] = -(result.m[i][0] * m[0][3] + result.m[i][1] * m[1][3]
+                       + result.m[i][2] * m[2][3]);
+  }
+  return result;
+}
+
+void TransformPoint(const AffineTransform &a, const float *v,
+                    float *result) {
+  float point[3];
+  for (int i = 0; i < 3; ++i) {
+    point[i] = a.m[i][0] * v[0] + a.m[i][1] * v[1] + a.m[i][2] * v[2]
+      + a.m[i][3];
+  }
+  for (int i = 0; i < 3; ++i) result[i] = point[i];
+}
+
+void TransformVector(const AffineTransform &a, const float *v,
+                     float *result) {
+  float vector[3];
+  for (int i = 0; i < 3; ++i) {
+    vector[i] = a.m[i][0] * v[0] + a.m[i][1] * v[1] + a.m[i][2] * v[2];
+  }
+  for (int i = 0; i < 3; ++i) result[i] = vector[i];
+}
+
+void QuatMultiply(const float *a, const float *b, float *result) {
+  float w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+  float x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+  float y = a[0] * b[2] + a[2] * b[0] + a[3] * b[1] - a[1] * b[3];
+  float z = a[0] * b[3] + a[3] * b[0] + a[1] * b[2] - a[2] * b[1];
+  result[0] = w; result[1] = x; result[2] = y; result[3] = z;
+}
+
+void JointQuaternion(float bend, float twist, float side, float *result) {
+  const float cx = cos(bend / 2), sx = sin(bend / 2);
+  const float cy = cos(twist / 2), sy = sin(twist / 2);
+  const float cz = cos(side / 2), sz = sin(side / 2);
+
+  result[0] = cx * cy * cz - sx * sy * sz;
+  result[1] = sx * cy * cz + cx * sy * sz;
+  result[2] = cx * sy * cz - sx * cy * sz;
+  result[3] = cx * cy * sz + sx * sy * cz;
+}
+
+}  // namespace libhand
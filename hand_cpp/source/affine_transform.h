@@ -0,0 +1,55 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// AffineTransform
+//
+// The plain float transform math shared by the parts of LibHand that
+// walk the hand skeleton without OGRE: the .scene reader, the software
+// renderer and the forward kinematics. Quaternions are stored as w, x,
+// y, z.
+
+#ifndef AFFINE_TRANSFORM_H
+#define AFFINE_TRANSFORM_H
+
+# include "hand_prereq.h"
+
+namespace libhand {
+
+// A row-major 3x4 affine transform
+struct AffineTransform {
+  float m[3][4];
+};
+
+// Scales, then rotates by the quaternion, then translates. This is how
+// both a bone and a .scene node are placed relative to their parent.
+AffineTransform MakeAffine(const float *position, const float *orientation,
+                           const float *scale);
+
+// a * b, b being applied first
+AffineTransform Multiply(const AffineTransform &a, const AffineTransform &b);
+
+// Throws a runtime_error if the transform is singular
+AffineTransform Inverse(const AffineTransform &a);
+
+void TransformPoint(const AffineTransform &a, const float *v,
+                    float *result);
+void TransformVector(const AffineTransform &a, const float *v,
+                     float *result);
+
+// result = a * b, result may alias a or b
+void QuatMultiply(const float *a, const float *b, float *result);
+
+// The rotation of a joint, Rx(bend) Ry(twist) Rz(side), the same as
+// HandJoint::ToQuaternion() without going through OGRE
+void JointQuaternion(float bend, float twist, float side, float *result);
+
+}  // namespace libhand
+
+#endif  // AFFINE_TRANSFORM_H
@@ -0,0 +1,56 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// build_mesh_lods: generates the LOD levels of a mesh, such as the hand
+// model, into a new .mesh file (see mesh_lod_builder.h)
+
+# include <cstdlib>
+# include <exception>
+# include <iostream>
+
+# include "mesh_lod_builder.h"
+# include "ogre_file_reader.h"
+
+using namespace std;
+using namespace libhand;
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 4) {
+    cerr << "Usage: " << argv[0]
+         << " <mesh file> <output mesh file> [number of levels]" << endl;
+    return 1;
+  }
+
+  const int num_levels = argc > 3 ? atoi(argv[3]) :
+    MeshLodBuilder::kDefaultNumLevels;
+
+  try {
+    MeshData mesh;
+    OgreFileReader::LoadMesh(argv[1], &mesh);
+    MeshLodBuilder::BuildLods(&mesh, num_levels);
+    MeshLodBuilder::SaveLods(argv[1], mesh, argv[2]);
+
+    for (size_t level = 0; level <= mesh.lod_values.size(); ++level) {
+      size_t num_triangles = 0;
+      for (size_t i = 0; i < mesh.sub_meshes.size(); ++i) {
+        const SubMeshData &sub_mesh = mesh.sub_meshes[i];
+        num_triangles += (level ? sub_mesh.lod_indices[level - 1].size() :
+                          sub_mesh.indices.size()) / 3;
+      }
+      cout << "Level " << level << ": " << num_triangles << " triangles"
+           << endl;
+    }
+  } catch (const std::exception &e) {
+    cerr << "Exception: " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// build_pose_set: packs pose files into a pose set (see pose_set.h). The
+// pose files can be given one by one or as whole directories, which are
+// loaded in parallel.
+
+# include <exception>
+# include <iostream>
+# include <string>
+# include <vector>
+
+# include "boost/filesystem.hpp"
+
+# include "hand_pose.h"
+# include "pose_dataset.h"
+# include "pose_loader.h"
+# include "pose_set.h"
+# include "scene_spec.h"
+
+using namespace std;
+using namespace libhand;
+
+void ReportProgress(const PoseLoader::Progress &progress) {
+  cerr << "Loaded " << progress.files_done << " of " << progress.num_files
+       << " pose files (" << (int) progress.files_per_second()
+       << " files/sec)" << endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " <scene_spec.yml> <pose set file> "
+         << "[pose .yml files or directories...]" << endl;
+    return 1;
+  }
+
+  try {
+    SceneSpec scene_spec(argv[1]);
+
+    vector<string> filenames;
+    for (int i = 3; i < argc; ++i) {
+      if (boost::filesystem::is_directory(argv[i])) {
+        vector<string> dir_files = PoseLoader::ListPoseFiles(argv[i]);
+        filenames.insert(filenames.end(), dir_files.begin(), dir_files.end());
+      } else {
+        filenames.push_back(argv[i]);
+      }
+    }
+
+    PoseLoader loader(scene_spec);
+    loader.set_progress_callback(ReportProgress);
+
+    PoseDataset dataset(scene_spec.num_bones());
+    loader.LoadFiles(filenames, &dataset);
+
+    PoseSetWriter writer(argv[2], scene_spec);
+    FullHandPose hand_pose(scene_spec.num_bones());
+    for (size_t i = 0; i < dataset.size(); ++i) {
+      dataset.GetPose(i, &hand_pose);
+      writer.Append(hand_pose);
+    }
+    writer.Close();
+
+    PoseSet pose_set(argv[2]);
+    cout << "Wrote " << pose_set.num_poses() << " poses into "
+         << pose_set.filename() << endl;
+  } catch (const std::exception &e) {
+    cerr << "Exception: " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
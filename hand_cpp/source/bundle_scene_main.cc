@@ -0,0 +1,41 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// bundle_scene: precompiles a scene into a scene bundle (see scene_bundle.h)
+
+# include <exception>
+# include <iostream>
+
+# include "scene_bundle.h"
+# include "scene_spec.h"
+
+using namespace std;
+using namespace libhand;
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    cerr << "Usage: " << argv[0] << " <scene_spec.yml> <bundle file>" << endl;
+    return 1;
+  }
+
+  try {
+    SceneSpec scene_spec(argv[1]);
+    SceneBundle::Write(scene_spec, argv[2]);
+
+    SceneBundle bundle(argv[2]);
+    cout << "Wrote " << bundle.num_entries() << " files into "
+         << bundle.filename() << endl;
+  } catch (const std::exception &e) {
+    cerr << "Exception: " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,181 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// FixedHandPose
+//
+// FixedHandPose<N> is a FullHandPose with the number of joints fixed at
+// compile time. The floats are stored inline, in the FullHandPose
+// layout, so creating and copying poses never touches the heap. It is
+// meant for the inner loops of samplers and optimizers that go through
+// millions of poses; the rest of LibHand takes a FullHandPose, which the
+// pose converts to and from with a copy of the floats.
+
+#ifndef FIXED_HAND_POSE_H
+#define FIXED_HAND_POSE_H
+
+# include "hand_prereq.h"
+# include <algorithm>
+# include <stdexcept>
+
+# include "boost/array.hpp"
+
+# include "hand_pose.h"
+# include "printfstring.h"
+
+namespace libhand {
+
+using namespace std;
+
+template <int N>
+class FixedHandPose {
+ public:
+  static const int kNumJoints = N;
+  static const int kTotalElements = FullHandPose::kRotMatrixElements
+    + FullHandPose::kElementsPerJoint * N;
+
+  FixedHandPose() { Clear(); }
+
+  // Throws a runtime_error if the pose does not have N joints
+  explicit FixedHandPose(const FullHandPose &hand_pose) {
+    FromFullHandPose(hand_pose);
+  }
+
+  int num_joints() const { return N; }
+  int total_joint_elements() const {
+    return kTotalElements - FullHandPose::kRotMatrixElements;
+  }
+  int total_elements() const { return kTotalElements; }
+
+  // Conversions. Throws a runtime_error if the pose does not have N
+  // joints.
+  void FromFullHandPose(const FullHandPose &hand_pose);
+
+  // Resizes the pose to N joints if needed
+  void ToFullHandPose(FullHandPose *hand_pose) const;
+  FullHandPose ToFullHandPose() const;
+
+  // The accessors of FullHandPose
+  float rotation(int index) const { return data_[index]; }
+  float &rotation(int index) { return data_[index]; }
+
+  void GetRotMatrix(float *rot_mtx) const;
+  void SetRotMatrix(const float *rot_mtx);
+
+  HandJoint joint(int joint) const;
+  void set_joint(int joint_num, HandJoint joint);
+
+  float bend(int joint) const { return data_[JointOffset(joint)]; }
+  float &bend(int joint) { return data_[JointOffset(joint)]; }
+  float side(int joint) const { return data_[JointOffset(joint) + 1]; }
+  float &side(int joint) { return data_[JointOffset(joint) + 1]; }
+  float twist(int joint) const { return data_[JointOffset(joint) + 2]; }
+  float &twist(int joint) { return data_[JointOffset(joint) + 2]; }
+
+  void Clear();
+  void ClearRotation();
+  void ClearJoints();
+
+  // Trivial iterators
+  float *begin() { return data_.begin(); }
+  float *end() { return data_.end(); }
+  const float *begin() const { return data_.begin(); }
+  const float *end() const { return data_.end(); }
+
+  float *rotation_begin() { return begin(); }
+  float *rotation_end() { return begin() + FullHandPose::kRotMatrixElements; }
+  const float *rotation_begin() const { return begin(); }
+  const float *rotation_end() const {
+    return begin() + FullHandPose::kRotMatrixElements;
+  }
+
+  float *joints_begin() { return rotation_end(); }
+  float *joints_end() { return end(); }
+  const float *joints_begin() const { return rotation_end(); }
+  const float *joints_end() const { return end(); }
+
+ private:
+  static int JointOffset(int joint) {
+    return FullHandPose::kRotMatrixElements
+      + joint * FullHandPose::kElementsPerJoint;
+  }
+
+  boost::array<float, kTotalElements> data_;
+};
+
+// Inline implementations
+
+template <int N>
+void FixedHandPose<N>::FromFullHandPose(const FullHandPose &hand_pose) {
+  if (hand_pose.num_joints() != N) {
+    throw runtime_error(PrintFString("The pose has %d joints, while a "
+                                     "FixedHandPose<%d> was expected",
+                                     hand_pose.num_joints(), N));
+  }
+
+  copy(hand_pose.begin(), hand_pose.end(), begin());
+}
+
+template <int N>
+void FixedHandPose<N>::ToFullHandPose(FullHandPose *hand_pose) const {
+  if (hand_pose->num_joints() != N) *hand_pose = FullHandPose(N);
+  copy(begin(), end(), hand_pose->begin());
+}
+
+template <int N>
+FullHandPose FixedHandPose<N>::ToFullHandPose() const {
+  FullHandPose hand_pose(N);
+  copy(begin(), end(), hand_pose.begin());
+  return hand_pose;
+}
+
+template <int N>
+void FixedHandPose<N>::GetRotMatrix(float *rot_mtx) const {
+  copy(rotation_begin(), rotation_end(), rot_mtx);
+}
+
+template <int N>
+void FixedHandPose<N>::SetRotMatrix(const float *rot_mtx) {
+  copy(rot_mtx, rot_mtx + FullHandPose::kRotMatrixElements, rotation_begin());
+}
+
+template <int N>
+HandJoint FixedHandPose<N>::joint(int joint) const {
+  return HandJoint(bend(joint), side(joint), twist(joint));
+}
+
+template <int N>
+void FixedHandPose<N>::set_joint(int joint_num, HandJoint joint) {
+  bend(joint_num) = joint.bend;
+  side(joint_num) = joint.side;
+  twist(joint_num) = joint.twist;
+}
+
+template <int N>
+void FixedHandPose<N>::Clear() {
+  ClearRotation();
+  ClearJoints();
+}
+
+template <int N>
+void FixedHandPose<N>::ClearRotation() {
+  fill(rotation_begin(), rotation_end(), 0.f);
+
+  float *rot_arr = rotation_begin();
+
+  rot_arr[0] = 1.; rot_arr[4] = 1.; rot_arr[8] = 1;
+}
+
+template <int N>
+void FixedHandPose<N>::ClearJoints() {
+  fill(joints_begin(), joints_end(), 0.f);
+}
+
+}  // namespace libhand
+#endif  // FIXED_HAND_POSE_H
@@ -0,0 +1,355 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// HandKinematics
+
+# include "hand_kinematics.h"
+
+# include <algorithm>
+# include <cmath>
+# include <cstring>
+# include <stdexcept>
+
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
+# include "affine_transform.h"
+# include "ogre_file_reader.h"
+# include "printfstring.h"
+
+namespace libhand {
+
+namespace {
+
+// Four floats, one per pose in a group of four poses
+#ifdef __SSE__
+struct Float4 {
+  __m128 v;
+
+  Float4() {}
+  Float4(__m128 value) : v(value) {}
+  explicit Float4(float value) : v(_mm_set1_ps(value)) {}
+
+  static Float4 Load(const float *p) { return _mm_loadu_ps(p); }
+  void Store(float *p) const { _mm_storeu_ps(p, v); }
+};
+
+inline Float4 operator+ (Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator- (Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator* (Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+#else
+struct Float4 {
+  float v[4];
+
+  Float4() {}
+  explicit Float4(float value) { v[0] = v[1] = v[2] = v[3] = value; }
+
+  static Float4 Load(const float *p) {
+    Float4 result;
+    memcpy(result.v, p, sizeof(result.v));
+    return result;
+  }
+  void Store(float *p) const { memcpy(p, v, sizeof(v)); }
+};
+
+inline Float4 operator+ (Float4 a, Float4 b) {
+  for (int i = 0; i < 4; ++i) a.v[i] += b.v[i];
+  return a;
+}
+inline Float4 operator- (Float4 a, Float4 b) {
+  for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i];
+  return a;
+}
+inline Float4 operator* (Float4 a, Float4 b) {
+  for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i];
+  return a;
+}
+#endif
+
+struct Quat4 {
+  Float4 w, x, y, z;
+};
+
+struct Vector4 {
+  Float4 x, y, z;
+};
+
+inline Quat4 Multiply(const Quat4 &a, const Quat4 &b) {
+  Quat4 result;
+  result.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+  result.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+  result.y = a.w * b.y + a.y * b.w + a.z * b.x - a.x * b.z;
+  result.z = a.w * b.z + a.z * b.w + a.x * b.y - a.y * b.x;
+  return result;
+}
+
+// Rotates the vector by the unit quaternion, as OGRE does it:
+// v + 2w (q x v) + 2 q x (q x v)
+inline Vector4 Rotate(const Quat4 &q, const Vector4 &v) {
+  const Float4 two(2);
+  Vector4 uv, uuv;
+  uv.x = q.y * v.z - q.z * v.y;
+  uv.y = q.z * v.x - q.x * v.z;
+  uv.z = q.x * v.y - q.y * v.x;
+  uuv.x = q.y * uv.z - q.z * uv.y;
+  uuv.y = q.z * uv.x - q.x * uv.z;
+  uuv.z = q.x * uv.y - q.y * uv.x;
+
+  Vector4 result;
+  result.x = v.x + two * (q.w * uv.x + uuv.x);
+  result.y = v.y + two * (q.w * uv.y + uuv.y);
+  result.z = v.z + two * (q.w * uv.z + uuv.z);
+  return result;
+}
+
+// The pose of a bone in the skeleton space, for four poses
+struct BoneState {
+  Quat4 orientation;
+  Vector4 position;
+  Vector4 scale;
+};
+
+}  // namespace
+
+HandKinematics::HandKinematics() : num_joints_(0) {
+  memset(hand_transform_, 0, sizeof(hand_transform_));
+  for (int i = 0; i < 3; ++i) hand_transform_[i][i] = 1;
+}
+
+void HandKinematics::Load(const SceneSpec &scene_spec) {
+  const string scene_dir = scene_spec.SceneDirFullPath();
+
+  SceneEntityData entity;
+  OgreFileReader::FindSceneEntity(scene_dir + "/" + scene_spec.scene_file(),
+                                  scene_spec.hand_object_name(), &entity);
+
+  MeshData mesh;
+  OgreFileReader::LoadMesh(scene_dir + "/" + entity.mesh_file, &mesh);
+  if (mesh.skeleton_name.empty()) {
+    throw runtime_error(PrintFString("The hand object %s does not have a "
+                                     "skeleton.",
+                                     scene_spec.hand_object_name().c_str()));
+  }
+
+  SkeletonData skeleton;
+  OgreFileReader::LoadSkeleton(scene_dir + "/" + mesh.skeleton_name,
+                               &skeleton);
+
+  const int num_bones = (int) skeleton.bones.size();
+
+  // Parents before children
+  vector<int> order;
+  if (!skeleton.ParentsFirst(&order)) {
+    throw runtime_error(PrintFString("The skeleton %s has a cycle",
+                                     mesh.skeleton_name.c_str()));
+  }
+
+  vector<int> index_by_handle(num_bones);
+  for (int i = 0; i < num_bones; ++i) index_by_handle[order[i]] = i;
+
+  parents_.assign(num_bones, -1);
+  positions_.resize(3 * num_bones);
+  orientations_.resize(4 * num_bones);
+  scales_.resize(3 * num_bones);
+  joints_.assign(num_bones, -1);
+
+  vector<bool> is_leaf(num_bones, true);
+
+  for (int i = 0; i < num_bones; ++i) {
+    const SkeletonBoneData &bone = skeleton.bones[order[i]];
+
+    if (bone.parent != -1) {
+      parents_[i] = index_by_handle[bone.parent];
+      is_leaf[parents_[i]] = false;
+    }
+    copy(bone.position, bone.position + 3, &positions_[3 * i]);
+    copy(bone.orientation, bone.orientation + 4, &orientations_[4 * i]);
+    copy(bone.scale, bone.scale + 3, &scales_[3 * i]);
+  }
+
+  num_joints_ = scene_spec.num_bones();
+  for (int joint = 0; joint < num_joints_; ++joint) {
+    const string &bone_name = scene_spec.bone_name(joint);
+    const int handle = skeleton.bone_handle(bone_name);
+
+    if (handle == -1) {
+      throw runtime_error(PrintFString("The hand object %s does not have a "
+                                       "bone named %s",
+                                       scene_spec.hand_object_name().c_str(),
+                                       bone_name.c_str()));
+    }
+    joints_[index_by_handle[handle]] = joint;
+  }
+
+  keypoint_bones_.clear();
+  tip_lengths_.clear();
+  keypoint_names_.clear();
+
+  for (int i = 0; i < num_bones; ++i) {
+    const string &name = skeleton.bones[order[i]].name;
+
+    keypoint_bones_.push_back(i);
+    tip_lengths_.push_back(0);
+    keypoint_names_.push_back(name);
+
+    const float *position = &positions_[3 * i];
+    const float length = sqrt(position[0] * position[0]
+                              + position[1] * position[1]
+                              + position[2] * position[2]);
+    if (is_leaf[i] && length > 0) {
+      keypoint_bones_.push_back(i);
+      tip_lengths_.push_back(length);
+      keypoint_names_.push_back(name + " tip");
+    }
+  }
+
+  memcpy(hand_transform_, entity.transform, sizeof(hand_transform_));
+}
+
+int HandKinematics::keypoint_index(const string &name) const {
+  for (size_t i = 0; i < keypoint_names_.size(); ++i) {
+    if (keypoint_names_[i] == name) return (int) i;
+  }
+
+  return -1;
+}
+
+// The poses are processed in groups of four, one pose per SIMD lane.
+// The last group is padded with copies of the last pose.
+void HandKinematics::ComputeKeypoints(const vector<FullHandPose> &hand_poses,
+                                      HandKeypoints *keypoints) const {
+  if (parents_.empty()) {
+    throw runtime_error("No hand skeleton loaded...");
+  }
+
+  for (size_t i = 0; i < hand_poses.size(); ++i) {
+    if (hand_poses[i].num_joints() != num_joints_) {
+      throw runtime_error(PrintFString("The bone map has %d bones, while "
+                                       "the number of joints in the hand "
+                                       "pose is %d", num_joints_,
+                                       hand_poses[i].num_joints()));
+    }
+  }
+
+  const int num_poses = (int) hand_poses.size();
+  const int num_bones = (int) parents_.size();
+
+  keypoints->num_keypoints = num_keypoints();
+  keypoints->num_poses = num_poses;
+  keypoints->x.resize((size_t) num_keypoints() * num_poses);
+  keypoints->y.resize(keypoints->x.size());
+  keypoints->z.resize(keypoints->x.size());
+
+  vector<BoneState> bones(num_bones);
+  // The joint rotations of a group, w, x, y, z lanes per joint
+  vector<float> joint_rotations(16 * num_joints_);
+
+  for (int first = 0; first < num_poses; first += 4) {
+    const int group_size = min(4, num_poses - first);
+
+    // The joint quaternions of the group, one lane per pose
+    for (int lane = 0; lane < 4; ++lane) {
+      const FullHandPose &pose = hand_poses[first + min(lane,
+                                                        group_size - 1)];
+      for (int joint = 0; joint < num_joints_; ++joint) {
+        const HandJoint angles = pose.joint(joint);
+        float q[4];
+        JointQuaternion(angles.bend, angles.twist, angles.side, q);
+
+        float *lanes = &joint_rotations[16 * joint];
+        for (int i = 0; i < 4; ++i) lanes[4 * i + lane] = q[i];
+      }
+    }
+
+    for (int i = 0; i < num_bones; ++i) {
+      Quat4 local;
+      local.w = Float4(orientations_[4 * i]);
+      local.x = Float4(orientations_[4 * i + 1]);
+      local.y = Float4(orientations_[4 * i + 2]);
+      local.z = Float4(orientations_[4 * i + 3]);
+
+      // Bones rotate in their local space
+      if (joints_[i] != -1) {
+        const float *q = &joint_rotations[16 * joints_[i]];
+        Quat4 joint;
+        joint.w = Float4::Load(q);
+        joint.x = Float4::Load(q + 4);
+        joint.y = Float4::Load(q + 8);
+        joint.z = Float4::Load(q + 12);
+        local = Multiply(local, joint);
+      }
+
+      Vector4 position, scale;
+      position.x = Float4(positions_[3 * i]);
+      position.y = Float4(positions_[3 * i + 1]);
+      position.z = Float4(positions_[3 * i + 2]);
+      scale.x = Float4(scales_[3 * i]);
+      scale.y = Float4(scales_[3 * i + 1]);
+      scale.z = Float4(scales_[3 * i + 2]);
+
+      BoneState &bone = bones[i];
+      if (parents_[i] == -1) {
+        bone.orientation = local;
+        bone.position = position;
+        bone.scale = scale;
+      } else {
+        const BoneState &parent = bones[parents_[i]];
+        position.x = position.x * parent.scale.x;
+        position.y = position.y * parent.scale.y;
+        position.z = position.z * parent.scale.z;
+        position = Rotate(parent.orientation, position);
+
+        bone.orientation = Multiply(parent.orientation, local);
+        bone.position.x = parent.position.x + position.x;
+        bone.position.y = parent.position.y + position.y;
+        bone.position.z = parent.position.z + position.z;
+        bone.scale.x = parent.scale.x * scale.x;
+        bone.scale.y = parent.scale.y * scale.y;
+        bone.scale.z = parent.scale.z * scale.z;
+      }
+    }
+
+    for (int k = 0; k < num_keypoints(); ++k) {
+      const BoneState &bone = bones[keypoint_bones_[k]];
+      Vector4 point = bone.position;
+
+      if (tip_lengths_[k] > 0) {
+        Vector4 tip;
+        tip.x = Float4(0);
+        tip.y = Float4(tip_lengths_[k]) * bone.scale.y;
+        tip.z = Float4(0);
+        tip = Rotate(bone.orientation, tip);
+
+        point.x = point.x + tip.x;
+        point.y = point.y + tip.y;
+        point.z = point.z + tip.z;
+      }
+
+      // Into the world space
+      const float (*m)[4] = hand_transform_;
+      Float4 world[3];
+      for (int r = 0; r < 3; ++r) {
+        world[r] = Float4(m[r][0]) * point.x + Float4(m[r][1]) * point.y
+          + Float4(m[r][2]) * point.z + Float4(m[r][3]);
+      }
+
+      float lanes[3][4];
+      for (int r = 0; r < 3; ++r) world[r].Store(lanes[r]);
+
+      const size_t offset = (size_t) k * num_poses + first;
+      copy(lanes[0], lanes[0] + group_size, &keypoints->x[offset]);
+      copy(lanes[1], lanes[1] + group_size, &keypoints->y[offset]);
+      copy(lanes[2], lanes[2] + group_size, &keypoints->z[offset]);
+    }
+  }
+}
+
+}  // namespace libhand
@@ -0,0 +1,105 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// HandKinematics
+//
+// The HandKinematics class computes the 3D positions of the hand joints
+// for hand poses, without rendering anything. It reads the hand skeleton
+// in its binding pose straight from the scene files, so it needs neither
+// the OGRE 3D engine nor a render context.
+//
+// Every bone of the skeleton gives a keypoint at its joint (the head of
+// the bone). The skeleton has no bones past the fingertips, so every leaf
+// bone also gives a tip keypoint: the joint moved along the bone (its
+// local y axis, as exported from Blender) by the length of its parent
+// bone.
+//
+// The bones in the SceneSpec bone map are rotated by the joints of the
+// pose the same way HandRenderer rotates them. The keypoints are in the
+// world space of the scene, the space HandRenderer places its camera in.
+//
+// A batch of poses is computed at once, four poses at a time using SSE
+// when available. The results are stored structure-of-arrays: one array
+// per coordinate, keypoint after keypoint, each with all the poses.
+
+#ifndef HAND_KINEMATICS_H
+#define HAND_KINEMATICS_H
+
+# include "hand_prereq.h"
+# include <string>
+# include <vector>
+
+# include "hand_pose.h"
+# include "scene_spec.h"
+
+namespace libhand {
+
+using namespace std;
+
+// The keypoints of a batch of poses
+struct HandKeypoints {
+  HandKeypoints() : num_keypoints(0), num_poses(0) {}
+
+  int num_keypoints;
+  int num_poses;
+
+  // The coordinate of a keypoint in a pose is at
+  // [keypoint * num_poses + pose]
+  vector<float> x, y, z;
+
+  void Get(int keypoint, int pose, float *xyz) const {
+    const size_t i = (size_t) keypoint * num_poses + pose;
+    xyz[0] = x[i]; xyz[1] = y[i]; xyz[2] = z[i];
+  }
+};
+
+class HAND_EXPORT HandKinematics {
+ public:
+  HandKinematics();
+
+  // Reads the skeleton of the hand object in the scene. Throws a
+  // runtime_error if it can't be read or lacks a bone of the bone map.
+  void Load(const SceneSpec &scene_spec);
+
+  int num_keypoints() const { return (int) keypoint_names_.size(); }
+
+  // The bone name, with " tip" appended for the tip keypoints
+  const string &keypoint_name(int keypoint) const {
+    return keypoint_names_[keypoint];
+  }
+
+  // Returns -1 if there is no such keypoint
+  int keypoint_index(const string &name) const;
+
+  // Computes the keypoints of all the poses. Every pose has to have one
+  // joint per bone in the bone map.
+  void ComputeKeypoints(const vector<FullHandPose> &hand_poses,
+                        HandKeypoints *keypoints) const;
+
+ private:
+  int num_joints_;
+
+  // The bones, parents before children
+  vector<int> parents_;               // Indices into the bones, -1 if root
+  vector<float> positions_;           // x, y, z per bone
+  vector<float> orientations_;        // w, x, y, z per bone
+  vector<float> scales_;              // x, y, z per bone
+  vector<int> joints_;                // The pose joint per bone, or -1
+
+  // The keypoints
+  vector<int> keypoint_bones_;
+  vector<float> tip_lengths_;         // 0 for the joints
+  vector<string> keypoint_names_;
+
+  float hand_transform_[3][4];        // The hand object in the world
+};
+
+}  // namespace libhand
+#endif  // HAND_KINEMATICS_H
@@ -12,14 +12,20 @@
 
 # include "hand_renderer.h"
 
+# include <cfloat>
 # include <cmath>
+# include <cstdlib>
+# include <cstring>
 
 # include <exception>
 # include <iostream>
+# include <map>
 # include <vector>
 
 # include <boost/shared_ptr.hpp>
 # include <boost/shared_array.hpp>
+# include <boost/weak_ptr.hpp>
+# include <boost/thread/mutex.hpp>
 
 # include "OGRE/OgreQuaternion.h"
 # include "OGRE/OgreVector3.h"
@@ -32,8 +38,16 @@
 # include "OGRE/OgreTextureManager.h"
 # include "OGRE/OgreTexture.h"
 # include "OGRE/OgreHardwarePixelBuffer.h"
+# include "OGRE/OgreHighLevelGpuProgramManager.h"
+# include "OGRE/OgreMaterialManager.h"
+# include "OGRE/OgreTechnique.h"
+# include "OGRE/OgrePass.h"
 # include "OGRE/Ogre.h"
 
+# include "OGRE/OgreArchive.h"
+# include "OGRE/OgreArchiveFactory.h"
+# include "OGRE/OgreArchiveManager.h"
+
 # include "OGRE/OgreEntity.h"
 # include "OGRE/OgreBone.h"
 # include "OGRE/OgreSkeleton.h"
@@ -50,6 +64,7 @@
 #endif
 
 # include "printfstring.h"
+# include "software_renderer.h"
 
 # include "opencv2/opencv.hpp"
 
@@ -58,33 +73,573 @@ namespace libhand {
 using namespace std;
 using namespace Ogre;
 
+// The visibility flag of the hand entity. Every atlas cell has its own
+// copy of the hand, flagged by one of the bits above it and seen only by
+// the viewport of the cell. The rest of the scene has all the flags set.
+static const uint32 kMainHandFlag = 1;
+static const int kNumVisibilityFlagBits = 8 * sizeof(uint32);
+static const int kFirstAtlasCellFlagBit = 1;
+
+// The visibility flag of an atlas cell
+static inline uint32 AtlasCellFlag(int cell) {
+  return (uint32) 1 << (kFirstAtlasCellFlagBit + cell);
+}
+
+// The material scheme of the frame in the silhouette mode
+static const char * const kSilhouetteScheme = "HandRenderer Silhouette";
+
+const float HandRenderer::kDefaultCropMargin = 0.2f;
+
+// A joint sits where two parts of the hand meet, often at the edge of
+// their labels, so its visibility is checked within this many pixels of
+// its projection
+static const int kKeypointLabelRadius = 2;
+
+// Outputs such as the depth map are rendered by additional viewports
+// that use their own material scheme. The hand materials don't know
+// about these schemes, so OGRE asks this listener for a technique.
+class SchemeListener : public MaterialManager::Listener {
+ public:
+  void set_scheme_material(const string &scheme, MaterialPtr material) {
+    scheme_materials_[scheme] = material;
+  }
+
+  bool has_scheme_material(const string &scheme) const {
+    return scheme_materials_.find(scheme) != scheme_materials_.end();
+  }
+
+  // The materials have to be let go of while OGRE is still there
+  void Clear() { scheme_materials_.clear(); }
+
+  Technique *handleSchemeNotFound(unsigned short scheme_index,
+                                  const String &scheme_name,
+                                  Material *original_material,
+                                  unsigned short lod_index,
+                                  const Renderable *renderable) {
+    map<string, MaterialPtr>::iterator i = scheme_materials_.find(scheme_name);
+    if (i == scheme_materials_.end()) return NULL;
+
+    return i->second->getBestTechnique();
+  }
+
+ private:
+  map<string, MaterialPtr> scheme_materials_;
+};
+
+// Writes the camera space depth into the red channel
+static const char * const kDepthVertexProgram =
+  "varying float depth;\n"
+  "void main() {\n"
+  "  depth = -(gl_ModelViewMatrix * gl_Vertex).z;\n"
+  "  gl_Position = ftransform();\n"
+  "}\n";
+
+static const char * const kDepthFragmentProgram =
+  "varying float depth;\n"
+  "void main() {\n"
+  "  gl_FragColor = vec4(depth, 0.0, 0.0, 1.0);\n"
+  "}\n";
+
+// Bakes the part labels into a vertex colour buffer. The label of a
+// vertex is the label of the bone with the largest weight on it, stored
+// in the red channel. Any vertex colours the mesh came with are
+// replaced; the lit hand materials don't use them.
+template <class BoneAssignmentIterator>
+static void BakeLabelColours(VertexData *vertex_data,
+                             BoneAssignmentIterator assignments,
+                             const vector<uint8> &bone_labels) {
+  // Baking again replaces the colour buffer of the previous bake, rather
+  // than adding another one
+  VertexDeclaration *declaration = vertex_data->vertexDeclaration;
+  VertexBufferBinding *binding = vertex_data->vertexBufferBinding;
+  const VertexElement *old_colours =
+    declaration->findElementBySemantic(VES_DIFFUSE);
+  if (old_colours) {
+    const unsigned short old_source = old_colours->getSource();
+    declaration->removeElement(VES_DIFFUSE);
+    if (declaration->findElementsBySource(old_source).empty()) {
+      binding->unsetBinding(old_source);
+    }
+  }
+
+  const size_t num_vertices = vertex_data->vertexCount;
+  const VertexElementType colour_type =
+    VertexElement::getBestColourVertexElementType();
+  const RGBA background =
+    VertexElement::convertColourValue(ColourValue::Black, colour_type);
+
+  vector<float> best_weight(num_vertices, 0);
+  vector<RGBA> colours(num_vertices, background);
+
+  while (assignments.hasMoreElements()) {
+    VertexBoneAssignment assignment = assignments.getNext();
+    size_t vertex = assignment.vertexIndex;
+
+    if (vertex >= num_vertices
+        || assignment.boneIndex >= bone_labels.size()
+        || assignment.weight <= best_weight[vertex]) {
+      continue;
+    }
+
+    best_weight[vertex] = assignment.weight;
+    colours[vertex] = VertexElement::convertColourValue
+      (ColourValue(bone_labels[assignment.boneIndex] / 255.f, 0, 0, 1),
+       colour_type);
+  }
+
+  if (!num_vertices) return;
+
+  HardwareVertexBufferSharedPtr buffer =
+    HardwareBufferManager::getSingleton().createVertexBuffer
+    (VertexElement::getTypeSize(colour_type), num_vertices,
+     HardwareBuffer::HBU_STATIC_WRITE_ONLY);
+  buffer->writeData(0, buffer->getSizeInBytes(), &colours[0], true);
+
+  unsigned short source = binding->getNextIndex();
+  declaration->addElement(source, 0, colour_type, VES_DIFFUSE);
+  binding->setBinding(source, buffer);
+}
+
+// Whether a window system is there for OGRE to create its OpenGL
+// context with
+static bool HaveDisplay() {
+#if defined(WIN32) || defined(__APPLE__)
+  return true;
+#else
+  const char *display = getenv("DISPLAY");
+  return display && *display;
+#endif
+}
+
+// The OGRE archive type of the scene bundles
+static const char * const kBundleArchiveType = "HandSceneBundle";
+
+// Serves the files of a scene bundle to the OGRE resource system straight
+// from the mapped bundle. The decoded textures are not files; they are
+// created from their pixels before the resource group is loaded.
+class BundleArchive : public Archive {
+ public:
+  BundleArchive(const String &name, const SceneBundle &bundle) :
+    Archive(name, kBundleArchiveType), bundle_(bundle) {}
+
+  bool isCaseSensitive() const { return true; }
+  void load() {}
+  void unload() {}
+
+  DataStreamPtr open(const String &filename, bool read_only = true) const {
+    const SceneBundle::Entry *entry = FindFile(filename);
+    if (!entry) {
+      OGRE_EXCEPT(Exception::ERR_FILE_NOT_FOUND,
+                  "The scene bundle " + mName + " has no file " + filename,
+                  "BundleArchive::open");
+    }
+
+    // The stream reads the mapping, which the archive keeps alive
+    return DataStreamPtr(OGRE_NEW MemoryDataStream
+                         (filename, (void *) entry->data, entry->size,
+                          false));
+  }
+
+  StringVectorPtr list(bool recursive = true, bool dirs = false) {
+    return find("*", recursive, dirs);
+  }
+
+  FileInfoListPtr listFileInfo(bool recursive = true, bool dirs = false) {
+    return findFileInfo("*", recursive, dirs);
+  }
+
+  StringVectorPtr find(const String &pattern, bool recursive = true,
+                       bool dirs = false) {
+    StringVectorPtr names(OGRE_NEW_T(StringVector, MEMCATEGORY_GENERAL)(),
+                          SPFM_DELETE_T);
+    if (dirs) return names;
+
+    for (int i = 0; i < bundle_.num_entries(); ++i) {
+      const SceneBundle::Entry &entry = bundle_.entry(i);
+      if (entry.type == SceneBundle::FILE_ENTRY
+          && StringUtil::match(entry.name, pattern, true)) {
+        names->push_back(entry.name);
+      }
+    }
+
+    return names;
+  }
+
+  // Made const by OGRE 1.8
+#if OGRE_VERSION >= 0x010800
+  FileInfoListPtr findFileInfo(const String &pattern, bool recursive = true,
+                               bool dirs = false) const {
+#else
+  FileInfoListPtr findFileInfo(const String &pattern, bool recursive = true,
+                               bool dirs = false) {
+#endif
+    FileInfoListPtr infos(OGRE_NEW_T(FileInfoList, MEMCATEGORY_GENERAL)(),
+                          SPFM_DELETE_T);
+    if (dirs) return infos;
+
+    for (int i = 0; i < bundle_.num_entries(); ++i) {
+      const SceneBundle::Entry &entry = bundle_.entry(i);
+      if (entry.type == SceneBundle::FILE_ENTRY
+          && StringUtil::match(entry.name, pattern, true)) {
+        FileInfo info;
+        info.archive = this;
+        info.filename = info.basename = entry.name;
+        info.compressedSize = info.uncompressedSize = entry.size;
+        infos->push_back(info);
+      }
+    }
+
+    return infos;
+  }
+
+  bool exists(const String &filename) { return FindFile(filename) != NULL; }
+
+  time_t getModifiedTime(const String &filename) { return 0; }
+
+ private:
+  const SceneBundle::Entry *FindFile(const String &filename) const {
+    const SceneBundle::Entry *entry = bundle_.FindEntry(filename);
+    return entry && entry->type == SceneBundle::FILE_ENTRY ? entry : NULL;
+  }
+
+  SceneBundle bundle_;
+};
+
+// Creates the archives of the scene bundles. A bundle is added before its
+// file name is added as a resource location of the bundle archive type.
+class BundleArchiveFactory : public ArchiveFactory {
+ public:
+  void AddBundle(const SceneBundle &bundle) {
+    bundles_[bundle.filename()] = bundle;
+  }
+
+  const String &getType() const {
+    static const String type = kBundleArchiveType;
+    return type;
+  }
+
+  Archive *createInstance(const String &name) {
+    map<string, SceneBundle>::iterator i = bundles_.find(name);
+    if (i == bundles_.end()) {
+      OGRE_EXCEPT(Exception::ERR_ITEM_NOT_FOUND,
+                  "No scene bundle was added as " + name,
+                  "BundleArchiveFactory::createInstance");
+    }
+
+    // The archive has its own handle on the mapping from here on
+    Archive *archive = OGRE_NEW BundleArchive(name, i->second);
+    bundles_.erase(i);
+    return archive;
+  }
+
+#if OGRE_VERSION >= 0x010800
+  Archive *createInstance(const String &name, bool read_only) {
+    return createInstance(name);
+  }
+#endif
+
+  void destroyInstance(Archive *archive) { OGRE_DELETE archive; }
+
+ private:
+  map<string, SceneBundle> bundles_;
+};
+
+// The OGRE Root is a process wide singleton, so all the HandRenderer
+// instances using the OGRE backend share it, together with its render
+// system and the hidden window that owns the OpenGL context. The
+// context is created by the first of these instances and destroyed
+// with the last one.
+class OgreContext {
+ public:
+  static boost::shared_ptr<OgreContext> Acquire();
+
+  Root *root() { return root_.get(); }
+
+  // Scene resources (meshes, materials, textures) are loaded into a
+  // resource group shared by every instance that loads a scene from the
+  // same directory, as OGRE resource names are global. Sets *is_new if
+  // the group was just created and its resources still need loading.
+  string AcquireSceneGroup(const string &scene_dir, bool *is_new);
+  void ReleaseSceneGroup(const string &group_name);
+
+  // Process wide unique numbers for the names of OGRE objects
+  int NextInstanceId();
+
+  // Makes the bundle available as a resource location of the
+  // kBundleArchiveType type, named after the bundle file
+  void AddSceneBundle(const SceneBundle &bundle);
+
+ private:
+  OgreContext();
+
+  static boost::mutex mutex_;
+  static boost::weak_ptr<OgreContext> instance_;
+
+#ifdef LOAD_OGRE_PLUGINS_STATICALLY
+  boost::shared_ptr<GLPlugin> gl_plugin_;
+  boost::shared_ptr<OctreePlugin> octree_plugin_;
+#endif
+  BundleArchiveFactory bundle_archive_factory_;   // Outlives the root
+  boost::shared_ptr<Root> root_;
+
+  map<string, int> scene_group_users_;
+  int next_instance_id_;
+
+  // Disallow
+  OgreContext(const OgreContext &rhs);
+  OgreContext& operator= (const OgreContext &rhs);
+};
+
+boost::mutex OgreContext::mutex_;
+boost::weak_ptr<OgreContext> OgreContext::instance_;
+
+boost::shared_ptr<OgreContext> OgreContext::Acquire() {
+  boost::mutex::scoped_lock lock(mutex_);
+
+  boost::shared_ptr<OgreContext> context = instance_.lock();
+  if (!context) {
+    context.reset(new OgreContext);
+    instance_ = context;
+  }
+
+  return context;
+}
+
+OgreContext::OgreContext() : next_instance_id_(0) {
+#ifdef LOAD_OGRE_PLUGINS_STATICALLY
+  gl_plugin_.reset(new GLPlugin);
+  octree_plugin_.reset(new OctreePlugin);
+#endif
+
+  root_.reset(new Root("", "", "hand_renderer.log"));
+  ArchiveManager::getSingleton().addArchiveFactory(&bundle_archive_factory_);
+
+#ifdef LOAD_OGRE_PLUGINS_STATICALLY
+  root_->installPlugin(gl_plugin_.get());
+  root_->installPlugin(octree_plugin_.get());
+#else
+  // Only the render system and the generic (octree) scene manager are
+  // used, so the portal zone plugins are not loaded at all, which saves
+  // on the start up time.
+  #ifdef WIN32
+    //FIXME: Windows build currently only supports Release build (Debug needs _d appended to the strings) 
+    root_->loadPlugin("RenderSystem_Direct3D9");
+  #elif __APPLE__
+    root_->loadPlugin("/usr/local/opt/ogre/lib/libRenderSystem_GL");
+  #else
+    root_->loadPlugin("RenderSystem_GL");
+  #endif
+  #ifdef __APPLE__
+    root_->loadPlugin("/usr/local/opt/ogre/lib/libPlugin_OctreeSceneManager");
+  #else
+    root_->loadPlugin("Plugin_OctreeSceneManager");
+  #endif
+#endif
+
+  RenderSystemList render_systems = root_->getAvailableRenderers();
+  if (!render_systems.size()) {
+    throw runtime_error("No rendersystem found..");
+  }
+
+  RenderSystem *render_system = render_systems[0];
+  root_->setRenderSystem(render_system);
+
+  root_->initialise(false, "");
+
+  NameValuePairList window_params;
+  window_params["macAPI"] = "cocoa";
+
+  RenderWindow *window = root_->createRenderWindow("HandRenderer Window",
+                                                   1, 1,
+                                                   false,
+                                                   &window_params);
+  window->setVisible(false);
+}
+
+string OgreContext::AcquireSceneGroup(const string &scene_dir,
+                                      bool *is_new) {
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const string group_name = "HandRenderer Scene Resources " + scene_dir;
+  int &num_users = scene_group_users_[group_name];
+
+  *is_new = !num_users;
+  if (*is_new) {
+    ResourceGroupManager::getSingleton().createResourceGroup(group_name);
+  }
+  ++num_users;
+
+  return group_name;
+}
+
+void OgreContext::ReleaseSceneGroup(const string &group_name) {
+  boost::mutex::scoped_lock lock(mutex_);
+
+  map<string, int>::iterator i = scene_group_users_.find(group_name);
+  if (i == scene_group_users_.end()) return;
+
+  if (--i->second == 0) {
+    ResourceGroupManager::getSingleton().destroyResourceGroup(group_name);
+    scene_group_users_.erase(i);
+  }
+}
+
+int OgreContext::NextInstanceId() {
+  boost::mutex::scoped_lock lock(mutex_);
+  return next_instance_id_++;
+}
+
+void OgreContext::AddSceneBundle(const SceneBundle &bundle) {
+  boost::mutex::scoped_lock lock(mutex_);
+  bundle_archive_factory_.AddBundle(bundle);
+}
+
+// The fixed point BT.601 luminance weights cv::cvtColor() uses for
+// 8-bit images, and its rounding
+static const int kLumaShift = 14;
+static const int kLumaBlue = 1868;
+static const int kLumaGreen = 9617;
+static const int kLumaRed = 4899;
+static const int kLumaRound = 1 << (kLumaShift - 1);
+
+// The luminance of a BGR888 pixel, or of a single channel one
+static inline int Luma(const unsigned char *pixel, int channels) {
+  if (channels == 1) return pixel[0];
+
+  return (kLumaBlue * pixel[0] + kLumaGreen * pixel[1] + kLumaRed * pixel[2]
+          + kLumaRound) >> kLumaShift;
+}
+
+// Converts a BGR888 (3 channels) or a luminance (1 channel) frame into
+// one of the single channel output formats in a single pass
+static void ConvertFrame(const unsigned char *src, size_t src_stride,
+                         int src_channels, int width, int height,
+                         HandRenderer::OutputFormat output_format,
+                         unsigned char *dst, size_t stride) {
+  for (int row = 0; row < height; ++row) {
+    const unsigned char *pixel = src + row * src_stride;
+    unsigned char *dst_row = dst + row * stride;
+
+    switch (output_format) {
+    case HandRenderer::GRAY_FORMAT:
+      for (int x = 0; x < width; ++x, pixel += src_channels) {
+        dst_row[x] = Luma(pixel, src_channels);
+      }
+      break;
+    case HandRenderer::MASK_FORMAT:
+      for (int x = 0; x < width; ++x, pixel += src_channels) {
+        dst_row[x] = Luma(pixel, src_channels) ? 255 : 0;
+      }
+      break;
+    case HandRenderer::PACKED_MASK_FORMAT:
+      {
+        unsigned char bits = 0;
+        for (int x = 0; x < width; ++x, pixel += src_channels) {
+          bits = (bits << 1) | (Luma(pixel, src_channels) != 0);
+          if (x % 8 == 7) {
+            *dst_row++ = bits;
+            bits = 0;
+          }
+        }
+        if (width % 8) *dst_row = bits << (8 - width % 8);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
 class HandRendererPrivate {
  public:
   HandRendererPrivate();
+  ~HandRendererPrivate();
 
   static const int kDefaultWidth = HandRenderer::kDefaultWidth;
   static const int kDefaultHeight = HandRenderer::kDefaultHeight;
   
   void Setup(int width = kDefaultWidth,
-             int height = kDefaultHeight);
+             int height = kDefaultHeight,
+             HandRenderer::Backend backend = HandRenderer::OGRE_BACKEND);
+  HandRenderer::Backend backend() const { return backend_; }
 
   void SetRenderSize(int width = kDefaultWidth,
                      int height = kDefaultHeight);
+  void PrewarmRenderSizes(const vector<cv::Size> &sizes);
+  void ClearRenderSizePool();
 
   void LoadScene(const SceneSpec &scene_spec);
+  void LoadScene(const SceneBundle &bundle);
 
   void SetHandPose(const FullHandPose &hand_pose, bool update_camera);
 
   void RenderHand();
 
+  void RenderHandInto(cv::Mat &dst);
+  void RenderHandInto(void *dst, size_t stride);
+
+  void RenderBatch(const vector<FullHandPose> &hand_poses,
+                   const vector<HandCameraSpec> &camera_specs,
+                   char *batch_buffer);
+  void RenderViews(const FullHandPose &hand_pose,
+                   const vector<HandCameraSpec> &camera_specs,
+                   char *views_buffer);
+
+  void SetAtlasLayout(int columns, int rows);
+  void RenderAtlas(const vector<FullHandPose> &hand_poses,
+                   const vector<HandCameraSpec> &camera_specs,
+                   vector<cv::Mat> *cells);
+  const cv::Mat atlas_buffer_cv() const;
+
+  void SetAsyncDepth(int num_targets);
+  int async_depth() const { return async_depth_; }
+  int SubmitFrame(const FullHandPose &hand_pose,
+                  const HandCameraSpec &camera_spec);
+  bool PollFrame(int ticket) const;
+  void FetchFrame(int ticket, cv::Mat *dst);
+
   int render_width() { return render_width_; }
   int render_height() { return render_height_; }
 
+  void set_output_format(HandRenderer::OutputFormat output_format);
+  HandRenderer::OutputFormat output_format() const {
+    return output_format_;
+  }
+
+  size_t frame_row_bytes() const;
+  size_t frame_bytes() const {
+    return frame_row_bytes() * render_height_;
+  }
+
   const char *pixel_buffer_raw() const {
     return pixel_data_.get();
   }
 
-  const cv::Mat pixel_buffer_cv() const;
+  const cv::Mat pixel_buffer_cv() const { return FrameCv(pixel_data_.get()); }
+  const cv::Mat keypoint_buffer_cv() const;
+
+  void set_depth_enabled(bool depth_enabled) {
+    SetLayerEnabled(kDepthLayer, depth_enabled);
+  }
+  bool depth_enabled() const { return layers_[kDepthLayer].enabled; }
+  const cv::Mat depth_buffer_cv() const { return LayerCv(kDepthLayer); }
+
+  void set_labels_enabled(bool labels_enabled) {
+    SetLayerEnabled(kLabelLayer, labels_enabled);
+  }
+  bool labels_enabled() const { return layers_[kLabelLayer].enabled; }
+  const cv::Mat label_buffer_cv() const { return LayerCv(kLabelLayer); }
+
+  void set_auto_crop(bool auto_crop, float margin);
+  bool auto_crop() const { return auto_crop_; }
+  cv::Rect_<float> crop_rect() const { return crop_rect_; }
+
+  void set_auto_lod(bool auto_lod);
+  bool auto_lod() const { return auto_lod_; }
+  int lod_level() const { return lod_level_; }
+
+  void set_silhouette_mode(bool silhouette_mode);
+  bool silhouette_mode() const { return silhouette_mode_; }
 
   float initial_cam_distance() const { return initial_cam_distance_; }
   float CameraHandDistance();
@@ -95,9 +650,123 @@ class HandRendererPrivate {
   }
 
  private:
+  // A render target in the asynchronous ring
+  struct AsyncSlot {
+    TexturePtr texture;
+    RenderTexture *target;
+    boost::shared_array<char> pixel_data;
+    int ticket;       // -1 if the slot is free
+    bool read_back;   // true if pixel_data holds the frame
+
+    AsyncSlot() : target(NULL), ticket(-1), read_back(false) {}
+  };
+
+  // A cell of the atlas, with its own clone of the hand entity
+  struct AtlasCell {
+    Entity *entity;
+    Camera *camera;
+    std::vector<Bone *> bones;
+    FullHandPose applied_pose;
+    bool pose_is_applied;
+
+    AtlasCell() : entity(NULL), camera(NULL), pose_is_applied(false) {}
+  };
+
+  // Additional outputs of the same frame as the colour image, seen by the
+  // same camera. Every layer is a separate draw of the hand into a render
+  // target of its own, with a different material scheme.
+  enum LayerType {
+    kDepthLayer = 0,
+    kLabelLayer,
+    kNumLayers
+  };
+
+  struct RenderLayer {
+    string scheme;
+    PixelFormat format;
+    PixelFormat read_format;
+    int cv_type;
+    int bytes_per_pixel;
+    bool enabled;
+    TexturePtr texture;
+    RenderTexture *target;
+    boost::shared_array<char> data;
+
+    RenderLayer() : format(PF_UNKNOWN), read_format(PF_UNKNOWN),
+                    cv_type(0), bytes_per_pixel(0),
+                    enabled(false), target(NULL) {}
+  };
+
+  // The render targets and the buffers of a render size other than the
+  // current one. The targets have no viewports while they are pooled.
+  struct PooledSize {
+    TexturePtr texture;
+    RenderTexture *target;
+    boost::shared_array<char> pixel_data;
+    boost::shared_array<char> readback_data;
+    // Only the texture, the target and the data of the layers are used
+    RenderLayer layers[kNumLayers];
+    int last_used;
+
+    PooledSize() : target(NULL), last_used(0) {}
+  };
+  typedef std::map<std::pair<int, int>, PooledSize> SizePool;
+
   void SetRenderSizeInternal(int width, int height);
+  void PoolCurrentSize();
+  bool TakePooledSize(int width, int height);
+  void DestroyPooledSize(PooledSize &pooled);
+  void TrimSizePool();
+  void LoadScene(const SceneSpec &scene_spec, const SceneBundle *bundle);
+  void LoadBundleTextures(const SceneBundle &bundle);
+  TexturePtr CreateRenderTexture(const string &name, int width, int height);
+  Viewport *AttachViewport(RenderTarget *target, const string &scheme = "");
+  void SetLayerEnabled(LayerType layer_type, bool enabled);
+  void CreateLayerTarget(RenderLayer &layer, int width, int height);
+  void DestroyLayerTarget(RenderLayer &layer);
+  MaterialPtr CreateSchemeMaterial(LayerType layer_type);
+  MaterialPtr CreateSilhouetteMaterial();
+  void SetFrameScheme(Viewport *viewport);
+  void ReadLayers();
+  void AddLabelColours(const SceneSpec &scene_spec);
+  void BindSkeleton(const SceneSpec &scene_spec);
+  const cv::Mat LayerCv(LayerType layer_type) const;
+  void CreateAsyncRing();
+  void DestroyAsyncRing();
+  size_t FindAsyncSlot(int ticket) const;
+  void CreateAtlas();
+  void DestroyAtlas();
+  void CreateAtlasCells();
+  void SelectLod();
+  size_t LodNumTriangles(int level) const;
+  void DestroyAtlasCells();
+  size_t atlas_stride() const { return 3 * atlas_columns_ * render_width_; }
+  char *atlas_cell_data(int cell) const;
   void DestroyScene();
   void InitChecks();
+  void CheckPose(const FullHandPose &hand_pose);
+  void ApplyPose(const FullHandPose &hand_pose);
+  static void PoseBones(const std::vector<Bone *> &bones,
+                        const FullHandPose &hand_pose,
+                        const FullHandPose *applied_pose);
+  void PositionCamera(const HandCameraSpec &camera_spec);
+  void ProjectSkeleton(const HandCameraSpec &camera_spec,
+                       vector<float> *points);
+  void CropView(const HandCameraSpec &camera_spec, bool with_crop);
+  void RenderFrame(const HandCameraSpec &camera_spec,
+                   bool with_layers = false,
+                   bool with_crop = false);
+  void ReadFrame(RenderTarget *target, char *dst);
+  void ReadFrame(RenderTarget *target, char *dst, size_t stride);
+  void ReadBgrFrame(RenderTarget *target, char *dst);
+  void ReadBgrFrame(RenderTarget *target, char *dst, size_t stride);
+  void ReadSilhouette(RenderTarget *target, char *dst, size_t stride);
+  char *readback_data();
+  size_t bgr_frame_bytes() const {
+    return (size_t) 3 * render_width_ * render_height_;
+  }
+  const cv::Mat FrameCv(const char *data) const;
+  void ProjectKeypoints();
 
   Vector3 CamPositionRelativeToHand();
 
@@ -106,22 +775,36 @@ class HandRendererPrivate {
 #endif
 
   bool renderer_is_setup_;
+  HandRenderer::Backend backend_;
   bool scene_is_loaded_;
 
   int render_width_;
   int render_height_;
 
-  const string render_tex_rsrc_name_;
-  const string render_tex_name_;
+  string render_tex_rsrc_name_;
+  string render_tex_name_;
 
-  const string scene_rsrc_name_;
+  // Empty while no scene is loaded
+  string scene_rsrc_name_;
 
+  // Large enough for a BGR888 frame, whatever the output format
   boost::shared_array<char> pixel_data_;
-#ifdef LOAD_OGRE_PLUGINS_STATICALLY
-  boost::shared_ptr<GLPlugin> gl_plugin_;
-  boost::shared_ptr<OctreePlugin> octree_plugin_;
-#endif
-  boost::shared_ptr<Root> root_;
+  // Where the OGRE backend reads the BGR888 frames back to, when they
+  // have to be converted or copied before they reach their destination.
+  // Allocated on demand.
+  boost::shared_array<char> readback_data_;
+  HandRenderer::OutputFormat output_format_;
+  SchemeListener scheme_listener_;
+
+  boost::shared_ptr<OgreContext> ogre_context_;
+  // Declared after the context, so that a pooled texture is never
+  // released after it. The destructor empties the pool anyway.
+  SizePool size_pool_;
+  int size_pool_clock_;
+
+  // Set only for the SOFTWARE_BACKEND, which then replaces all of the
+  // OGRE objects below
+  boost::shared_ptr<SoftwareRenderer> software_;
 
   SceneSpec scene_spec_;
 
@@ -137,11 +820,49 @@ class HandRendererPrivate {
   Entity *hand_entity_;
   Node *hand_node_;
   SkeletonInstance *hand_skeleton_;
+  // The pose the skeleton is in, valid if pose_is_applied_
+  FullHandPose applied_pose_;
+  bool pose_is_applied_;
 
   float initial_cam_distance_;
   HandCameraSpec camera_spec_;
 
+  bool auto_crop_;
+  float crop_margin_;
+  cv::Rect_<float> crop_rect_;
+  bool frustum_is_cropped_;
+
+  bool auto_lod_;
+  int lod_level_;
+
+  bool silhouette_mode_;
+
   std::vector<Bone *> bone_by_index_;
+  // The label of the part each bone map joint connects to, see
+  // SoftwareRenderer::joint_parent_labels()
+  std::vector<uint8> joint_parent_labels_;
+
+  // x, y, depth, visible per bone map bone, of the last RenderHand()
+  std::vector<float> keypoints_;
+
+  int async_depth_;
+  int next_ticket_;
+  std::vector<AsyncSlot> async_ring_;
+
+  int atlas_columns_;
+  int atlas_rows_;
+  TexturePtr atlas_texture_;
+  RenderTexture *atlas_target_;
+  boost::shared_array<char> atlas_data_;
+  // Created on demand, once a scene is loaded
+  std::vector<AtlasCell> atlas_cells_;
+
+  RenderLayer layers_[kNumLayers];
+  // The hand mesh is shared by every instance that loaded the scene, so
+  // the part labels are baked into a copy of it owned by this instance.
+  // Null until the labels are first needed.
+  string label_mesh_name_;
+  MeshPtr label_mesh_;
 
   // Disallow
   HandRendererPrivate(const HandRendererPrivate &rhs);
@@ -152,21 +873,94 @@ class HandRendererPrivate {
 HandRenderer::HandRenderer() : private_(new HandRendererPrivate) {}
 HandRenderer::~HandRenderer() { delete private_; }
 
-void HandRenderer::Setup(int width, int height) {
-  private_->Setup(width, height);
+void HandRenderer::Setup(int width, int height, Backend backend) {
+  private_->Setup(width, height, backend);
+}
+HandRenderer::Backend HandRenderer::backend() const {
+  return private_->backend();
 }
 void HandRenderer::SetRenderSize(int width, int height) {
   private_->SetRenderSize(width, height);
 }
+void HandRenderer::PrewarmRenderSizes(const vector<cv::Size> &sizes) {
+  private_->PrewarmRenderSizes(sizes);
+}
+void HandRenderer::ClearRenderSizePool() {
+  private_->ClearRenderSizePool();
+}
 void HandRenderer::LoadScene(const SceneSpec &scene_spec) {
   private_->LoadScene(scene_spec);
 }
+
+void HandRenderer::LoadScene(const SceneBundle &bundle) {
+  private_->LoadScene(bundle);
+}
 void HandRenderer::SetHandPose(const FullHandPose &hand_pose,
                                bool update_camera) {
   private_->SetHandPose(hand_pose, update_camera);
 }
 void HandRenderer::RenderHand() { private_->RenderHand(); }
+void HandRenderer::SetAsyncDepth(int num_targets) {
+  private_->SetAsyncDepth(num_targets);
+}
+int HandRenderer::async_depth() const { return private_->async_depth(); }
+int HandRenderer::SubmitFrame(const FullHandPose &hand_pose,
+                              const HandCameraSpec &camera_spec) {
+  return private_->SubmitFrame(hand_pose, camera_spec);
+}
+bool HandRenderer::PollFrame(int ticket) const {
+  return private_->PollFrame(ticket);
+}
+void HandRenderer::FetchFrame(int ticket, cv::Mat *dst) {
+  private_->FetchFrame(ticket, dst);
+}
+void HandRenderer::RenderHandInto(cv::Mat &dst) {
+  private_->RenderHandInto(dst);
+}
+void HandRenderer::RenderHandInto(void *dst, size_t stride) {
+  private_->RenderHandInto(dst, stride);
+}
+void HandRenderer::RenderBatch(const vector<FullHandPose> &hand_poses,
+                               const vector<HandCameraSpec> &camera_specs,
+                               char *batch_buffer) {
+  private_->RenderBatch(hand_poses, camera_specs, batch_buffer);
+}
+void HandRenderer::RenderViews(const FullHandPose &hand_pose,
+                               const vector<HandCameraSpec> &camera_specs,
+                               char *views_buffer) {
+  private_->RenderViews(hand_pose, camera_specs, views_buffer);
+}
+void HandRenderer::SetAtlasLayout(int columns, int rows) {
+  private_->SetAtlasLayout(columns, rows);
+}
+void HandRenderer::RenderAtlas(const vector<FullHandPose> &hand_poses,
+                               const vector<HandCameraSpec> &camera_specs,
+                               vector<cv::Mat> *cells) {
+  private_->RenderAtlas(hand_poses, camera_specs, cells);
+}
+const cv::Mat HandRenderer::atlas_buffer_cv() const {
+  return private_->atlas_buffer_cv();
+}
 
+void HandRenderer::set_auto_crop(bool auto_crop, float margin) {
+  private_->set_auto_crop(auto_crop, margin);
+}
+bool HandRenderer::auto_crop() const { return private_->auto_crop(); }
+cv::Rect_<float> HandRenderer::crop_rect() const {
+  return private_->crop_rect();
+}
+
+void HandRenderer::set_auto_lod(bool auto_lod) {
+  private_->set_auto_lod(auto_lod);
+}
+bool HandRenderer::auto_lod() const { return private_->auto_lod(); }
+int HandRenderer::lod_level() const { return private_->lod_level(); }
+void HandRenderer::set_silhouette_mode(bool silhouette_mode) {
+  private_->set_silhouette_mode(silhouette_mode);
+}
+bool HandRenderer::silhouette_mode() const {
+  return private_->silhouette_mode();
+}
 float HandRenderer::initial_cam_distance() const {
   return private_->initial_cam_distance();
 }
@@ -179,6 +973,16 @@ void HandRenderer::set_camera_spec(const HandCameraSpec &camera_spec) {
 
 int HandRenderer::render_width() const { return private_->render_width(); }
 int HandRenderer::render_height() const { return private_->render_height(); }
+void HandRenderer::set_output_format(OutputFormat output_format) {
+  private_->set_output_format(output_format);
+}
+HandRenderer::OutputFormat HandRenderer::output_format() const {
+  return private_->output_format();
+}
+size_t HandRenderer::frame_row_bytes() const {
+  return private_->frame_row_bytes();
+}
+size_t HandRenderer::frame_bytes() const { return private_->frame_bytes(); }
 
 const char *HandRenderer::pixel_buffer_raw() const {
   return private_->pixel_buffer_raw();
@@ -186,20 +990,37 @@ const char *HandRenderer::pixel_buffer_raw() const {
 const cv::Mat HandRenderer::pixel_buffer_cv() const {
   return private_->pixel_buffer_cv();
 }
+const cv::Mat HandRenderer::keypoint_buffer_cv() const {
+  return private_->keypoint_buffer_cv();
+}
+void HandRenderer::set_labels_enabled(bool labels_enabled) {
+  private_->set_labels_enabled(labels_enabled);
+}
+bool HandRenderer::labels_enabled() const {
+  return private_->labels_enabled();
+}
+const cv::Mat HandRenderer::label_buffer_cv() const {
+  return private_->label_buffer_cv();
+}
+void HandRenderer::set_depth_enabled(bool depth_enabled) {
+  private_->set_depth_enabled(depth_enabled);
+}
+bool HandRenderer::depth_enabled() const {
+  return private_->depth_enabled();
+}
+const cv::Mat HandRenderer::depth_buffer_cv() const {
+  return private_->depth_buffer_cv();
+}
 // End of forwarding HandRenderer calls to HandRendererPrivate
 
 HandRendererPrivate::HandRendererPrivate() :
   renderer_is_setup_(false),
+  backend_(HandRenderer::AUTO_BACKEND),
   scene_is_loaded_(false),
   render_width_(0),
   render_height_(0),
-  render_tex_rsrc_name_("HandRenderer RenderTexture Resources"),
-  render_tex_name_("HandRenderer RenderTexture"),
-  scene_rsrc_name_("HandRenderer Scene Resources"),
-#ifdef LOAD_OGRE_PLUGINS_STATICALLY
-  gl_plugin_(new GLPlugin),
-  octree_plugin_(new OctreePlugin),
-#endif
+  output_format_(HandRenderer::BGR_FORMAT),
+  size_pool_clock_(0),
   scene_mgr_(NULL),
   resource_mgr_(NULL),
   render_target_(NULL),
@@ -209,10 +1030,55 @@ HandRendererPrivate::HandRendererPrivate() :
   hand_entity_(NULL),
   hand_node_(NULL),
   hand_skeleton_(NULL),
-  initial_cam_distance_(0) {
+  pose_is_applied_(false),
+  initial_cam_distance_(0),
+  auto_crop_(false),
+  crop_margin_(HandRenderer::kDefaultCropMargin),
+  frustum_is_cropped_(false),
+  auto_lod_(true),
+  lod_level_(0),
+  silhouette_mode_(false),
+  async_depth_(0),
+  next_ticket_(0),
+  atlas_columns_(0),
+  atlas_rows_(0),
+  atlas_target_(NULL) {
+  RenderLayer &depth_layer = layers_[kDepthLayer];
+  depth_layer.scheme = "HandRenderer Depth";
+  depth_layer.format = PF_FLOAT32_R;
+  depth_layer.read_format = PF_FLOAT32_R;
+  depth_layer.cv_type = CV_32FC1;
+  depth_layer.bytes_per_pixel = sizeof(float);
+
+  // The labels are rendered into the red channel only. Reading that back
+  // as luminance gives the exact label regardless of whether the
+  // conversion is done by OGRE or by the GL driver.
+  RenderLayer &label_layer = layers_[kLabelLayer];
+  label_layer.scheme = "HandRenderer Labels";
+  label_layer.format = PF_B8G8R8;
+  label_layer.read_format = PF_L8;
+  label_layer.cv_type = CV_8UC1;
+  label_layer.bytes_per_pixel = 1;
+}
+
+HandRendererPrivate::~HandRendererPrivate() {
+  if (!ogre_context_) return;
+
+  // The pooled targets are in the render texture resource group
+  ClearRenderSizePool();
+  if (scene_is_loaded_) DestroyScene();
+
+  MaterialManager::getSingleton().removeListener(&scheme_listener_);
+  scheme_listener_.Clear();
+  ogre_context_->root()->destroySceneManager(scene_mgr_);
+
+  // Takes the render textures, the scheme materials and their programs
+  // along with it
+  resource_mgr_->destroyResourceGroup(render_tex_rsrc_name_);
 }
 
-void HandRendererPrivate::Setup(int width, int height) {
+void HandRendererPrivate::Setup(int width, int height,
+                                HandRenderer::Backend backend) {
   if (width <= 0 || height <= 0) {
     throw runtime_error("Bad HandRenderer render width or height");
   }
@@ -222,65 +1088,53 @@ void HandRendererPrivate::Setup(int width, int height) {
     return;
   }
 
-#ifdef LOAD_OGRE_PLUGINS_STATICALLY
-  gl_plugin_.reset(new GLPlugin);
-  octree_plugin_.reset(new OctreePlugin);
-#endif
+  // With AUTO_BACKEND a missing display, or an OGRE that fails to
+  // start, means the software backend.
+  const bool may_fall_back = backend == HandRenderer::AUTO_BACKEND;
+  if (may_fall_back) {
+    backend = HaveDisplay() ? HandRenderer::OGRE_BACKEND
+                            : HandRenderer::SOFTWARE_BACKEND;
+  }
 
-root_.reset(new Root("", "", "hand_renderer.log"));
+  if (backend == HandRenderer::OGRE_BACKEND) {
+    try {
+      ogre_context_ = OgreContext::Acquire();
+    } catch (const std::exception &e) {
+      if (!may_fall_back) throw;
 
-#ifdef LOAD_OGRE_PLUGINS_STATICALLY
-  root_->installPlugin(gl_plugin_.get());
-  root_->installPlugin(octree_plugin_.get());
-#else
-  #ifdef __APPLE__
-    root_->loadPlugin("/usr/local/opt/ogre/lib/libPlugin_OctreeZone");
-    root_->loadPlugin("/usr/local/opt/ogre/lib/libPlugin_PCZSceneManager");
-  #else
-    root_->loadPlugin("Plugin_OctreeZone");
-    root_->loadPlugin("Plugin_PCZSceneManager");
-  #endif
-  #ifdef WIN32
-    //FIXME: Windows build currently only supports Release build (Debug needs _d appended to the strings) 
-    root_->loadPlugin("RenderSystem_Direct3D9");
-  #elif __APPLE__
-    root_->loadPlugin("/usr/local/opt/ogre/lib/libRenderSystem_GL");
-  #else
-    root_->loadPlugin("RenderSystem_GL");
-  #endif
-  #ifdef __APPLE__
-    root_->loadPlugin("/usr/local/opt/ogre/lib/libPlugin_OctreeSceneManager");
-  #else
-    root_->loadPlugin("Plugin_OctreeSceneManager");
-  #endif
-#endif
-
-  RenderSystemList render_systems = root_->getAvailableRenderers();
-  if (!render_systems.size()) {
-    throw runtime_error("No rendersystem found..");
+      // backend() tells the caller about the fall back, this tells why
+      cerr << "HandRenderer: OGRE did not start, using the software "
+           << "backend: " << e.what() << endl;
+      backend = HandRenderer::SOFTWARE_BACKEND;
+    }
   }
 
-  RenderSystem *render_system = render_systems[0];
-  root_->setRenderSystem(render_system);
+  backend_ = backend;
 
-  render_system = root_->getRenderSystem();
+  if (backend == HandRenderer::SOFTWARE_BACKEND) {
+    software_.reset(new SoftwareRenderer);
+    SetRenderSizeInternal(width, height);
 
-  root_->initialise(false, "");
+    renderer_is_setup_ = true;
+    return;
+  }
+
+  // Every instance names its OGRE objects uniquely, so that instances
+  // sharing the context don't step on each other
+  const int instance_id = ogre_context_->NextInstanceId();
+  render_tex_rsrc_name_ = PrintFString("HandRenderer RenderTexture "
+                                       "Resources %d", instance_id);
+  render_tex_name_ = PrintFString("HandRenderer RenderTexture %d",
+                                  instance_id);
+  label_mesh_name_ = PrintFString("HandRenderer Label Mesh %d", instance_id);
 
-  scene_mgr_ = root_->createSceneManager(Ogre::ST_GENERIC);
+  scene_mgr_ = ogre_context_->root()->createSceneManager(Ogre::ST_GENERIC);
 
   resource_mgr_ = ResourceGroupManager::getSingletonPtr();
   resource_mgr_->createResourceGroup(render_tex_rsrc_name_);
   resource_mgr_->initialiseResourceGroup(render_tex_rsrc_name_);
 
-  NameValuePairList window_params;
-  window_params["macAPI"] = "cocoa";
-
-  RenderWindow *window = root_->createRenderWindow("HandRenderer Window",
-                                                   1, 1,
-                                                   false,
-                                                   &window_params);
-  window->setVisible(false);
+  MaterialManager::getSingleton().addListener(&scheme_listener_);
 
   SetRenderSizeInternal(width, height);
 
@@ -288,20 +1142,594 @@ root_.reset(new Root("", "", "hand_renderer.log"));
 }
 
 void HandRendererPrivate::SetRenderSizeInternal(int width, int height) {
-  pixel_data_.reset(new char[3 * width * height]);
+  const bool is_pooled = TakePooledSize(width, height);
+  render_width_ = width; render_height_ = height;
+
+  if (!is_pooled) {
+    pixel_data_.reset(new char[bgr_frame_bytes()]);
+  }
+
+  if (software_) {
+    software_->SetRenderSize(width, height);
+  } else {
+    if (!is_pooled) {
+      output_texture_ =
+        CreateRenderTexture(PrintFString("%s %dx%d", render_tex_name_.c_str(),
+                                         width, height),
+                            width, height);
+      render_target_ = output_texture_->getBuffer()->getRenderTarget();
+      // Rendered on demand only, see RenderFrame()
+      render_target_->setAutoUpdated(false);
+    }
+
+    if (scene_is_loaded_) {
+      viewport_ = AttachViewport(render_target_);
+    }
+  }
+
+  for (int i = 0; i < kNumLayers; ++i) {
+    RenderLayer &layer = layers_[i];
+    if (!layer.enabled) continue;
+
+    if (!layer.data) CreateLayerTarget(layer, width, height);
+    if (layer.target && scene_is_loaded_) {
+      AttachViewport(layer.target, layer.scheme);
+    }
+  }
+
+  CreateAsyncRing();
+  CreateAtlas();
+  SelectLod();
+}
+
+// Moves the render targets and the buffers of the current size into the
+// pool
+void HandRendererPrivate::PoolCurrentSize() {
+  PooledSize &pooled =
+    size_pool_[std::make_pair(render_width_, render_height_)];
+  pooled.last_used = ++size_pool_clock_;
+
+  if (render_target_) render_target_->removeAllViewports();
+  pooled.texture = output_texture_;
+  pooled.target = render_target_;
+  pooled.pixel_data = pixel_data_;
+  pooled.readback_data = readback_data_;
+  output_texture_.setNull();
+  render_target_ = NULL;
+  viewport_ = NULL;
+  pixel_data_.reset();
+  readback_data_.reset();
+
+  for (int i = 0; i < kNumLayers; ++i) {
+    RenderLayer &layer = layers_[i];
+    if (layer.target) layer.target->removeAllViewports();
+
+    pooled.layers[i].texture = layer.texture;
+    pooled.layers[i].target = layer.target;
+    pooled.layers[i].data = layer.data;
+    layer.texture.setNull();
+    layer.target = NULL;
+    layer.data.reset();
+  }
+
+  TrimSizePool();
+}
+
+// Makes the pooled render targets and buffers of the size current, if
+// the size is in the pool. The layers enabled since the size was pooled
+// are left to the caller to create.
+bool HandRendererPrivate::TakePooledSize(int width, int height) {
+  SizePool::iterator found = size_pool_.find(std::make_pair(width, height));
+  if (found == size_pool_.end()) return false;
+
+  PooledSize &pooled = found->second;
+  output_texture_ = pooled.texture;
+  render_target_ = pooled.target;
+  pixel_data_ = pooled.pixel_data;
+  readback_data_ = pooled.readback_data;
+
+  for (int i = 0; i < kNumLayers; ++i) {
+    RenderLayer &layer = layers_[i];
+    if (!layer.enabled) {
+      DestroyLayerTarget(pooled.layers[i]);
+      continue;
+    }
+
+    layer.texture = pooled.layers[i].texture;
+    layer.target = pooled.layers[i].target;
+    layer.data = pooled.layers[i].data;
+  }
+
+  size_pool_.erase(found);
+  return true;
+}
+
+void HandRendererPrivate::DestroyPooledSize(PooledSize &pooled) {
+  if (!pooled.texture.isNull()) {
+    TextureManager::getSingleton().remove(pooled.texture->getName());
+  }
+
+  for (int i = 0; i < kNumLayers; ++i) {
+    DestroyLayerTarget(pooled.layers[i]);
+  }
+}
+
+// Drops the least recently used sizes while the pool, with the current
+// size, holds more than kMaxPooledRenderSizes of them
+void HandRendererPrivate::TrimSizePool() {
+  while (size_pool_.size() + 1 > (size_t) HandRenderer::kMaxPooledRenderSizes
+         && !size_pool_.empty()) {
+    SizePool::iterator oldest = size_pool_.begin();
+    for (SizePool::iterator i = size_pool_.begin(); i != size_pool_.end();
+         ++i) {
+      if (i->second.last_used < oldest->second.last_used) oldest = i;
+    }
+
+    DestroyPooledSize(oldest->second);
+    size_pool_.erase(oldest);
+  }
+}
+
+TexturePtr HandRendererPrivate::CreateRenderTexture(const string &name,
+                                                    int width, int height) {
+  return TextureManager::getSingleton().createManual(name,
+                                                     render_tex_rsrc_name_,
+                                                     TEX_TYPE_2D,
+                                                     width, height,
+                                                     0,
+                                                     PF_B8G8R8,
+                                                     TU_RENDERTARGET,
+                                                     0, false, false);
+}
+
+Viewport *HandRendererPrivate::AttachViewport(RenderTarget *target,
+                                              const string &scheme) {
+  Viewport *viewport = target->addViewport(camera_);
+  viewport->setBackgroundColour(ColourValue(0, 0, 0));
+  viewport->setVisibilityMask(kMainHandFlag);
+
+  if (!scheme.empty()) {
+    viewport->setMaterialScheme(scheme);
+    viewport->setOverlaysEnabled(false);
+    viewport->setSkiesEnabled(false);
+    viewport->setShadowsEnabled(false);
+  } else {
+    SetFrameScheme(viewport);
+  }
+
+  return viewport;
+}
+
+// The viewports of the frame itself (not of the layers) switch to the
+// silhouette material in the silhouette mode
+void HandRendererPrivate::SetFrameScheme(Viewport *viewport) {
+  viewport->setMaterialScheme(silhouette_mode_ ?
+                              String(kSilhouetteScheme) :
+                              MaterialManager::DEFAULT_SCHEME_NAME);
+}
+
+void HandRendererPrivate::SetLayerEnabled(LayerType layer_type,
+                                          bool enabled) {
+  RenderLayer &layer = layers_[layer_type];
+  if (layer.enabled == enabled) return;
+
+  if (!renderer_is_setup_) {
+    Setup(kDefaultWidth, kDefaultHeight);
+  }
+
+  if (enabled) {
+    // The software renderer draws every layer without any preparation
+    if (!software_
+        && !scheme_listener_.has_scheme_material(layer.scheme)) {
+      scheme_listener_.set_scheme_material(layer.scheme,
+                                           CreateSchemeMaterial(layer_type));
+    }
+
+    if (!software_ && layer_type == kLabelLayer && scene_is_loaded_) {
+      AddLabelColours(scene_spec_);
+      BindSkeleton(scene_spec_);
+    }
 
-  output_texture_ =
-    TextureManager::getSingleton().createManual(render_tex_name_,
+    CreateLayerTarget(layer, render_width_, render_height_);
+    if (layer.target && scene_is_loaded_) {
+      AttachViewport(layer.target, layer.scheme);
+    }
+  } else {
+    DestroyLayerTarget(layer);
+  }
+
+  layer.enabled = enabled;
+}
+
+// Creates the data, the texture and the render target of the layer, but
+// attaches no viewport
+void HandRendererPrivate::CreateLayerTarget(RenderLayer &layer,
+                                            int width, int height) {
+  layer.data.reset(new char[layer.bytes_per_pixel * width * height]);
+  memset(layer.data.get(), 0, layer.bytes_per_pixel * width * height);
+
+  // The software renderer draws all the layers itself
+  if (software_) {
+    layer.texture.setNull();
+    layer.target = NULL;
+    return;
+  }
+
+  layer.texture =
+    TextureManager::getSingleton().createManual(PrintFString("%s %s %dx%d",
+                                                    render_tex_name_.c_str(),
+                                                    layer.scheme.c_str(),
+                                                    width, height),
                                                 render_tex_rsrc_name_,
                                                 TEX_TYPE_2D,
                                                 width, height,
                                                 0,
-                                                PF_B8G8R8,
+                                                layer.format,
                                                 TU_RENDERTARGET,
                                                 0, false, false);
+  layer.target = layer.texture->getBuffer()->getRenderTarget();
+  // Layers are only rendered in frames that read them back
+  layer.target->setAutoUpdated(false);
+}
 
-  render_target_ = output_texture_->getBuffer()->getRenderTarget();
-  render_width_ = width; render_height_ = height;
+void HandRendererPrivate::DestroyLayerTarget(RenderLayer &layer) {
+  layer.data.reset();
+  if (layer.texture.isNull()) return;
+
+  TextureManager::getSingleton().remove(layer.texture->getName());
+  layer.texture.setNull();
+  layer.target = NULL;
+}
+
+MaterialPtr HandRendererPrivate::CreateSchemeMaterial(LayerType layer_type) {
+  const string name = render_tex_name_ + " " + layers_[layer_type].scheme;
+
+  MaterialPtr material =
+    MaterialManager::getSingleton().create(name, render_tex_rsrc_name_);
+  Pass *pass = material->getTechnique(0)->getPass(0);
+  pass->setLightingEnabled(false);
+
+  switch (layer_type) {
+  case kDepthLayer:
+    {
+      HighLevelGpuProgramManager &program_mgr =
+        HighLevelGpuProgramManager::getSingleton();
+
+      if (!program_mgr.isLanguageSupported("glsl")) {
+        throw runtime_error("The depth output needs GLSL support");
+      }
+
+      HighLevelGpuProgramPtr vertex_program =
+        program_mgr.createProgram(name + " VP", render_tex_rsrc_name_,
+                                  "glsl", GPT_VERTEX_PROGRAM);
+      vertex_program->setSource(kDepthVertexProgram);
+
+      HighLevelGpuProgramPtr fragment_program =
+        program_mgr.createProgram(name + " FP", render_tex_rsrc_name_,
+                                  "glsl", GPT_FRAGMENT_PROGRAM);
+      fragment_program->setSource(kDepthFragmentProgram);
+
+      pass->setVertexProgram(vertex_program->getName());
+      pass->setFragmentProgram(fragment_program->getName());
+    }
+    break;
+  case kLabelLayer:
+    // Unlit, untextured, using the labels baked into the vertex colours.
+    // Flat shading keeps the labels from being blended across a triangle.
+    pass->setShadingMode(SO_FLAT);
+    pass->setFog(true, FOG_NONE);
+    break;
+  default:
+    break;
+  }
+
+  material->load();
+  return material;
+}
+
+// Plain white whatever the lights, the textures and the vertex colours
+// (which hold the labels if these are enabled): with the vertex colours
+// untracked and no ambient, diffuse or specular reflection, only the
+// self-illumination is left
+MaterialPtr HandRendererPrivate::CreateSilhouetteMaterial() {
+  MaterialPtr material =
+    MaterialManager::getSingleton().create(render_tex_name_ + " "
+                                           + kSilhouetteScheme,
+                                           render_tex_rsrc_name_);
+  Pass *pass = material->getTechnique(0)->getPass(0);
+  pass->setVertexColourTracking(TVC_NONE);
+  pass->setAmbient(ColourValue::Black);
+  pass->setDiffuse(ColourValue::Black);
+  pass->setSpecular(ColourValue::Black);
+  pass->setSelfIllumination(ColourValue::White);
+  pass->setShadingMode(SO_FLAT);
+  pass->setFog(true, FOG_NONE);
+
+  material->load();
+  return material;
+}
+
+void HandRendererPrivate::ReadLayers() {
+  if (software_) {
+    const size_t num_pixels = (size_t) render_width_ * render_height_;
+
+    if (depth_enabled()) {
+      memcpy(layers_[kDepthLayer].data.get(), software_->depth_buffer(),
+             num_pixels * sizeof(float));
+    }
+    if (labels_enabled()) {
+      memcpy(layers_[kLabelLayer].data.get(), software_->label_buffer(),
+             num_pixels);
+    }
+    return;
+  }
+
+  for (int i = 0; i < kNumLayers; ++i) {
+    RenderLayer &layer = layers_[i];
+    if (!layer.enabled) continue;
+
+    PixelBox pixel_box(Box(0, 0, render_width_, render_height_),
+                       layer.read_format,
+                       layer.data.get());
+    layer.target->copyContentsToMemory(pixel_box, RenderTarget::FB_FRONT);
+  }
+}
+
+const cv::Mat HandRendererPrivate::LayerCv(LayerType layer_type) const {
+  const RenderLayer &layer = layers_[layer_type];
+  if (!layer.enabled) return cv::Mat();
+
+  return cv::Mat(render_height_, render_width_, layer.cv_type,
+                 layer.data.get());
+}
+
+void HandRendererPrivate::CreateAsyncRing() {
+  async_ring_.resize(async_depth_);
+
+  for (int i = 0; i < async_depth_; ++i) {
+    AsyncSlot &slot = async_ring_[i];
+    slot.pixel_data.reset(new char[bgr_frame_bytes()]);
+
+    // The software renderer needs no render targets
+    if (software_) continue;
+
+    slot.texture = CreateRenderTexture(PrintFString("%s Async %d",
+                                                    render_tex_name_.c_str(),
+                                                    i),
+                                       render_width_, render_height_);
+    slot.target = slot.texture->getBuffer()->getRenderTarget();
+    // Ring targets are only ever rendered by SubmitFrame()
+    slot.target->setAutoUpdated(false);
+
+    if (scene_is_loaded_) AttachViewport(slot.target);
+  }
+}
+
+void HandRendererPrivate::DestroyAsyncRing() {
+  for (size_t i = 0; i < async_ring_.size(); ++i) {
+    if (async_ring_[i].texture.isNull()) continue;
+    TextureManager::getSingleton().remove(async_ring_[i].texture->getName());
+  }
+
+  async_ring_.clear();
+}
+
+void HandRendererPrivate::SetAtlasLayout(int columns, int rows) {
+  // Every cell needs a visibility flag bit of its own
+  const int max_cells = min(HandRenderer::kMaxAtlasCells,
+                            kNumVisibilityFlagBits - kFirstAtlasCellFlagBit);
+
+  if (columns < 0 || rows < 0
+      || (long long) columns * rows > max_cells) {
+    throw runtime_error(PrintFString("Bad atlas layout %dx%d, at most %d "
+                                     "cells are supported",
+                                     columns, rows, max_cells));
+  }
+
+  if (!renderer_is_setup_) {
+    Setup(kDefaultWidth, kDefaultHeight);
+  }
+
+  DestroyAtlas();
+  atlas_columns_ = columns;
+  atlas_rows_ = rows;
+  CreateAtlas();
+}
+
+void HandRendererPrivate::CreateAtlas() {
+  const int num_cells = atlas_columns_ * atlas_rows_;
+  if (!num_cells) return;
+
+  atlas_data_.reset(new char[num_cells * bgr_frame_bytes()]);
+  memset(atlas_data_.get(), 0, num_cells * bgr_frame_bytes());
+
+  if (software_) return;
+
+  atlas_texture_ = CreateRenderTexture(render_tex_name_ + " Atlas",
+                                       atlas_columns_ * render_width_,
+                                       atlas_rows_ * render_height_);
+  atlas_target_ = atlas_texture_->getBuffer()->getRenderTarget();
+  // Only rendered by RenderAtlas()
+  atlas_target_->setAutoUpdated(false);
+}
+
+void HandRendererPrivate::DestroyAtlas() {
+  DestroyAtlasCells();
+
+  atlas_data_.reset();
+  if (atlas_texture_.isNull()) return;
+
+  TextureManager::getSingleton().remove(atlas_texture_->getName());
+  atlas_texture_.setNull();
+  atlas_target_ = NULL;
+}
+
+// Every cell gets a clone of the hand entity, with a skeleton of its own,
+// and a camera that renders into the viewport of the cell. The
+// visibility flags keep every viewport to its own hand.
+void HandRendererPrivate::CreateAtlasCells() {
+  const int num_cells = atlas_columns_ * atlas_rows_;
+  SceneNode *hand_scene_node = hand_entity_->getParentSceneNode();
+
+  hand_entity_->setVisibilityFlags(kMainHandFlag);
+  atlas_cells_.resize(num_cells);
+
+  for (int i = 0; i < num_cells; ++i) {
+    AtlasCell &cell = atlas_cells_[i];
+    const string name = PrintFString("%s Atlas %d",
+                                     render_tex_name_.c_str(), i);
+    const uint32 cell_flag = AtlasCellFlag(i);
+
+    cell.entity = hand_entity_->clone(name);
+    cell.entity->setVisibilityFlags(cell_flag);
+    cell.entity->setMeshLodBias(1, lod_level_, lod_level_);
+    hand_scene_node->attachObject(cell.entity);
+
+    SkeletonInstance *skeleton = cell.entity->getSkeleton();
+    for (int j = 0; j < scene_spec_.num_bones(); ++j) {
+      Bone *bone = skeleton->getBone(scene_spec_.bone_name(j));
+      bone->setManuallyControlled(true);
+      cell.bones.push_back(bone);
+    }
+
+    cell.camera = scene_mgr_->createCamera(name);
+    cell.camera->setFOVy(camera_->getFOVy());
+    cell.camera->setAspectRatio(camera_->getAspectRatio());
+    cell.camera->setNearClipDistance(camera_->getNearClipDistance());
+    cell.camera->setFarClipDistance(camera_->getFarClipDistance());
+
+    Viewport *viewport =
+      atlas_target_->addViewport(cell.camera, i,
+                                 (float) (i % atlas_columns_)
+                                 / atlas_columns_,
+                                 (float) (i / atlas_columns_) / atlas_rows_,
+                                 1.f / atlas_columns_, 1.f / atlas_rows_);
+    viewport->setBackgroundColour(ColourValue(0, 0, 0));
+    viewport->setVisibilityMask(cell_flag);
+    viewport->setOverlaysEnabled(false);
+    SetFrameScheme(viewport);
+  }
+}
+
+void HandRendererPrivate::DestroyAtlasCells() {
+  if (atlas_cells_.empty()) return;
+
+  atlas_target_->removeAllViewports();
+
+  for (size_t i = 0; i < atlas_cells_.size(); ++i) {
+    scene_mgr_->destroyEntity(atlas_cells_[i].entity);
+    scene_mgr_->destroyCamera(atlas_cells_[i].camera);
+  }
+  atlas_cells_.clear();
+
+  hand_entity_->setVisibilityFlags(MovableObject::getDefaultVisibilityFlags());
+}
+
+char *HandRendererPrivate::atlas_cell_data(int cell) const {
+  const int row = cell / atlas_columns_, column = cell % atlas_columns_;
+  return atlas_data_.get() + row * render_height_ * atlas_stride()
+    + column * 3 * render_width_;
+}
+
+void HandRendererPrivate::RenderAtlas(const vector<FullHandPose> &hand_poses,
+                                      const vector<HandCameraSpec>
+                                      &camera_specs,
+                                      vector<cv::Mat> *cells) {
+  InitChecks();
+
+  const int num_cells = atlas_columns_ * atlas_rows_;
+  if (!num_cells) {
+    throw runtime_error("No atlas layout set");
+  }
+
+  if ((int) hand_poses.size() > num_cells) {
+    throw runtime_error(PrintFString("%d poses do not fit into an atlas of "
+                                     "%d cells", (int) hand_poses.size(),
+                                     num_cells));
+  }
+
+  if (camera_specs.size() != 1 && camera_specs.size() != hand_poses.size()) {
+    throw runtime_error(PrintFString("RenderAtlas needs either one camera "
+                                     "spec or one per pose (%d poses, "
+                                     "%d camera specs)",
+                                     (int) hand_poses.size(),
+                                     (int) camera_specs.size()));
+  }
+
+  for (size_t i = 0; i < hand_poses.size(); ++i) {
+    CheckPose(hand_poses[i]);
+  }
+
+  if (software_) {
+    // The software renderer has no per-frame overhead to save, so it
+    // draws the cells one by one, restoring the hand pose afterwards:
+    // the applied pose, or the binding pose if none was applied.
+    const bool restore_pose = pose_is_applied_;
+    const FullHandPose saved_pose = applied_pose_;
+
+    // Atlas cells are never cropped, whatever the last frame was
+    software_->SetProjectionWindow(-1, 1, -1, 1);
+
+    memset(atlas_data_.get(), 0, num_cells * bgr_frame_bytes());
+    for (size_t i = 0; i < hand_poses.size(); ++i) {
+      ApplyPose(hand_poses[i]);
+      software_->Render(camera_specs.size() == 1 ? camera_specs[0]
+                                                 : camera_specs[i],
+                        false, false);
+      software_->CopyFrame(atlas_cell_data(i), atlas_stride());
+    }
+
+    if (restore_pose) {
+      ApplyPose(saved_pose);
+    } else if (!hand_poses.empty()) {
+      ApplyPose(FullHandPose(scene_spec_.num_bones()));
+      pose_is_applied_ = false;
+    }
+  } else {
+    if (atlas_cells_.empty()) CreateAtlasCells();
+
+    const Vector3 hand_pos_world =
+      hand_node_->convertLocalToWorldPosition(Vector3::ZERO);
+
+    for (int i = 0; i < num_cells; ++i) {
+      AtlasCell &cell = atlas_cells_[i];
+
+      cell.entity->setVisible(i < (int) hand_poses.size());
+      if (i >= (int) hand_poses.size()) continue;
+
+      PoseBones(cell.bones, hand_poses[i],
+                cell.pose_is_applied ? &cell.applied_pose : NULL);
+      cell.applied_pose = hand_poses[i];
+      cell.pose_is_applied = true;
+
+      const HandCameraSpec &camera_spec =
+        camera_specs.size() == 1 ? camera_specs[0] : camera_specs[i];
+      cell.camera->setPosition(hand_pos_world + camera_spec.GetPosition());
+      cell.camera->setOrientation(camera_spec.GetQuaternion());
+    }
+
+    // All the cells in one pass and one readback
+    atlas_target_->update();
+
+    PixelBox pixel_box(Box(0, 0, atlas_columns_ * render_width_,
+                           atlas_rows_ * render_height_),
+                       PF_R8G8B8,
+                       atlas_data_.get());
+    atlas_target_->copyContentsToMemory(pixel_box, RenderTarget::FB_FRONT);
+  }
+
+  cells->resize(hand_poses.size());
+  for (size_t i = 0; i < hand_poses.size(); ++i) {
+    (*cells)[i] = cv::Mat(render_height_, render_width_, CV_8UC3,
+                          atlas_cell_data(i), atlas_stride());
+  }
+}
+
+const cv::Mat HandRendererPrivate::atlas_buffer_cv() const {
+  if (!atlas_data_) return cv::Mat();
+
+  return cv::Mat(atlas_rows_ * render_height_,
+                 atlas_columns_ * render_width_, CV_8UC3, atlas_data_.get());
 }
 
 void HandRendererPrivate::SetRenderSize(int width, int height) {
@@ -310,19 +1738,92 @@ void HandRendererPrivate::SetRenderSize(int width, int height) {
     return;
   }
 
+  if (width <= 0 || height <= 0) {
+    throw runtime_error("Bad HandRenderer render width or height");
+  }
+
   if (width == render_width_ && height == render_height_) {
     return;
   }
 
-  if (!output_texture_.isNull()) {
-    TextureManager::getSingleton().remove(render_tex_name_);
-    output_texture_.setNull();
-  }
+  PoolCurrentSize();
+  DestroyAsyncRing();
+  DestroyAtlas();
 
   SetRenderSizeInternal(width, height);
 }
 
+void HandRendererPrivate::PrewarmRenderSizes(const vector<cv::Size> &sizes) {
+  if (!renderer_is_setup_) {
+    Setup(kDefaultWidth, kDefaultHeight);
+  }
+
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    const int width = sizes[i].width, height = sizes[i].height;
+    if (width <= 0 || height <= 0) {
+      throw runtime_error("Bad HandRenderer render width or height");
+    }
+
+    if (width == render_width_ && height == render_height_) continue;
+
+    PooledSize &pooled = size_pool_[std::make_pair(width, height)];
+    pooled.last_used = ++size_pool_clock_;
+    if (pooled.pixel_data) continue;
+
+    pooled.pixel_data.reset(new char[3 * width * height]);
+
+    if (!software_) {
+      pooled.texture =
+        CreateRenderTexture(PrintFString("%s %dx%d", render_tex_name_.c_str(),
+                                         width, height),
+                            width, height);
+      pooled.target = pooled.texture->getBuffer()->getRenderTarget();
+      pooled.target->setAutoUpdated(false);
+    }
+
+    for (int j = 0; j < kNumLayers; ++j) {
+      if (!layers_[j].enabled) continue;
+
+      pooled.layers[j] = layers_[j];
+      CreateLayerTarget(pooled.layers[j], width, height);
+    }
+
+    TrimSizePool();
+  }
+}
+
+void HandRendererPrivate::ClearRenderSizePool() {
+  for (SizePool::iterator i = size_pool_.begin(); i != size_pool_.end();
+       ++i) {
+    DestroyPooledSize(i->second);
+  }
+  size_pool_.clear();
+}
+
+void HandRendererPrivate::SetAsyncDepth(int num_targets) {
+  if (num_targets < 0) {
+    throw runtime_error("The asynchronous render depth can't be negative");
+  }
+
+  if (!renderer_is_setup_) {
+    Setup(kDefaultWidth, kDefaultHeight);
+  }
+
+  DestroyAsyncRing();
+  async_depth_ = num_targets;
+  CreateAsyncRing();
+}
+
 void HandRendererPrivate::LoadScene(const SceneSpec &scene_spec) {
+  LoadScene(scene_spec, NULL);
+}
+
+void HandRendererPrivate::LoadScene(const SceneBundle &bundle) {
+  LoadScene(bundle.scene_spec(), &bundle);
+}
+
+void HandRendererPrivate::LoadScene(const SceneSpec &scene_spec,
+                                    const SceneBundle *bundle) {
   if (!renderer_is_setup_) {
     Setup(kDefaultWidth, kDefaultHeight);
   }
@@ -335,15 +1836,48 @@ void HandRendererPrivate::LoadScene(const SceneSpec &scene_spec) {
     DestroyScene();
   }
 
-  resource_mgr_->createResourceGroup(scene_rsrc_name_);
+  if (software_) {
+    if (bundle) {
+      software_->LoadScene(*bundle);
+    } else {
+      software_->LoadScene(scene_spec);
+    }
+    pose_is_applied_ = false;
+    joint_parent_labels_.assign(software_->joint_parent_labels().begin(),
+                                software_->joint_parent_labels().end());
+
+    initial_cam_distance_ = software_->initial_cam_distance();
+    camera_spec_= HandCameraSpec(initial_cam_distance());
+    scene_spec_ = scene_spec;
+    scene_is_loaded_ = true;
+    SelectLod();
+    return;
+  }
+
+  bool is_new_group = false;
+  scene_rsrc_name_ =
+    ogre_context_->AcquireSceneGroup(scene_spec.SceneDirFullPath(),
+                                     &is_new_group);
 
   try {
-    resource_mgr_->addResourceLocation(scene_spec.SceneDirFullPath(),
-                                       "FileSystem",
-                                       scene_rsrc_name_,
-                                       false);
-    resource_mgr_->initialiseResourceGroup(scene_rsrc_name_);
-    resource_mgr_->loadResourceGroup(scene_rsrc_name_);
+    if (is_new_group && bundle) {
+      ogre_context_->AddSceneBundle(*bundle);
+      resource_mgr_->addResourceLocation(bundle->filename(),
+                                         kBundleArchiveType,
+                                         scene_rsrc_name_,
+                                         false);
+      LoadBundleTextures(*bundle);
+    } else if (is_new_group) {
+      resource_mgr_->addResourceLocation(scene_spec.SceneDirFullPath(),
+                                         "FileSystem",
+                                         scene_rsrc_name_,
+                                         false);
+    }
+
+    if (is_new_group) {
+      resource_mgr_->initialiseResourceGroup(scene_rsrc_name_);
+      resource_mgr_->loadResourceGroup(scene_rsrc_name_);
+    }
 
     if (!resource_mgr_->resourceExists(scene_rsrc_name_,
                                        scene_spec.scene_file())) {
@@ -388,25 +1922,22 @@ void HandRendererPrivate::LoadScene(const SceneSpec &scene_spec) {
       throw runtime_error("The hand entity object is not attached to a node");
     }
 
-    hand_skeleton_ = hand_entity_->getSkeleton();
+    if (layers_[kLabelLayer].enabled) {
+      AddLabelColours(scene_spec);
+    }
 
-    viewport_ = render_target_->addViewport(camera_);
-    viewport_->setBackgroundColour(ColourValue(0, 0, 0));
+    BindSkeleton(scene_spec);
 
-    for (int i = 0; i < scene_spec.num_bones(); ++i) {
-      const string &bone_name = scene_spec.bone_name(i);
+    viewport_ = AttachViewport(render_target_);
 
-      if (!hand_skeleton_->hasBone(bone_name)) {
-        throw runtime_error(PrintFString
-                            ("The hand object %s does not have a "
-                             "bone named %s",
-                             scene_spec.hand_object_name().c_str(),
-                             bone_name.c_str()));
-      }
-      Bone *bone = hand_skeleton_->getBone(bone_name);
-      bone->setManuallyControlled(true);
+    for (size_t i = 0; i < async_ring_.size(); ++i) {
+      AttachViewport(async_ring_[i].target);
+    }
 
-      bone_by_index_.push_back(bone);
+    for (int i = 0; i < kNumLayers; ++i) {
+      if (layers_[i].enabled) {
+        AttachViewport(layers_[i].target, layers_[i].scheme);
+      }
     }
 
     initial_cam_distance_ = CameraHandDistance();
@@ -425,14 +1956,162 @@ void HandRendererPrivate::LoadScene(const SceneSpec &scene_spec) {
 
   scene_spec_ = scene_spec;
   scene_is_loaded_ = true;
+  SelectLod();
+}
+
+// The textures of a bundle are already decoded, so they are created
+// straight from their pixels instead of being loaded from image files
+void HandRendererPrivate::LoadBundleTextures(const SceneBundle &bundle) {
+  for (int i = 0; i < bundle.num_entries(); ++i) {
+    const SceneBundle::Entry &entry = bundle.entry(i);
+    if (entry.type != SceneBundle::TEXTURE_ENTRY) continue;
+
+    DataStreamPtr pixels(OGRE_NEW MemoryDataStream((void *) entry.data,
+                                                   entry.size, false));
+    TextureManager::getSingleton().loadRawData(entry.name, scene_rsrc_name_,
+                                               pixels,
+                                               entry.width, entry.height,
+                                               PF_BYTE_BGR);
+  }
+}
+
+void HandRendererPrivate::BindSkeleton(const SceneSpec &scene_spec) {
+  hand_skeleton_ = hand_entity_->getSkeleton();
+  bone_by_index_.clear();
+
+  for (int i = 0; i < scene_spec.num_bones(); ++i) {
+    const string &bone_name = scene_spec.bone_name(i);
+
+    if (!hand_skeleton_->hasBone(bone_name)) {
+      throw runtime_error(PrintFString
+                          ("The hand object %s does not have a "
+                           "bone named %s",
+                           scene_spec.hand_object_name().c_str(),
+                           bone_name.c_str()));
+    }
+    Bone *bone = hand_skeleton_->getBone(bone_name);
+    bone->setManuallyControlled(true);
+
+    bone_by_index_.push_back(bone);
+  }
+
+  joint_parent_labels_.clear();
+  for (size_t i = 0; i < bone_by_index_.size(); ++i) {
+    uint8 parent_label = 0;
+
+    for (Node *node = bone_by_index_[i]->getParent(); node;
+         node = node->getParent()) {
+      int bone_idx = scene_spec.bone_index(node->getName());
+
+      if (bone_idx != -1) {
+        parent_label = (uint8) min(bone_idx + 1, 255);
+        break;
+      }
+    }
+    joint_parent_labels_.push_back(parent_label);
+  }
+
+  // A new skeleton instance starts out in the binding pose
+  pose_is_applied_ = false;
+}
+
+void HandRendererPrivate::AddLabelColours(const SceneSpec &scene_spec) {
+  if (!label_mesh_.isNull()) return;
+
+  if (scene_spec.num_bones() > 254) {
+    throw runtime_error("The label output supports at most 254 bones");
+  }
+
+  MeshPtr mesh = hand_entity_->getMesh()->clone(label_mesh_name_);
+  SkeletonPtr skeleton = mesh->getSkeleton();
+
+  // Every skeleton bone is labelled by its closest ancestor (or itself)
+  // in the bone map
+  vector<uint8> bone_labels(skeleton->getNumBones(), 0);
+
+  for (unsigned short handle = 0; handle < skeleton->getNumBones(); ++handle) {
+    for (Node *node = skeleton->getBone(handle); node;
+         node = node->getParent()) {
+      int bone_idx = scene_spec.bone_index(node->getName());
+
+      if (bone_idx != -1) {
+        bone_labels[handle] = (uint8) (bone_idx + 1);
+        break;
+      }
+    }
+  }
+
+  if (mesh->sharedVertexData) {
+    BakeLabelColours(mesh->sharedVertexData,
+                     mesh->getBoneAssignmentIterator(),
+                     bone_labels);
+  }
+
+  for (unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i) {
+    SubMesh *sub_mesh = mesh->getSubMesh(i);
+
+    if (!sub_mesh->useSharedVertices) {
+      BakeLabelColours(sub_mesh->vertexData,
+                       sub_mesh->getBoneAssignmentIterator(),
+                       bone_labels);
+    }
+  }
+
+  // An entity can't change its mesh, so the hand entity is replaced by
+  // one of the labelled copy, with the same materials. This also gives
+  // it a new skeleton. The atlas clones are simply recreated.
+  DestroyAtlasCells();
+
+  SceneNode *hand_scene_node = hand_entity_->getParentSceneNode();
+  Entity *entity = scene_mgr_->createEntity(label_mesh_name_,
+                                            mesh->getName());
+  for (unsigned int i = 0; i < entity->getNumSubEntities(); ++i) {
+    entity->getSubEntity(i)->setMaterial
+      (hand_entity_->getSubEntity(i)->getMaterial());
+  }
+  entity->setCastShadows(hand_entity_->getCastShadows());
+  entity->setMeshLodBias(1, lod_level_, lod_level_);
+
+  hand_scene_node->detachObject(hand_entity_);
+  scene_mgr_->destroyEntity(hand_entity_);
+  hand_scene_node->attachObject(entity);
+
+  hand_entity_ = entity;
+  label_mesh_ = mesh;
 }
 
 void HandRendererPrivate::DestroyScene() {
+  keypoints_.clear();
+
+  if (software_) {
+    for (size_t i = 0; i < async_ring_.size(); ++i) {
+      async_ring_[i].ticket = -1;
+    }
+    scene_is_loaded_ = false;
+    return;
+  }
+
+  DestroyAtlasCells();
   render_target_->removeAllViewports();
+  for (size_t i = 0; i < async_ring_.size(); ++i) {
+    async_ring_[i].target->removeAllViewports();
+    async_ring_[i].ticket = -1;
+  }
+  for (int i = 0; i < kNumLayers; ++i) {
+    if (layers_[i].enabled) layers_[i].target->removeAllViewports();
+  }
   scene_mgr_->destroyAllCameras();
   scene_mgr_->clearScene();
-  resource_mgr_->destroyResourceGroup(scene_rsrc_name_);
+  if (!label_mesh_.isNull()) {
+    MeshManager::getSingleton().remove(label_mesh_->getHandle());
+    label_mesh_.setNull();
+  }
+  if (!scene_rsrc_name_.empty()) {
+    ogre_context_->ReleaseSceneGroup(scene_rsrc_name_);
+    scene_rsrc_name_.clear();
+  }
   bone_by_index_.clear();
+  frustum_is_cropped_ = false;
   scene_is_loaded_ = false;
 }
 
@@ -449,47 +2128,683 @@ void HandRendererPrivate::InitChecks() {
 void HandRendererPrivate::SetHandPose(const FullHandPose &hand_pose,
                                       bool update_camera) {
   InitChecks();
+  CheckPose(hand_pose);
+  ApplyPose(hand_pose);
+
+  if (update_camera) {
+    camera_spec_.SetFromHandPose(hand_pose);
+  }
+}
 
+void HandRendererPrivate::CheckPose(const FullHandPose &hand_pose) {
   if (hand_pose.num_joints() != scene_spec_.num_bones()) {
     throw runtime_error(PrintFString("The bone map has %d bones, while "
                                      "the number of joints in the hand pose "
                                      "is %d", scene_spec_.num_bones(),
                                      hand_pose.num_joints()));
   }
+}
+
+void HandRendererPrivate::ApplyPose(const FullHandPose &hand_pose) {
+  if (software_) {
+    software_->SetHandPose(hand_pose);
+  } else {
+    PoseBones(bone_by_index_, hand_pose,
+              pose_is_applied_ ? &applied_pose_ : NULL);
+  }
 
-  hand_skeleton_->reset(true);
+  applied_pose_ = hand_pose;
+  pose_is_applied_ = true;
+}
 
-  for (int bone_no = 0; bone_no < scene_spec_.num_bones(); ++bone_no) {
-    Bone *bone = bone_by_index_[bone_no];
+// Only the bones whose joints changed since the applied pose (all of
+// them, without one) are reset and rotated again. Bones outside the bone
+// map are never moved, so they stay in their binding pose. If no joint
+// changed the skeleton is not touched at all, and the entity does not
+// redo the skinning.
+void HandRendererPrivate::PoseBones(const std::vector<Bone *> &bones,
+                                    const FullHandPose &hand_pose,
+                                    const FullHandPose *applied_pose) {
+  for (size_t bone_no = 0; bone_no < bones.size(); ++bone_no) {
     HandJoint joint_angle = hand_pose.joint(bone_no);
 
+    if (applied_pose) {
+      HandJoint applied = applied_pose->joint(bone_no);
+      if (applied.bend == joint_angle.bend
+          && applied.side == joint_angle.side
+          && applied.twist == joint_angle.twist) {
+        continue;
+      }
+    }
+
+    Bone *bone = bones[bone_no];
+    bone->reset();
     bone->rotate(joint_angle.ToQuaternion(), Node::TS_LOCAL);
   }
+}
 
-  if (update_camera) {
-    camera_spec_.SetFromHandPose(hand_pose);
+void HandRendererPrivate::RenderHand() {
+  InitChecks();
+
+  RenderFrame(camera_spec_, true, auto_crop_);
+  ReadFrame(render_target_, pixel_data_.get());
+  ReadLayers();
+  ProjectKeypoints();
+}
+
+void HandRendererPrivate::RenderHandInto(cv::Mat &dst) {
+  const cv::Mat frame = pixel_buffer_cv();
+  dst.create(frame.rows, frame.cols, frame.type());
+  RenderHandInto(dst.data, dst.step);
+}
+
+void HandRendererPrivate::RenderHandInto(void *dst, size_t stride) {
+  InitChecks();
+
+  if (!dst) {
+    throw runtime_error("No output buffer given to RenderHandInto");
+  }
+
+  if (stride < frame_row_bytes()) {
+    throw runtime_error(PrintFString("The row stride %d is too small for "
+                                     "a %d pixels wide frame",
+                                     (int) stride, render_width_));
   }
+
+  RenderFrame(camera_spec_, true, auto_crop_);
+  ReadFrame(render_target_, (char *) dst, stride);
+  ReadLayers();
+  ProjectKeypoints();
 }
 
-void HandRendererPrivate::RenderHand() {
+void HandRendererPrivate::RenderBatch(const vector<FullHandPose> &hand_poses,
+                                      const vector<HandCameraSpec>
+                                      &camera_specs,
+                                      char *batch_buffer) {
+  InitChecks();
+
+  if (camera_specs.size() != 1 && camera_specs.size() != hand_poses.size()) {
+    throw runtime_error(PrintFString("RenderBatch needs either one camera "
+                                     "spec or one per pose (%d poses, "
+                                     "%d camera specs)",
+                                     (int) hand_poses.size(),
+                                     (int) camera_specs.size()));
+  }
+
+  if (hand_poses.empty()) return;
+
+  if (!batch_buffer) {
+    throw runtime_error("No output buffer given to RenderBatch");
+  }
+
+  // Validate the whole batch up front, so that a bad pose can't leave
+  // the output buffer half-written.
+  for (size_t i = 0; i < hand_poses.size(); ++i) {
+    CheckPose(hand_poses[i]);
+  }
+
+  const size_t stride = frame_bytes();
+
+  for (size_t i = 0; i < hand_poses.size(); ++i) {
+    ApplyPose(hand_poses[i]);
+    RenderFrame(camera_specs.size() == 1 ? camera_specs[0] : camera_specs[i]);
+    ReadFrame(render_target_, batch_buffer + i * stride);
+  }
+}
+
+void HandRendererPrivate::RenderViews(const FullHandPose &hand_pose,
+                                      const vector<HandCameraSpec>
+                                      &camera_specs,
+                                      char *views_buffer) {
   InitChecks();
 
+  if (camera_specs.empty()) return;
+
+  if (!views_buffer) {
+    throw runtime_error("No output buffer given to RenderViews");
+  }
+
+  CheckPose(hand_pose);
+
+  // The pose is applied once. OGRE then skins the mesh in the first view
+  // only, as the skeleton stays clean, and the software renderer skins
+  // it up front, leaving just the camera transform to every view.
+  ApplyPose(hand_pose);
+  if (software_ && camera_specs.size() > 1) software_->SkinHand();
+
+  const size_t stride = frame_bytes();
+
+  for (size_t i = 0; i < camera_specs.size(); ++i) {
+    RenderFrame(camera_specs[i]);
+    ReadFrame(render_target_, views_buffer + i * stride);
+  }
+}
+
+int HandRendererPrivate::SubmitFrame(const FullHandPose &hand_pose,
+                                     const HandCameraSpec &camera_spec) {
+  InitChecks();
+
+  if (async_ring_.empty()) {
+    throw runtime_error("Asynchronous rendering is off, "
+                        "call SetAsyncDepth() first");
+  }
+
+  CheckPose(hand_pose);
+
+  const int ticket = next_ticket_;
+  AsyncSlot &slot = async_ring_[ticket % async_ring_.size()];
+
+  if (slot.ticket != -1) {
+    throw runtime_error(PrintFString("All %d asynchronous render targets "
+                                     "are busy, fetch frame %d first",
+                                     (int) async_ring_.size(), slot.ticket));
+  }
+
+  ApplyPose(hand_pose);
+
+  slot.ticket = ticket;
+  slot.read_back = false;
+  ++next_ticket_;
+
+  // The software renderer is done with the frame as soon as it returns
+  if (software_) {
+    RenderFrame(camera_spec);
+    ReadFrame(NULL, slot.pixel_data.get());
+    slot.read_back = true;
+    return ticket;
+  }
+
+  // The previous frame is read back before this one is issued. It has
+  // had the time since the previous call to finish, and the readback
+  // does not wait for the draw calls of this frame.
+  AsyncSlot &prev_slot =
+    async_ring_[(ticket + async_ring_.size() - 1) % async_ring_.size()];
+
+  if (&prev_slot != &slot && prev_slot.ticket != -1 && !prev_slot.read_back) {
+    ReadFrame(prev_slot.target, prev_slot.pixel_data.get());
+    prev_slot.read_back = true;
+  }
+
+  // Issues the draw calls to the driver and returns without waiting for
+  // the GPU, which renders the frame while the caller goes on. Like the
+  // software frames, the frame is never cropped.
+  PositionCamera(camera_spec);
+  CropView(camera_spec, false);
+  slot.target->update(false);
+
+  return ticket;
+}
+
+size_t HandRendererPrivate::FindAsyncSlot(int ticket) const {
+  if (ticket >= 0 && !async_ring_.empty()) {
+    size_t slot_no = ticket % async_ring_.size();
+    if (async_ring_[slot_no].ticket == ticket) return slot_no;
+  }
+
+  throw runtime_error(PrintFString("Frame %d is not in flight", ticket));
+}
+
+bool HandRendererPrivate::PollFrame(int ticket) const {
+  return async_ring_[FindAsyncSlot(ticket)].read_back;
+}
+
+void HandRendererPrivate::FetchFrame(int ticket, cv::Mat *dst) {
+  AsyncSlot &slot = async_ring_[FindAsyncSlot(ticket)];
+
+  const cv::Mat slot_frame = FrameCv(slot.pixel_data.get());
+  dst->create(slot_frame.rows, slot_frame.cols, slot_frame.type());
+
+  if (slot.read_back) {
+    slot_frame.copyTo(*dst);
+  } else {
+    ReadFrame(slot.target, (char *) dst->data, dst->step);
+  }
+
+  slot.ticket = -1;
+  slot.read_back = false;
+}
+
+void HandRendererPrivate::PositionCamera(const HandCameraSpec &camera_spec) {
   Vector3 camera_pos_world =
     ( hand_node_->convertLocalToWorldPosition(Vector3::ZERO)
-      + camera_spec_.GetPosition() );
+      + camera_spec.GetPosition() );
 
   camera_node_->setPosition(camera_pos_world);
-  camera_->setOrientation(camera_spec_.GetQuaternion());
+  camera_->setOrientation(camera_spec.GetQuaternion());
+}
+
+// The same points as SoftwareRenderer::ProjectSkeleton()
+void HandRendererPrivate::ProjectSkeleton(const HandCameraSpec &camera_spec,
+                                          vector<float> *points) {
+  if (software_) {
+    software_->ProjectSkeleton(camera_spec, points);
+    return;
+  }
+
+  const Matrix4 view_hand =
+    camera_->getViewMatrix() * hand_node_->_getFullTransform();
+  const Real focal = 1 / Math::Tan(camera_->getFOVy() / 2);
+  const Real aspect_ratio = camera_->getAspectRatio();
+
+  points->clear();
+  for (unsigned short handle = 0; handle < hand_skeleton_->getNumBones();
+       ++handle) {
+    Bone *bone = hand_skeleton_->getBone(handle);
+    const Matrix4 bone_view = view_hand * bone->_getFullTransform();
+    const Vector3 tip(0, bone->getInitialPosition().length(), 0);
+
+    for (int end = 0; end < (bone->numChildren() ? 1 : 2); ++end) {
+      Vector3 position = bone_view * (end ? tip : Vector3::ZERO);
+
+      const Real w = -position.z;
+      if (w < camera_->getNearClipDistance()) continue;
+
+      points->push_back(position.x * focal / aspect_ratio / w);
+      points->push_back(position.y * focal / w);
+    }
+  }
+}
+
+// Sets crop_rect_ and narrows the view of the camera down to it
+void HandRendererPrivate::CropView(const HandCameraSpec &camera_spec,
+                                   bool with_crop) {
+  vector<float> points;
+  if (with_crop) ProjectSkeleton(camera_spec, &points);
+
+  crop_rect_ = cv::Rect_<float>(0, 0, render_width_, render_height_);
+
+  if (!points.empty()) {
+    float x0 = FLT_MAX, x1 = -FLT_MAX, y0 = FLT_MAX, y1 = -FLT_MAX;
+
+    for (size_t i = 0; i < points.size(); i += 2) {
+      const float x = (1 + points[i]) * (0.5f * render_width_);
+      const float y = (1 - points[i + 1]) * (0.5f * render_height_);
+      x0 = min(x0, x); x1 = max(x1, x);
+      y0 = min(y0, y); y1 = max(y1, y);
+    }
+
+    float width = x1 - x0, height = y1 - y0;
+    const float margin = crop_margin_ * max(width, height);
+    width += 2 * margin;
+    height += 2 * margin;
+
+    if (width * render_height_ < height * render_width_) {
+      width = height * render_width_ / render_height_;
+    } else {
+      height = width * render_height_ / render_width_;
+    }
+
+    if (width > 0) {
+      crop_rect_ = cv::Rect_<float>((x0 + x1 - width) / 2,
+                                    (y0 + y1 - height) / 2,
+                                    width, height);
+    }
+  }
+
+  // The crop in normalized device coordinates
+  const float left = 2 * crop_rect_.x / render_width_ - 1;
+  const float right = 2 * (crop_rect_.x + crop_rect_.width) / render_width_
+    - 1;
+  const float top = 1 - 2 * crop_rect_.y / render_height_;
+  const float bottom = 1 - 2 * (crop_rect_.y + crop_rect_.height)
+    / render_height_;
+
+  if (software_) {
+    software_->SetProjectionWindow(left, right, bottom, top);
+  } else if (crop_rect_.width != render_width_
+             || crop_rect_.height != render_height_
+             || crop_rect_.x != 0 || crop_rect_.y != 0) {
+    // The frustum extents are given on the near plane
+    const Real half_height = camera_->getNearClipDistance()
+      * Math::Tan(camera_->getFOVy() / 2);
+    const Real half_width = half_height * camera_->getAspectRatio();
+
+    camera_->setFrustumExtents(left * half_width, right * half_width,
+                               top * half_height, bottom * half_height);
+    frustum_is_cropped_ = true;
+  } else if (frustum_is_cropped_) {
+    camera_->resetFrustumExtents();
+    frustum_is_cropped_ = false;
+  }
+}
+
+void HandRendererPrivate::RenderFrame(const HandCameraSpec &camera_spec,
+                                      bool with_layers, bool with_crop) {
+  if (software_) {
+    CropView(camera_spec, with_crop);
+    software_->Render(camera_spec, with_layers && depth_enabled(),
+                      with_layers && labels_enabled());
+    return;
+  }
+
+  PositionCamera(camera_spec);
+  CropView(camera_spec, with_crop);
+
+  // Only the targets of this instance are updated, rather than every
+  // target of the shared OGRE Root. Every enabled layer is an extra pass,
+  // drawn right after the colour image from the same skinned hand mesh.
+  render_target_->update();
+
+  if (with_layers) {
+    for (int i = 0; i < kNumLayers; ++i) {
+      if (layers_[i].enabled) layers_[i].target->update();
+    }
+  }
+}
+
+// Reads the frame back into dst in the output format, with rows of
+// frame_row_bytes()
+void HandRendererPrivate::ReadFrame(RenderTarget *target, char *dst) {
+  ReadFrame(target, dst, frame_row_bytes());
+}
+
+void HandRendererPrivate::ReadFrame(RenderTarget *target, char *dst,
+                                    size_t stride) {
+  if (output_format_ == HandRenderer::BGR_FORMAT) {
+    ReadBgrFrame(target, dst, stride);
+    return;
+  }
+
+  if (silhouette_mode_ && !software_) {
+    ReadSilhouette(target, dst, stride);
+    return;
+  }
+
+  // The software renderer is converted straight from its frame
+  const unsigned char *bgr;
+  if (software_) {
+    bgr = software_->frame_buffer();
+  } else {
+    ReadBgrFrame(target, readback_data());
+    bgr = (const unsigned char *) readback_data_.get();
+  }
+
+  ConvertFrame(bgr, 3 * render_width_, 3, render_width_, render_height_,
+               output_format_, (unsigned char *) dst, stride);
+}
+
+void HandRendererPrivate::ReadBgrFrame(RenderTarget *target, char *dst) {
+  if (software_) {
+    software_->CopyFrame(dst, 3 * render_width_);
+    return;
+  }
 
-  root_->renderOneFrame(0);
   PixelBox pixel_box(Box(0, 0, render_width_, render_height_),
                      PF_R8G8B8,
-                     pixel_data_.get());
-  render_target_->copyContentsToMemory(pixel_box, RenderTarget::FB_FRONT);
+                     dst);
+  target->copyContentsToMemory(pixel_box, RenderTarget::FB_FRONT);
 }
 
-const cv::Mat HandRendererPrivate::pixel_buffer_cv() const {
-  return cv::Mat(render_height_, render_width_, CV_8UC3, pixel_data_.get());
+void HandRendererPrivate::ReadBgrFrame(RenderTarget *target, char *dst,
+                                       size_t stride) {
+  const size_t row_bytes = 3 * render_width_;
+
+  if (software_) {
+    software_->CopyFrame(dst, stride);
+    return;
+  }
+
+  if (stride == row_bytes) {
+    ReadBgrFrame(target, dst);
+    return;
+  }
+
+  // OGRE expresses the row pitch in pixels. Strides that are not a whole
+  // number of pixels have to go through the readback buffer.
+  if (stride % 3 == 0) {
+    PixelBox pixel_box(Box(0, 0, render_width_, render_height_),
+                       PF_R8G8B8,
+                       dst);
+    pixel_box.rowPitch = stride / 3;
+    pixel_box.slicePitch = pixel_box.rowPitch * render_height_;
+    target->copyContentsToMemory(pixel_box, RenderTarget::FB_FRONT);
+  } else {
+    ReadBgrFrame(target, readback_data());
+    for (int row = 0; row < render_height_; ++row) {
+      memcpy(dst + row * stride, readback_data_.get() + row * row_bytes,
+             row_bytes);
+    }
+  }
+}
+
+// The white silhouette on black reads back as single byte luminance
+// exactly, whether the conversion is done by OGRE or by the GL driver.
+// It is 255 or 0, already a mask.
+void HandRendererPrivate::ReadSilhouette(RenderTarget *target, char *dst,
+                                         size_t stride) {
+  const bool is_packed =
+    output_format_ == HandRenderer::PACKED_MASK_FORMAT;
+
+  PixelBox pixel_box(Box(0, 0, render_width_, render_height_),
+                     PF_L8,
+                     is_packed ? readback_data() : dst);
+  if (!is_packed) {
+    pixel_box.rowPitch = stride;
+    pixel_box.slicePitch = stride * render_height_;
+  }
+  target->copyContentsToMemory(pixel_box, RenderTarget::FB_FRONT);
+
+  if (is_packed) {
+    ConvertFrame((const unsigned char *) readback_data_.get(),
+                 render_width_, 1, render_width_, render_height_,
+                 output_format_, (unsigned char *) dst, stride);
+  }
+}
+
+char *HandRendererPrivate::readback_data() {
+  if (!readback_data_) readback_data_.reset(new char[bgr_frame_bytes()]);
+  return readback_data_.get();
+}
+
+void HandRendererPrivate::set_output_format(HandRenderer::OutputFormat
+                                            output_format) {
+  if (output_format < HandRenderer::BGR_FORMAT
+      || output_format > HandRenderer::PACKED_MASK_FORMAT) {
+    throw runtime_error(PrintFString("Bad HandRenderer output format %d",
+                                     (int) output_format));
+  }
+
+  // The frames in flight would be read back in the new format
+  for (size_t i = 0; i < async_ring_.size(); ++i) {
+    async_ring_[i].ticket = -1;
+    async_ring_[i].read_back = false;
+  }
+
+  output_format_ = output_format;
+}
+
+size_t HandRendererPrivate::frame_row_bytes() const {
+  switch (output_format_) {
+  case HandRenderer::BGR_FORMAT:
+    return (size_t) 3 * render_width_;
+  case HandRenderer::PACKED_MASK_FORMAT:
+    return (render_width_ + 7) / 8;
+  default:
+    return render_width_;
+  }
+}
+
+// A view of a frame in the output format
+const cv::Mat HandRendererPrivate::FrameCv(const char *data) const {
+  const int type = output_format_ == HandRenderer::BGR_FORMAT ?
+    CV_8UC3 : CV_8UC1;
+  const int columns = output_format_ == HandRenderer::PACKED_MASK_FORMAT ?
+    (int) frame_row_bytes() : render_width_;
+
+  return cv::Mat(render_height_, columns, type, (void *) data);
+}
+
+// Projects the bone map joints with the camera of the frame just
+// rendered, then checks their visibility against the frame and, if
+// there is one, the label image.
+void HandRendererPrivate::ProjectKeypoints() {
+  const int num_joints = scene_spec_.num_bones();
+  vector<float> joints(3 * num_joints);
+
+  if (software_) {
+    software_->ProjectJoints(&joints[0]);
+  } else {
+    const Matrix4 view_projection =
+      camera_->getProjectionMatrix() * camera_->getViewMatrix();
+    const Matrix4 &hand_transform = hand_node_->_getFullTransform();
+
+    for (int i = 0; i < num_joints; ++i) {
+      Vector3 world = hand_transform * bone_by_index_[i]->_getDerivedPosition();
+      Vector4 clip = view_projection * Vector4(world);
+
+      // The clip space w is the distance along the viewing direction
+      float *joint = &joints[3 * i];
+      if (clip.w < camera_->getNearClipDistance()) {
+        joint[0] = joint[1] = joint[2] = 0;
+      } else {
+        joint[0] = (1 + clip.x / clip.w) * (0.5f * render_width_);
+        joint[1] = (1 - clip.y / clip.w) * (0.5f * render_height_);
+        joint[2] = clip.w;
+      }
+    }
+  }
+
+  const uint8 *labels = labels_enabled() ?
+    (const uint8 *) layers_[kLabelLayer].data.get() : NULL;
+
+  keypoints_.resize(4 * num_joints);
+  for (int i = 0; i < num_joints; ++i) {
+    const float *joint = &joints[3 * i];
+    const int col = (int) floor(joint[0]);
+    const int row = (int) floor(joint[1]);
+
+    bool visible = joint[2] > 0
+      && col >= 0 && col < render_width_
+      && row >= 0 && row < render_height_;
+
+    if (visible && labels) {
+      visible = false;
+
+      for (int r = max(0, row - kKeypointLabelRadius);
+           r <= min(render_height_ - 1, row + kKeypointLabelRadius)
+             && !visible; ++r) {
+        for (int c = max(0, col - kKeypointLabelRadius);
+             c <= min(render_width_ - 1, col + kKeypointLabelRadius); ++c) {
+          uint8 label = labels[r * render_width_ + c];
+
+          if (label == i + 1 || label == joint_parent_labels_[i]) {
+            visible = true;
+            break;
+          }
+        }
+      }
+    }
+
+    float *keypoint = &keypoints_[4 * i];
+    keypoint[0] = joint[0];
+    keypoint[1] = joint[1];
+    keypoint[2] = joint[2];
+    keypoint[3] = visible ? 1 : 0;
+  }
+}
+
+void HandRendererPrivate::set_auto_lod(bool auto_lod) {
+  auto_lod_ = auto_lod;
+  SelectLod();
+}
+
+void HandRendererPrivate::set_silhouette_mode(bool silhouette_mode) {
+  if (silhouette_mode == silhouette_mode_) return;
+
+  if (!renderer_is_setup_) {
+    Setup(kDefaultWidth, kDefaultHeight);
+  }
+
+  silhouette_mode_ = silhouette_mode;
+
+  if (software_) {
+    software_->set_silhouette(silhouette_mode);
+    return;
+  }
+
+  if (silhouette_mode
+      && !scheme_listener_.has_scheme_material(kSilhouetteScheme)) {
+    scheme_listener_.set_scheme_material(kSilhouetteScheme,
+                                         CreateSilhouetteMaterial());
+  }
+
+  // The viewports attached from now on pick the scheme up themselves
+  if (render_target_->getNumViewports()) {
+    SetFrameScheme(render_target_->getViewport(0));
+  }
+  for (size_t i = 0; i < async_ring_.size(); ++i) {
+    if (async_ring_[i].target->getNumViewports()) {
+      SetFrameScheme(async_ring_[i].target->getViewport(0));
+    }
+  }
+  if (atlas_target_) {
+    for (unsigned short i = 0; i < atlas_target_->getNumViewports(); ++i) {
+      SetFrameScheme(atlas_target_->getViewport(i));
+    }
+  }
+}
+
+// The atlas cells are of the render size too, so they use the same level
+void HandRendererPrivate::SelectLod() {
+  if (!scene_is_loaded_) return;
+
+  int num_levels = 1;
+  if (software_) {
+    num_levels = software_->num_lod_levels();
+  } else if (!hand_entity_->getMesh()->isLodManual()) {
+    num_levels = hand_entity_->getMesh()->getNumLodLevels();
+  }
+
+  const size_t min_triangles = (size_t) render_width_ * render_height_
+    / HandRenderer::kLodPixelsPerTriangle;
+
+  int level = 0;
+  while (auto_lod_ && level + 1 < num_levels
+         && LodNumTriangles(level + 1) >= min_triangles) {
+    ++level;
+  }
+  lod_level_ = level;
+
+  if (software_) {
+    software_->set_lod_level(level);
+    return;
+  }
+
+  // The level is pinned, whatever the LOD strategy of the mesh would
+  // pick for the camera distance
+  hand_entity_->setMeshLodBias(1, level, level);
+  for (size_t i = 0; i < atlas_cells_.size(); ++i) {
+    atlas_cells_[i].entity->setMeshLodBias(1, level, level);
+  }
+}
+
+size_t HandRendererPrivate::LodNumTriangles(int level) const {
+  if (software_) return software_->lod_num_triangles(level);
+
+  const MeshPtr &mesh = hand_entity_->getMesh();
+  size_t num_indices = 0;
+  for (unsigned short i = 0; i < mesh->getNumSubMeshes(); ++i) {
+    const SubMesh *sub_mesh = mesh->getSubMesh(i);
+    num_indices += level ? sub_mesh->mLodFaceList[level - 1]->indexCount :
+      sub_mesh->indexData->indexCount;
+  }
+  return num_indices / 3;
+}
+
+void HandRendererPrivate::set_auto_crop(bool auto_crop, float margin) {
+  if (margin < 0) {
+    throw runtime_error("The auto-crop margin can't be negative");
+  }
+
+  auto_crop_ = auto_crop;
+  crop_margin_ = margin;
+}
+
+const cv::Mat HandRendererPrivate::keypoint_buffer_cv() const {
+  if (keypoints_.empty()) return cv::Mat();
+
+  return cv::Mat(keypoints_.size() / 4, 4, CV_32FC1,
+                 (void *) &keypoints_[0]);
 }
 
 Vector3 HandRendererPrivate::CamPositionRelativeToHand() {
@@ -27,6 +27,7 @@
 
 # include "hand_camera_spec.h"
 # include "hand_pose.h"
+# include "scene_bundle.h"
 # include "scene_spec.h"
 
 namespace libhand {
@@ -37,9 +38,19 @@ class HandRendererPrivate;
 
 class HAND_EXPORT HandRenderer {
  public:
-  // You should have one instance of HandRenderer class that lives as
-  // long as you plan to render hands. There should not be multiple
-  // instances of HandRenderer existing at the same time.
+  // Any number of HandRenderer instances can exist at the same time,
+  // each with its own render size, scene, pose and outputs.
+  //
+  // SOFTWARE_BACKEND instances are fully independent of each other, so
+  // that every worker thread can own one and render in parallel. A
+  // single instance must not be used by two threads at the same time.
+  //
+  // OGRE_BACKEND instances share the process wide OGRE engine and its
+  // OpenGL context, which is created with the first of them and
+  // destroyed with the last one. OpenGL can only be driven from one
+  // thread, so all of these instances have to be used from the same
+  // thread. Instances loading a scene from the same directory share its
+  // meshes, materials and textures.
   HandRenderer();
   ~HandRenderer();
 
@@ -47,24 +58,76 @@ class HAND_EXPORT HandRenderer {
   static const int kDefaultWidth = 400;
   static const int kDefaultHeight = 400;
   
+  // The rendering backends
+  //    OGRE_BACKEND - the OGRE 3D engine with its OpenGL render system
+  //    SOFTWARE_BACKEND - skinning and rasterization on the CPU alone,
+  //                       for machines without a GPU or an X server.
+  //                       Produces the same kinds of outputs as the OGRE
+  //                       backend (frame, depth, labels, keypoints), but
+  //                       not the same pixels: its rasterization,
+  //                       lighting and texture filtering differ.
+  //    AUTO_BACKEND - OGRE_BACKEND if there is a display to create the
+  //                   OpenGL context with, SOFTWARE_BACKEND on headless
+  //                   machines or if OGRE fails to start, printing
+  //                   the reason to cerr. Setup() then needs no X
+  //                   server and makes no window system round trips.
+  //                   Check backend() for the one chosen.
+  enum Backend {
+    OGRE_BACKEND,
+    SOFTWARE_BACKEND,
+    AUTO_BACKEND
+  };
+
   // The setup routine must be called first.
   //    width - the width of the output buffer in pixels
   //    height - the height of the output buffer in pixels
+  //    backend - the renderer to use, chosen once, at the first call.
+  //              The methods that set the renderer up on their own use
+  //              OGRE_BACKEND.
   void Setup(int width = kDefaultWidth,
-             int height = kDefaultHeight);
+             int height = kDefaultHeight,
+             Backend backend = OGRE_BACKEND);
+
+  // The backend in use (OGRE_BACKEND or SOFTWARE_BACKEND) once set up,
+  // which tells whether AUTO_BACKEND fell back to the software renderer
+  Backend backend() const;
 
   // Partially reloads the 3D engine to adjust all the buffers to the
   // desired output width and height. SetRenderSize() can be called
   // throughout the program.
+  //
+  // The render targets and the buffers of the sizes switched away from
+  // are kept in a pool, so that switching back to one of the last
+  // kMaxPooledRenderSizes sizes allocates nothing. The targets of the
+  // asynchronous ring and of the atlas are still recreated.
   void SetRenderSize(int width = kDefaultWidth,
                      int height = kDefaultHeight);
 
+  static const int kMaxPooledRenderSizes = 8;
+
+  // Creates the render targets and the buffers of the given sizes ahead
+  // of time, so that even the first SetRenderSize() to each of them is
+  // cheap. Sets up the renderer if it is not set up yet.
+  void PrewarmRenderSizes(const vector<cv::Size> &sizes);
+
+  // Releases the pooled render targets and buffers of all the sizes but
+  // the current one
+  void ClearRenderSizePool();
+
   // Loads the 3D scene based on the description in the scene_spec.yml file
   void LoadScene(const SceneSpec &scene_spec);
 
+  // Loads the 3D scene from a precompiled scene bundle (see
+  // scene_bundle.h), without touching the scene directory
+  void LoadScene(const SceneBundle &bundle);
+
   // Updates the hand pose (but does not actually render the hand).
   // If update_camera is set to true, then the camera is going to be moved
   // corresponding to the camera information in the FullHandPose class.
+  //
+  // Only the bones whose joints changed since the last pose are updated.
+  // When no joint changed, e.g. if only the camera moved between two
+  // frames, the skeleton and the mesh skinning are not redone at all.
   void SetHandPose(const FullHandPose &hand_pose,
                    bool update_camera = false);
 
@@ -75,6 +138,145 @@ class HAND_EXPORT HandRenderer {
   // Renders the hand into the pixel buffer.
   void RenderHand();
 
+  // Renders the hand straight into caller-owned memory, bypassing the
+  // internal pixel buffer (which is left untouched). This saves a full
+  // frame copy for callers that want to keep the rendered frame.
+  //
+  // The matrix is (re)allocated to the size and type of
+  // pixel_buffer_cv() only if it does not already have them, so a view
+  // into a larger preallocated matrix is rendered in place.
+  void RenderHandInto(cv::Mat &dst);
+
+  // The raw memory version: row r of the frame is written at
+  // dst + r * stride, where stride must be at least frame_row_bytes().
+  void RenderHandInto(void *dst, size_t stride);
+
+  // Renders a whole batch of hand poses in one call, writing every frame
+  // straight into a caller-provided buffer. The scene checks are done
+  // once per batch rather than once per frame.
+  //    hand_poses - the poses to render, one frame per pose
+  //    camera_specs - either one camera per pose, or a single camera
+  //                   used for all the poses in the batch
+  //    batch_buffer - contiguous memory of at least
+  //                   hand_poses.size() * frame_bytes() bytes. Frame i is
+  //                   written at offset i * frame_bytes() in the same
+  //                   layout as pixel_buffer_raw() (N x H x W x 3 for
+  //                   BGR_FORMAT).
+  //
+  // The internal pixel buffer is left untouched. After the call the
+  // hand is left in the last pose of the batch, while camera_spec() is
+  // not modified.
+  void RenderBatch(const vector<FullHandPose> &hand_poses,
+                   const vector<HandCameraSpec> &camera_specs,
+                   char *batch_buffer);
+
+  // Renders one hand pose from a number of cameras, writing every view
+  // into views_buffer the same way RenderBatch() does (frame i, seen by
+  // camera_specs[i], at offset i * frame_bytes()). The pose is applied
+  // and the hand skinned only once, after which only the camera moves
+  // from view to view. Leaves the hand in the pose, while camera_spec()
+  // is not modified.
+  void RenderViews(const FullHandPose &hand_pose,
+                   const vector<HandCameraSpec> &camera_specs,
+                   char *views_buffer);
+
+  // Atlas rendering
+  //
+  // SetAtlasLayout() arranges columns x rows cells, render_width() x
+  // render_height() pixels each, into one atlas image (0 cells turn the
+  // atlas off). The layout has at most kMaxAtlasCells cells: the OGRE
+  // backend tells the cells apart by the 32 bit visibility flags, one bit
+  // per cell, with the lowest bit taken by the hand of RenderHand().
+  static const int kMaxAtlasCells = 31;
+  void SetAtlasLayout(int columns, int rows);
+
+  // Renders up to columns x rows poses, each into its own cell (cells go
+  // row by row), with either one camera spec per pose or a single one for
+  // all of them. The OGRE backend poses a clone of the hand per cell and
+  // renders all the cells in one pass with a single readback, which cuts
+  // the per-frame overhead of small renders.
+  //
+  // cells is resized to the number of poses and filled with views into
+  // the atlas buffer, valid until the next RenderAtlas(), layout or
+  // render size change. Unused cells are black. The pose and camera of
+  // RenderHand() are not modified.
+  void RenderAtlas(const vector<FullHandPose> &hand_poses,
+                   const vector<HandCameraSpec> &camera_specs,
+                   vector<cv::Mat> *cells);
+
+  // The whole atlas as a CV_8UC3 matrix (an empty matrix if there is no
+  // atlas layout).
+  const cv::Mat atlas_buffer_cv() const;
+
+  // Asynchronous rendering
+  //
+  // SetAsyncDepth() sets up a ring of num_targets render targets (0
+  // turns asynchronous rendering off). Frames are submitted into the ring
+  // and fetched later. The OGRE backend issues the draw calls of a frame
+  // without waiting for the GPU, so the GPU renders the frame while the
+  // caller does its own work, e.g. processes the frames fetched before;
+  // the frame is read back at the next SubmitFrame() or at its
+  // FetchFrame(), by which time it is usually done. The CPU work of a
+  // frame (posing, skinning, issuing the draw calls) is still done
+  // within SubmitFrame(), on the calling thread. The software backend
+  // renders the whole frame within SubmitFrame(). Changing the render
+  // size discards all the frames in flight.
+  void SetAsyncDepth(int num_targets);
+  int async_depth() const;
+
+  // Starts rendering the pose as seen by the given camera into the next
+  // ring target and returns the ticket of the frame. Submitting a frame
+  // first reads back the previously submitted one. Throws if the ring
+  // target is still holding a frame that has not been fetched.
+  int SubmitFrame(const FullHandPose &hand_pose,
+                  const HandCameraSpec &camera_spec);
+
+  // Returns true if the frame has already been read back, i.e. if
+  // FetchFrame() will not wait for the 3D engine. A frame is read back
+  // when the frame following it is submitted.
+  bool PollFrame(int ticket) const;
+
+  // Copies the frame into dst (reallocated to the size and type of
+  // pixel_buffer_cv() if needed) and frees its ring target. If the frame
+  // has not been read back yet, it is read back straight into dst.
+  void FetchFrame(int ticket, cv::Mat *dst);
+
+  // Auto-cropping
+  //
+  // When enabled, RenderHand() and RenderHandInto() frame the hand
+  // tightly rather than render the whole view of the camera. The bounding
+  // box of the projected skeleton (the joints and the fingertips) is
+  // grown by margin times its larger side on every side, widened to the
+  // aspect ratio of the frame and rendered into the whole
+  // render_width() x render_height() frame. The depth map, the labels and
+  // the keypoints are rendered with the same crop. The frames of the
+  // other render calls (batches, views, atlas cells, asynchronous
+  // frames) are never cropped.
+  static const float kDefaultCropMargin;
+  void set_auto_crop(bool auto_crop, float margin = kDefaultCropMargin);
+  bool auto_crop() const;
+
+  // The crop of the last RenderHand() or RenderHandInto() frame, in the
+  // pixel coordinates of the uncropped frame. The crop is scaled by
+  // render_width() / crop_rect().width into the frame. The whole frame if
+  // auto-cropping is off or the hand is behind the camera.
+  cv::Rect_<float> crop_rect() const;
+
+  // Level of detail
+  //
+  // A hand mesh with LOD levels (see the build_mesh_lods tool) is
+  // rendered at its coarsest level that still has a triangle for every
+  // kLodPixelsPerTriangle pixels of the render_width() x render_height()
+  // frame, so the small renders skip the detail they can't show. Auto LOD
+  // is on by default; when off, the full detail mesh is rendered. The
+  // keypoints are computed from the skeleton and are not affected.
+  static const int kLodPixelsPerTriangle = 4;
+  void set_auto_lod(bool auto_lod);
+  bool auto_lod() const;
+
+  // The LOD level in use, 0 being the full detail
+  int lod_level() const;
+
   // The camera distance from the center of the hand object when the
   // scene file was loaded
   float initial_cam_distance() const;
@@ -83,13 +285,119 @@ class HAND_EXPORT HandRenderer {
   int render_width() const;
   int render_height() const;
 
-  // Provides raw access to the pixel buffer. The buffer is
-  // contiguous, row-major, in the BGR888 format, no alpha channel.
+  // Output formats
+  //
+  // The format of the frames produced by RenderHand(), RenderHandInto(),
+  // RenderBatch(), RenderViews() and FetchFrame():
+  //    BGR_FORMAT - BGR888, no alpha channel (the default)
+  //    GRAY_FORMAT - 8-bit luminance, the same as
+  //                  ImageUtils::Grayscale8Bit() of the BGR888 frame
+  //    MASK_FORMAT - 1 byte per pixel, 255 where the luminance is not 0
+  //                  and 0 elsewhere, the same as
+  //                  ImageUtils::MaskFromNonZero() of the BGR888 frame
+  //    PACKED_MASK_FORMAT - the mask at 1 bit per pixel, 8 pixels per
+  //                         byte, the leftmost one in the highest bit.
+  //                         Every row starts at a new byte.
+  // The frames are converted while they are read back, so that the
+  // consumers of grayscale images or masks need neither the BGR888 frame
+  // nor a separate conversion pass. The atlas is always BGR888. Changing
+  // the format discards all the asynchronous frames in flight.
+  enum OutputFormat {
+    BGR_FORMAT,
+    GRAY_FORMAT,
+    MASK_FORMAT,
+    PACKED_MASK_FORMAT
+  };
+  void set_output_format(OutputFormat output_format);
+  OutputFormat output_format() const;
+
+  // Silhouette mode
+  //
+  // When enabled, the frames show the plain white silhouette of the hand
+  // on black: every pixel the hand covers, its dark parts included, is
+  // white. The hand is drawn with a flat, unlit and untextured material,
+  // which skips the lighting and the texturing. With MASK_FORMAT or
+  // GRAY_FORMAT the OGRE backend then reads back a single byte per pixel,
+  // and PACKED_MASK_FORMAT is packed from that. The depth map and the
+  // labels are not affected.
+  void set_silhouette_mode(bool silhouette_mode);
+  bool silhouette_mode() const;
+
+  // The size of a row and of a whole rendered frame in the output
+  // format, in bytes
+  size_t frame_row_bytes() const;
+  size_t frame_bytes() const;
+
+  // Provides raw access to the pixel buffer. The buffer is contiguous,
+  // row-major, in the output format.
   const char *pixel_buffer_raw() const;
 
-  // Provides a light wrapper around the buffer as an OpenCV matrix.
+  // Provides a light wrapper around the buffer as an OpenCV matrix:
+  // render_height() x render_width() CV_8UC3 for BGR_FORMAT, CV_8UC1 for
+  // the other formats, with frame_row_bytes() columns for
+  // PACKED_MASK_FORMAT.
   const cv::Mat pixel_buffer_cv() const;
 
+  // Keypoint output
+  //
+  // RenderHand() and RenderHandInto() also project the joint (the head)
+  // of every bone in the SceneSpec bone map into the frame, using the
+  // same camera. Row i of the CV_32FC1 matrix belongs to bone i and holds
+  //    x, y - the pixel coordinates of the joint
+  //    depth - its distance from the camera plane, as in the depth map
+  //    visible - 1 if the joint is in front of the camera and inside the
+  //              frame, 0 otherwise. With the label output enabled, a
+  //              joint is also hidden if the label image shows neither
+  //              its bone nor the part it connects to around its pixel,
+  //              i.e. if another part of the hand covers it.
+  // The matrix is empty before the first frame is rendered.
+  const cv::Mat keypoint_buffer_cv() const;
+
+  // Depth output
+  //
+  // When enabled, RenderHand() and RenderHandInto() also produce a depth
+  // map of the same frame: for every pixel the distance of the hand
+  // surface from the camera plane, along the viewing direction, in scene
+  // units. Background pixels are 0. The OGRE backend needs GLSL support
+  // for this.
+  //
+  // The software backend writes the depth in the same rasterization pass
+  // as the colour image. The OGRE backend draws the hand a second time
+  // for it, with a depth material into a render target of its own, right
+  // after the colour image and from the same skinned mesh. Enabling the
+  // depth output there costs about one more draw of the hand and one more
+  // readback per frame.
+  void set_depth_enabled(bool depth_enabled);
+  bool depth_enabled() const;
+
+  // The depth map as a CV_32FC1 matrix (an empty matrix if the depth
+  // output is disabled).
+  const cv::Mat depth_buffer_cv() const;
+
+  // Part label output
+  //
+  // When enabled, RenderHand() and RenderHandInto() also produce a label
+  // image of the same frame, where every hand pixel holds the index of
+  // its bone in the SceneSpec bone map plus one, and background pixels
+  // are 0. Mesh parts driven by bones outside the bone map take the label
+  // of their closest ancestor in the bone map.
+  //
+  // The software backend writes the labels in the same rasterization
+  // pass as the colour image. The OGRE backend draws the hand once more
+  // for them, with a flat vertex colour material into a render target of
+  // its own, which costs about one more draw of the hand and one more
+  // readback per frame, on top of the depth pass if that is enabled too.
+  //
+  // The OGRE backend bakes the labels into the hand mesh as vertex
+  // colours, which resets the hand pose if a scene is already loaded.
+  // Enable the labels before LoadScene() to avoid that.
+  void set_labels_enabled(bool labels_enabled);
+  bool labels_enabled() const;
+
+  // The label image as a CV_8UC1 matrix (an empty matrix if the label
+  // output is disabled).
+  const cv::Mat label_buffer_cv() const;
+
  private:
   // PIMPL (Private Implementation pointer)
   HandRendererPrivate *private_;
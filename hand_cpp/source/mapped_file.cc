@@ -0,0 +1,84 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// MappedFile
+
+# include "mapped_file.h"
+
+# include <fstream>
+# include <iterator>
+# include <stdexcept>
+
+#ifndef WIN32
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+# include "printfstring.h"
+
+namespace libhand {
+
+MappedFile::MappedFile() : data_(NULL), size_(0) {}
+
+MappedFile::MappedFile(const string &filename) : data_(NULL), size_(0) {
+  Open(filename);
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+void MappedFile::Open(const string &filename) {
+  Close();
+
+#ifndef WIN32
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw runtime_error(PrintFString("Could not open %s", filename.c_str()));
+  }
+
+  struct stat file_stat;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+    data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    throw runtime_error(PrintFString("Could not map %s", filename.c_str()));
+  }
+  data_ = (const char *) data;
+  size_ = file_stat.st_size;
+#else
+  ifstream file(filename.c_str(), ios::in | ios::binary);
+  if (!file.is_open()) {
+    throw runtime_error(PrintFString("Could not open %s", filename.c_str()));
+  }
+  buffer_.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+  if (buffer_.empty()) {
+    throw runtime_error(PrintFString("Could not map %s", filename.c_str()));
+  }
+  data_ = &buffer_[0];
+  size_ = buffer_.size();
+#endif
+}
+
+void MappedFile::Close() {
+#ifndef WIN32
+  if (data_) munmap((void *) data_, size_);
+#endif
+  data_ = NULL;
+  size_ = 0;
+  vector<char>().swap(buffer_);
+}
+
+}  // namespace libhand
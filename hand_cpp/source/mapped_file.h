@@ -0,0 +1,56 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// MappedFile
+//
+// A whole file mapped read-only into memory. Where files can't be
+// mapped (on Windows), the file is read into memory instead, so the
+// users see the same thing either way. Used by the scene bundles and the
+// pose sets.
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+# include "hand_prereq.h"
+# include <cstddef>
+# include <string>
+# include <vector>
+
+namespace libhand {
+
+using namespace std;
+
+class HAND_EXPORT MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Maps the file, throws a runtime_error if it can't be read
+  explicit MappedFile(const string &filename);
+  void Open(const string &filename);
+
+  bool is_open() const { return data_ != NULL; }
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  void Close();
+
+  const char *data_;
+  size_t size_;
+  vector<char> buffer_;    // Holds the file where it can't be mapped
+
+  // Disallow
+  MappedFile(const MappedFile &rhs);
+  MappedFile& operator= (const MappedFile &rhs);
+};
+
+}  // namespace libhand
+#endif  // MAPPED_FILE_H
@@ -0,0 +1,771 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// MeshLodBuilder
+
+# include "mesh_lod_builder.h"
+
+# include <algorithm>
+# include <cmath>
+# include <cstring>
+# include <fstream>
+# include <iterator>
+# include <map>
+# include <queue>
+# include <stdexcept>
+# include <utility>
+# include <vector>
+
+# include <boost/shared_ptr.hpp>
+
+# include "printfstring.h"
+
+namespace libhand {
+
+const float MeshLodBuilder::kDefaultReduction = 0.25f;
+
+namespace {
+
+// Chunk identifiers, as in OgreMeshFileFormat.h
+const unsigned short kMeshLod = 0x8000;
+const unsigned short kMeshLodUsage = 0x8100;
+const unsigned short kMeshLodGenerated = 0x8120;
+
+// The size of a chunk header: an unsigned short id, an unsigned int size
+const size_t kChunkHeaderSize = 6;
+
+// The LOD strategy named in the file. The values of the levels are
+// distances relative to the full detail one, HandRenderer picks the
+// level itself.
+const char * const kLodStrategy = "Distance";
+
+// The open borders constrain their points this much harder than the
+// surface does
+const double kBorderWeight = 10;
+
+// A collapse between vertices with entirely different skinning weights
+// costs this many times the squared length of the edge, which keeps the
+// borders between the parts (and their labels) sharp
+const double kSkinningWeight = 100;
+
+// A collapse may not turn a triangle more than about 80 degrees
+const double kMinNormalCosine = 0.2;
+
+// The quadric error of a point, the sum of its squared distances to a
+// set of planes, as a symmetric 4x4 matrix
+struct Quadric {
+  Quadric() { fill(a, a + 10, 0.0); }
+
+  void AddPlane(const double *n, double d, double weight) {
+    a[0] += weight * n[0] * n[0]; a[1] += weight * n[0] * n[1];
+    a[2] += weight * n[0] * n[2]; a[3] += weight * n[0] * d;
+    a[4] += weight * n[1] * n[1]; a[5] += weight * n[1] * n[2];
+    a[6] += weight * n[1] * d;    a[7] += weight * n[2] * n[2];
+    a[8] += weight * n[2] * d;    a[9] += weight * d * d;
+  }
+
+  void Add(const Quadric &rhs) {
+    for (int i = 0; i < 10; ++i) a[i] += rhs.a[i];
+  }
+
+  double Error(const float *p) const {
+    const double x = p[0], y = p[1], z = p[2];
+    return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z
+      + 2 * a[3] * x + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+      + a[7] * z * z + 2 * a[8] * z + a[9];
+  }
+
+  double a[10];  // xx xy xz xw yy yz yw zz zw ww
+};
+
+void Cross(const double *a, const double *b, double *result) {
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+double Dot(const double *a, const double *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// The normal of the triangle, scaled by twice its area
+void TriangleNormal(const float *p0, const float *p1, const float *p2,
+                    double *normal) {
+  const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+  Cross(e1, e2, normal);
+}
+
+bool Normalize(double *v) {
+  const double length = sqrt(Dot(v, v));
+  if (length <= 0) return false;
+
+  for (int i = 0; i < 3; ++i) v[i] /= length;
+  return true;
+}
+
+class PositionLess {
+ public:
+  explicit PositionLess(const float *positions) : positions_(positions) {}
+
+  bool operator() (unsigned int a, unsigned int b) const {
+    return lexicographical_compare(positions_ + 3 * a, positions_ + 3 * a + 3,
+                                   positions_ + 3 * b, positions_ + 3 * b + 3);
+  }
+
+ private:
+  const float *positions_;
+};
+
+// Collapses the edges of the triangles made of one vertex buffer. The
+// edges are those of the points: the vertices at the same position,
+// which are split along the texture seams, make one point. Collapsing a
+// point moves every triangle corner on it to a vertex of the target
+// point on the same side of the seams.
+class Simplifier {
+ public:
+  Simplifier(const VertexStreamData &vertices,
+             const vector<VertexBoneAssignmentData> &assignments);
+
+  void AddSubMesh(int sub_mesh, const vector<unsigned int> &indices);
+
+  // After all the sub-meshes are added
+  void Initialize();
+
+  int num_triangles() const { return num_alive_; }
+
+  // Collapses the edges until at most num_triangles are left, or no
+  // edge can be collapsed
+  void Reduce(int num_triangles);
+
+  // The triangles of the sub-mesh that are left
+  void GetIndices(int sub_mesh, vector<unsigned int> *indices) const;
+
+ private:
+  struct Triangle {
+    unsigned int vertices[3];
+    int sub_mesh;
+    bool alive;
+  };
+
+  struct Point {
+    float position[3];
+    int vertex;           // One of its vertices, for the skinning weights
+    Quadric quadric;
+    vector<int> triangles;
+    bool alive;
+    bool border;
+    int version;          // Bumped whenever its collapse may change
+  };
+
+  // The cheapest collapse of a point, ordered for a min-heap
+  struct Collapse {
+    double cost;
+    int point, target, version;
+
+    bool operator< (const Collapse &rhs) const { return cost > rhs.cost; }
+  };
+
+  typedef vector<pair<unsigned int, unsigned int> > VertexMap;
+
+  int CornerOf(const Triangle &triangle, int point) const;
+  void Neighbours(int point, vector<int> *points) const;
+  int NumSharedTriangles(int a, int b, bool *is_border) const;
+  bool MapVertices(int from, int to, VertexMap *vertex_map) const;
+  double SkinningDistance(int vertex_a, int vertex_b) const;
+  bool CollapseCost(int from, int to, double *cost) const;
+  bool FindCollapse(int point, Collapse *collapse) const;
+  void DoCollapse(int from, int to);
+
+  vector<int> point_of_;                  // Per vertex
+  vector<map<unsigned short, float> > skinning_;  // Per vertex
+  vector<Point> points_;
+  vector<Triangle> triangles_;
+  int num_alive_;
+  priority_queue<Collapse> collapses_;
+};
+
+Simplifier::Simplifier(const VertexStreamData &vertices,
+                       const vector<VertexBoneAssignmentData> &assignments) :
+  num_alive_(0) {
+  const size_t num_vertices = vertices.num_vertices;
+  if (vertices.positions.size() < 3 * num_vertices) {
+    throw runtime_error("The mesh has no vertex positions");
+  }
+
+  vector<unsigned int> order(num_vertices);
+  for (size_t i = 0; i < num_vertices; ++i) order[i] = i;
+
+  const PositionLess less(num_vertices ? &vertices.positions[0] : NULL);
+  sort(order.begin(), order.end(), less);
+
+  point_of_.resize(num_vertices);
+  for (size_t i = 0; i < num_vertices; ++i) {
+    const unsigned int vertex = order[i];
+
+    if (!i || less(order[i - 1], vertex)) {
+      Point point;
+      copy(&vertices.positions[3 * vertex],
+           &vertices.positions[3 * vertex] + 3, point.position);
+      point.vertex = vertex;
+      point.alive = true;
+      point.border = false;
+      point.version = 0;
+      points_.push_back(point);
+    }
+    point_of_[vertex] = points_.size() - 1;
+  }
+
+  skinning_.resize(num_vertices);
+  for (size_t i = 0; i < assignments.size(); ++i) {
+    if (assignments[i].vertex < num_vertices) {
+      skinning_[assignments[i].vertex][assignments[i].bone] +=
+        assignments[i].weight;
+    }
+  }
+}
+
+void Simplifier::AddSubMesh(int sub_mesh,
+                            const vector<unsigned int> &indices) {
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    Triangle triangle;
+    triangle.sub_mesh = sub_mesh;
+    triangle.alive = true;
+
+    int points[3];
+    for (int j = 0; j < 3; ++j) {
+      if (indices[i + j] >= point_of_.size()) {
+        throw runtime_error("The mesh has an index out of range");
+      }
+      triangle.vertices[j] = indices[i + j];
+      points[j] = point_of_[indices[i + j]];
+    }
+
+    // The degenerate triangles are dropped from all the levels
+    if (points[0] == points[1] || points[1] == points[2]
+        || points[0] == points[2]) {
+      continue;
+    }
+
+    for (int j = 0; j < 3; ++j) {
+      points_[points[j]].triangles.push_back(triangles_.size());
+    }
+    triangles_.push_back(triangle);
+    ++num_alive_;
+  }
+}
+
+void Simplifier::Initialize() {
+  for (size_t t = 0; t < triangles_.size(); ++t) {
+    const Triangle &triangle = triangles_[t];
+    const float *p[3];
+    for (int j = 0; j < 3; ++j) {
+      p[j] = points_[point_of_[triangle.vertices[j]]].position;
+    }
+
+    double normal[3];
+    TriangleNormal(p[0], p[1], p[2], normal);
+    if (!Normalize(normal)) continue;
+
+    for (int j = 0; j < 3; ++j) {
+      const int a = point_of_[triangle.vertices[j]];
+      const int b = point_of_[triangle.vertices[(j + 1) % 3]];
+
+      double p0[3] = { p[j][0], p[j][1], p[j][2] };
+      points_[a].quadric.AddPlane(normal, -Dot(normal, p0), 1);
+
+      // The plane through a border edge, perpendicular to the triangle
+      bool is_border = false;
+      NumSharedTriangles(a, b, &is_border);
+      if (!is_border) continue;
+
+      const float *p1 = p[(j + 1) % 3];
+      const double edge[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+      double side[3];
+      Cross(edge, normal, side);
+      if (!Normalize(side)) continue;
+
+      const double d = -Dot(side, p0);
+      points_[a].quadric.AddPlane(side, d, kBorderWeight);
+      points_[b].quadric.AddPlane(side, d, kBorderWeight);
+      points_[a].border = points_[b].border = true;
+    }
+  }
+
+  for (size_t i = 0; i < points_.size(); ++i) {
+    Collapse collapse;
+    if (FindCollapse(i, &collapse)) collapses_.push(collapse);
+  }
+}
+
+void Simplifier::Reduce(int num_triangles) {
+  while (num_alive_ > num_triangles && !collapses_.empty()) {
+    const Collapse queued = collapses_.top();
+    collapses_.pop();
+
+    const Point &point = points_[queued.point];
+    if (!point.alive || point.version != queued.version) continue;
+
+    // The neighbourhood may have changed since the collapse was queued
+    Collapse collapse;
+    if (!FindCollapse(queued.point, &collapse)) continue;
+    if (collapse.cost > queued.cost) {
+      collapses_.push(collapse);
+      continue;
+    }
+
+    DoCollapse(collapse.point, collapse.target);
+  }
+}
+
+void Simplifier::GetIndices(int sub_mesh,
+                            vector<unsigned int> *indices) const {
+  indices->clear();
+  for (size_t t = 0; t < triangles_.size(); ++t) {
+    const Triangle &triangle = triangles_[t];
+    if (triangle.alive && triangle.sub_mesh == sub_mesh) {
+      indices->insert(indices->end(), triangle.vertices,
+                      triangle.vertices + 3);
+    }
+  }
+}
+
+// Returns -1 if the triangle has no corner on the point
+int Simplifier::CornerOf(const Triangle &triangle, int point) const {
+  for (int j = 0; j < 3; ++j) {
+    if (point_of_[triangle.vertices[j]] == point) return j;
+  }
+  return -1;
+}
+
+// Sorted
+void Simplifier::Neighbours(int point, vector<int> *points) const {
+  points->clear();
+
+  const vector<int> &triangles = points_[point].triangles;
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    const Triangle &triangle = triangles_[triangles[i]];
+    for (int j = 0; j < 3; ++j) {
+      const int neighbour = point_of_[triangle.vertices[j]];
+      if (neighbour != point) points->push_back(neighbour);
+    }
+  }
+
+  sort(points->begin(), points->end());
+  points->erase(unique(points->begin(), points->end()), points->end());
+}
+
+// The edge is a border if it does not have a triangle on both sides, or
+// if the two are of different sub-meshes
+int Simplifier::NumSharedTriangles(int a, int b, bool *is_border) const {
+  int num_shared = 0;
+  int sub_mesh = -1;
+  bool mixed = false;
+
+  const vector<int> &triangles = points_[a].triangles;
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    const Triangle &triangle = triangles_[triangles[i]];
+    if (CornerOf(triangle, b) < 0) continue;
+
+    if (num_shared++ && triangle.sub_mesh != sub_mesh) mixed = true;
+    sub_mesh = triangle.sub_mesh;
+  }
+
+  *is_border = num_shared != 2 || mixed;
+  return num_shared;
+}
+
+// Maps every vertex of the from point to the vertex of the to point it
+// meets in a triangle of the edge. Fails if a vertex of the from point
+// is on a seam that the edge crosses: it has no vertex to go to, and
+// moving it would tear the seam open.
+bool Simplifier::MapVertices(int from, int to, VertexMap *vertex_map) const {
+  vertex_map->clear();
+
+  const vector<int> &triangles = points_[from].triangles;
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    const Triangle &triangle = triangles_[triangles[i]];
+    const int to_corner = CornerOf(triangle, to);
+    if (to_corner < 0) continue;
+
+    const unsigned int vertex = triangle.vertices[CornerOf(triangle, from)];
+    const unsigned int target = triangle.vertices[to_corner];
+
+    bool is_mapped = false;
+    for (size_t j = 0; j < vertex_map->size(); ++j) {
+      if ((*vertex_map)[j].first != vertex) continue;
+      if ((*vertex_map)[j].second != target) return false;
+      is_mapped = true;
+    }
+    if (!is_mapped) vertex_map->push_back(make_pair(vertex, target));
+  }
+
+  for (size_t i = 0; i < triangles.size(); ++i) {
+    const Triangle &triangle = triangles_[triangles[i]];
+    const unsigned int vertex = triangle.vertices[CornerOf(triangle, from)];
+
+    bool is_mapped = false;
+    for (size_t j = 0; j < vertex_map->size(); ++j) {
+      if ((*vertex_map)[j].first == vertex) is_mapped = true;
+    }
+    if (!is_mapped) return false;
+  }
+
+  return true;
+}
+
+// The sum of the weight differences over the bones, from 0 for the same
+// skinning to 2 for entirely different bones
+double Simplifier::SkinningDistance(int vertex_a, int vertex_b) const {
+  const map<unsigned short, float> &a = skinning_[vertex_a];
+  const map<unsigned short, float> &b = skinning_[vertex_b];
+
+  double sum_a = 0, sum_b = 0;
+  map<unsigned short, float>::const_iterator i;
+  for (i = a.begin(); i != a.end(); ++i) sum_a += i->second;
+  for (i = b.begin(); i != b.end(); ++i) sum_b += i->second;
+  if (sum_a <= 0 || sum_b <= 0) return sum_a == sum_b ? 0 : 2;
+
+  double distance = 0;
+  for (i = a.begin(); i != a.end(); ++i) {
+    map<unsigned short, float>::const_iterator j = b.find(i->first);
+    distance += fabs(i->second / sum_a
+                     - (j == b.end() ? 0 : j->second / sum_b));
+  }
+  for (i = b.begin(); i != b.end(); ++i) {
+    if (a.find(i->first) == a.end()) distance += i->second / sum_b;
+  }
+
+  return distance;
+}
+
+// Returns false if the collapse would break the mesh
+bool Simplifier::CollapseCost(int from, int to, double *cost) const {
+  const Point &from_point = points_[from];
+  const Point &to_point = points_[to];
+
+  bool is_border = false;
+  const int num_shared = NumSharedTriangles(from, to, &is_border);
+  if (!num_shared || num_shared > 2) return false;
+
+  // The border points only move along their border
+  if (from_point.border && !is_border) return false;
+
+  // The end points may share no neighbours but those of the triangles
+  // of the edge, or the collapse pinches the surface
+  vector<int> from_neighbours, to_neighbours, shared;
+  Neighbours(from, &from_neighbours);
+  Neighbours(to, &to_neighbours);
+  set_intersection(from_neighbours.begin(), from_neighbours.end(),
+                   to_neighbours.begin(), to_neighbours.end(),
+                   back_inserter(shared));
+  if ((int) shared.size() != num_shared) return false;
+
+  VertexMap vertex_map;
+  if (!MapVertices(from, to, &vertex_map)) return false;
+
+  // The triangles that stay must not flip over
+  for (size_t i = 0; i < from_point.triangles.size(); ++i) {
+    const Triangle &triangle = triangles_[from_point.triangles[i]];
+    if (CornerOf(triangle, to) >= 0) continue;
+
+    const float *before[3], *after[3];
+    for (int j = 0; j < 3; ++j) {
+      const int point = point_of_[triangle.vertices[j]];
+      before[j] = points_[point].position;
+      after[j] = point == from ? to_point.position : before[j];
+    }
+
+    double normal_before[3], normal_after[3];
+    TriangleNormal(before[0], before[1], before[2], normal_before);
+    TriangleNormal(after[0], after[1], after[2], normal_after);
+
+    const double length = sqrt(Dot(normal_before, normal_before)
+                               * Dot(normal_after, normal_after));
+    if (length <= 0
+        || Dot(normal_before, normal_after) < kMinNormalCosine * length) {
+      return false;
+    }
+  }
+
+  Quadric quadric = from_point.quadric;
+  quadric.Add(to_point.quadric);
+
+  double edge[3];
+  for (int i = 0; i < 3; ++i) {
+    edge[i] = to_point.position[i] - from_point.position[i];
+  }
+  const double skinning_distance =
+    SkinningDistance(from_point.vertex, to_point.vertex);
+
+  *cost = quadric.Error(to_point.position)
+    + kSkinningWeight * skinning_distance * skinning_distance
+    * Dot(edge, edge);
+  return true;
+}
+
+bool Simplifier::FindCollapse(int point, Collapse *collapse) const {
+  vector<int> neighbours;
+  Neighbours(point, &neighbours);
+
+  bool found = false;
+  for (size_t i = 0; i < neighbours.size(); ++i) {
+    double cost;
+    if (!CollapseCost(point, neighbours[i], &cost)) continue;
+
+    if (!found || cost < collapse->cost) {
+      collapse->cost = cost;
+      collapse->target = neighbours[i];
+      found = true;
+    }
+  }
+
+  collapse->point = point;
+  collapse->version = points_[point].version;
+  return found;
+}
+
+void Simplifier::DoCollapse(int from, int to) {
+  VertexMap vertex_map;
+  MapVertices(from, to, &vertex_map);
+
+  Point &from_point = points_[from];
+  Point &to_point = points_[to];
+
+  for (size_t i = 0; i < from_point.triangles.size(); ++i) {
+    const int t = from_point.triangles[i];
+    Triangle &triangle = triangles_[t];
+    const int corner = CornerOf(triangle, from);
+
+    if (CornerOf(triangle, to) >= 0) {
+      // The triangles of the edge vanish
+      triangle.alive = false;
+      --num_alive_;
+
+      for (int j = 0; j < 3; ++j) {
+        if (j == corner) continue;
+
+        vector<int> &triangles =
+          points_[point_of_[triangle.vertices[j]]].triangles;
+        triangles.erase(find(triangles.begin(), triangles.end(), t));
+      }
+    } else {
+      for (size_t j = 0; j < vertex_map.size(); ++j) {
+        if (vertex_map[j].first == triangle.vertices[corner]) {
+          triangle.vertices[corner] = vertex_map[j].second;
+          break;
+        }
+      }
+      to_point.triangles.push_back(t);
+    }
+  }
+
+  to_point.quadric.Add(from_point.quadric);
+  to_point.border = to_point.border || from_point.border;
+
+  from_point.alive = false;
+  from_point.triangles.clear();
+  ++from_point.version;
+
+  // The collapses around the target point have all changed
+  vector<int> points;
+  Neighbours(to, &points);
+  points.push_back(to);
+
+  for (size_t i = 0; i < points.size(); ++i) {
+    ++points_[points[i]].version;
+
+    Collapse collapse;
+    if (FindCollapse(points[i], &collapse)) collapses_.push(collapse);
+  }
+}
+
+// The file data is written in the native byte order, like the
+// OgreFileReader only the little-endian files are supported
+template <class T> void Append(const T &value, string *data) {
+  data->append((const char *) &value, sizeof(value));
+}
+
+void AppendChunkHeader(unsigned short id, size_t size, string *data) {
+  Append(id, data);
+  Append((unsigned int) size, data);
+}
+
+bool Needs32BitIndices(const vector<unsigned int> &indices) {
+  for (size_t i = 0; i < indices.size(); ++i) {
+    if (indices[i] > 0xffff) return true;
+  }
+  return false;
+}
+
+size_t GeneratedChunkSize(const vector<unsigned int> &indices) {
+  return kChunkHeaderSize + sizeof(unsigned int) + 1
+    + indices.size() * (Needs32BitIndices(indices) ? 4 : 2);
+}
+
+}  // namespace
+
+void MeshLodBuilder::BuildLods(MeshData *mesh, int num_levels,
+                               float reduction) {
+  if (num_levels < 0 || reduction <= 0 || reduction >= 1) {
+    throw runtime_error("Bad LOD level count or reduction");
+  }
+
+  vector<SubMeshData> &sub_meshes = mesh->sub_meshes;
+  mesh->lod_values.clear();
+  for (size_t i = 0; i < sub_meshes.size(); ++i) {
+    sub_meshes[i].lod_indices.clear();
+  }
+
+  // One per vertex buffer: the shared one and those of the sub-meshes
+  // with their own vertices
+  vector<boost::shared_ptr<Simplifier> > simplifiers;
+  vector<Simplifier *> simplifier_of(sub_meshes.size());
+  Simplifier *shared = NULL;
+
+  for (size_t i = 0; i < sub_meshes.size(); ++i) {
+    if (!sub_meshes[i].use_shared_vertices) {
+      simplifiers.push_back(boost::shared_ptr<Simplifier>
+                            (new Simplifier(sub_meshes[i].vertices,
+                                            sub_meshes[i].bone_assignments)));
+      simplifier_of[i] = simplifiers.back().get();
+    } else {
+      if (!shared) {
+        simplifiers.push_back(boost::shared_ptr<Simplifier>
+                              (new Simplifier(mesh->shared_vertices,
+                                              mesh->bone_assignments)));
+        shared = simplifiers.back().get();
+      }
+      simplifier_of[i] = shared;
+    }
+
+    simplifier_of[i]->AddSubMesh(i, sub_meshes[i].indices);
+  }
+
+  vector<int> full_triangles;
+  int num_triangles = 0;
+  for (size_t i = 0; i < simplifiers.size(); ++i) {
+    simplifiers[i]->Initialize();
+    full_triangles.push_back(simplifiers[i]->num_triangles());
+    num_triangles += full_triangles.back();
+  }
+
+  float fraction = 1;
+  for (int level = 1; level <= num_levels; ++level) {
+    fraction *= reduction;
+
+    int target = 0, level_triangles = 0;
+    for (size_t i = 0; i < simplifiers.size(); ++i) {
+      const int simplifier_target =
+        max(1, (int) ceil(full_triangles[i] * fraction));
+      simplifiers[i]->Reduce(simplifier_target);
+
+      target += simplifier_target;
+      level_triangles += simplifiers[i]->num_triangles();
+    }
+
+    // Not worth a level if the mesh could not get close to the target
+    if (level_triangles > (num_triangles + target) / 2) break;
+    num_triangles = level_triangles;
+
+    mesh->lod_values.push_back(sqrt(1 / fraction));
+    for (size_t i = 0; i < sub_meshes.size(); ++i) {
+      sub_meshes[i].lod_indices.push_back(vector<unsigned int>());
+      simplifier_of[i]->GetIndices(i, &sub_meshes[i].lod_indices.back());
+    }
+  }
+}
+
+void MeshLodBuilder::SaveLods(const string &src_filename,
+                              const MeshData &mesh,
+                              const string &dst_filename) {
+  MeshData src_mesh;
+  OgreFileReader::LoadMesh(src_filename, &src_mesh);
+
+  if (!src_mesh.lod_values.empty()) {
+    throw runtime_error(PrintFString("The mesh %s already has LOD levels",
+                                     src_filename.c_str()));
+  }
+  if (src_mesh.sub_meshes.size() != mesh.sub_meshes.size()) {
+    throw runtime_error(PrintFString("The LOD levels are not of the mesh %s",
+                                     src_filename.c_str()));
+  }
+
+  const size_t num_levels = mesh.lod_values.size();
+  for (size_t i = 0; i < mesh.sub_meshes.size(); ++i) {
+    if (mesh.sub_meshes[i].lod_indices.size() != num_levels) {
+      throw runtime_error("The mesh has a sub-mesh without LOD levels");
+    }
+  }
+
+  // The LOD chunks, as the OGRE mesh serializer (v1.41) writes them. The
+  // size of the first one only covers the LOD summary.
+  string lod_data;
+  AppendChunkHeader(kMeshLod, kChunkHeaderSize + strlen(kLodStrategy) + 1
+                    + sizeof(unsigned short) + 1, &lod_data);
+  lod_data += kLodStrategy;
+  lod_data += '\n';
+  Append((unsigned short) (num_levels + 1), &lod_data);
+  Append((unsigned char) 0, &lod_data);  // Generated, not manual
+
+  for (size_t level = 0; level < num_levels; ++level) {
+    size_t usage_size = kChunkHeaderSize + sizeof(float);
+    for (size_t i = 0; i < mesh.sub_meshes.size(); ++i) {
+      usage_size += GeneratedChunkSize(mesh.sub_meshes[i].lod_indices[level]);
+    }
+
+    AppendChunkHeader(kMeshLodUsage, usage_size, &lod_data);
+    Append(mesh.lod_values[level], &lod_data);
+
+    for (size_t i = 0; i < mesh.sub_meshes.size(); ++i) {
+      const vector<unsigned int> &indices =
+        mesh.sub_meshes[i].lod_indices[level];
+      const bool indices_32_bit = Needs32BitIndices(indices);
+
+      AppendChunkHeader(kMeshLodGenerated, GeneratedChunkSize(indices),
+                        &lod_data);
+      Append((unsigned int) indices.size(), &lod_data);
+      Append((unsigned char) indices_32_bit, &lod_data);
+      for (size_t j = 0; j < indices.size(); ++j) {
+        if (indices_32_bit) {
+          Append(indices[j], &lod_data);
+        } else {
+          Append((unsigned short) indices[j], &lod_data);
+        }
+      }
+    }
+  }
+
+  // The chunks of a mesh are read in any order, so the LOD levels simply
+  // follow the last one
+  ifstream src(src_filename.c_str(), ios::in | ios::binary);
+  if (!src.is_open()) {
+    throw runtime_error(PrintFString("Could not open %s",
+                                     src_filename.c_str()));
+  }
+  const string src_data((istreambuf_iterator<char>(src)),
+                        istreambuf_iterator<char>());
+  src.close();
+
+  ofstream dst(dst_filename.c_str(), ios::out | ios::binary | ios::trunc);
+  if (!dst.is_open()) {
+    throw runtime_error(PrintFString("Could not write %s",
+                                     dst_filename.c_str()));
+  }
+  dst << src_data << lod_data;
+  dst.close();
+
+  if (!dst) {
+    throw runtime_error(PrintFString("Could not write %s",
+                                     dst_filename.c_str()));
+  }
+}
+
+}  // namespace libhand
@@ -0,0 +1,68 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// MeshLodBuilder
+//
+// The MeshLodBuilder class generates the LOD (level of detail) levels of
+// a mesh offline and saves them into its .mesh file, where both the OGRE
+// 3D engine and the software renderer find them. HandRenderer then picks
+// the level by the render size (see HandRenderer::set_auto_lod()).
+//
+// The levels are made by collapsing the edges of the mesh one at a time,
+// the cheapest first by the quadric error metric. A vertex is always
+// collapsed into one of its neighbours, so the levels only drop
+// triangles and keep using the original vertices: every vertex keeps its
+// bone assignments (the skinning weights), its texture coordinates and
+// its part label. The open borders, the texture seams and the borders
+// between the sub-meshes are kept intact, and a collapse between
+// vertices skinned to different bones costs extra, so that the joints
+// keep bending the way they do at full detail.
+
+#ifndef MESH_LOD_BUILDER_H
+#define MESH_LOD_BUILDER_H
+
+# include "hand_prereq.h"
+# include <string>
+
+# include "ogre_file_reader.h"
+
+namespace libhand {
+
+using namespace std;
+
+class HAND_EXPORT MeshLodBuilder {
+ public:
+  static const int kDefaultNumLevels = 3;
+
+  // The fraction of the triangles of the previous level a level keeps
+  static const float kDefaultReduction;
+
+  // Generates the LOD levels of the mesh, replacing any it had. Fewer
+  // levels are made if the mesh can't be reduced that far.
+  static void BuildLods(MeshData *mesh,
+                        int num_levels = kDefaultNumLevels,
+                        float reduction = kDefaultReduction);
+
+  // Writes the .mesh file the mesh was read from, together with the LOD
+  // levels of the mesh, to dst_filename (which can be the same file).
+  // The source file must not have any LOD levels of its own. Throws a
+  // runtime_error on failure.
+  static void SaveLods(const string &src_filename, const MeshData &mesh,
+                       const string &dst_filename);
+
+ private:
+  // Disallow
+  MeshLodBuilder();
+  MeshLodBuilder(const MeshLodBuilder &rhs);
+  MeshLodBuilder& operator= (const MeshLodBuilder &rhs);
+};
+
+}  // namespace libhand
+#endif  // MESH_LOD_BUILDER_H
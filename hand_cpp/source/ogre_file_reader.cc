@@ -0,0 +1,569 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// OgreFileReader
+
+# include <algorithm>
+# include <cstdlib>
+# include <cstring>
+# include <fstream>
+# include <iterator>
+# include <stdexcept>
+
+# include "ogre_file_reader.h"
+
+# include "tinyxml/tinyxml.h"
+
+# include "affine_transform.h"
+# include "printfstring.h"
+
+namespace libhand {
+
+using namespace std;
+
+// Chunk identifiers, as in OgreMeshFileFormat.h and OgreSkeletonFileFormat.h
+static const unsigned short kChunkHeader = 0x1000;
+
+static const unsigned short kMesh = 0x3000;
+static const unsigned short kSubMesh = 0x4000;
+static const unsigned short kSubMeshOperation = 0x4010;
+static const unsigned short kSubMeshBoneAssignment = 0x4100;
+static const unsigned short kGeometry = 0x5000;
+static const unsigned short kGeometryVertexDeclaration = 0x5100;
+static const unsigned short kGeometryVertexElement = 0x5110;
+static const unsigned short kGeometryVertexBuffer = 0x5200;
+static const unsigned short kGeometryVertexBufferData = 0x5210;
+static const unsigned short kMeshSkeletonLink = 0x6000;
+static const unsigned short kMeshBoneAssignment = 0x7000;
+static const unsigned short kMeshLod = 0x8000;
+static const unsigned short kMeshLodUsage = 0x8100;
+static const unsigned short kMeshLodGenerated = 0x8120;
+
+static const unsigned short kSkeletonBone = 0x2000;
+static const unsigned short kSkeletonBoneParent = 0x3000;
+
+// The size of a chunk header: an unsigned short id, an unsigned int size
+static const size_t kChunkHeaderSize = 6;
+
+// The size of a bone chunk that carries no scale, not counting the name
+static const size_t kBoneChunkSizeNoScale = kChunkHeaderSize + 2 + 7 * 4;
+
+// Vertex element types and semantics (OgreHardwareVertexBuffer.h)
+enum { kVetFloat1 = 0, kVetFloat2 = 1, kVetFloat3 = 2, kVetFloat4 = 3 };
+enum { kVesPosition = 1, kVesNormal = 4, kVesTextureCoordinates = 7 };
+
+// Render operation types (OgreRenderOperation.h)
+enum { kOtTriangleList = 4, kOtTriangleStrip = 5, kOtTriangleFan = 6 };
+
+namespace {
+
+// Reads the little-endian binary data of a whole file, or of a file
+// already in memory. OGRE writes the files in the native byte order of
+// the exporting machine, we only accept the little-endian ones.
+class ChunkStream {
+ public:
+  explicit ChunkStream(const string &filename) : filename_(filename), pos_(0) {
+    ifstream file(filename.c_str(), ios::in | ios::binary);
+    if (!file.is_open())
+      throw runtime_error(PrintFString("Could not open %s",
+                                       filename.c_str()));
+
+    file_data_.assign(istreambuf_iterator<char>(file),
+                      istreambuf_iterator<char>());
+    data_ = file_data_.empty() ? NULL : &file_data_[0];
+    size_ = file_data_.size();
+    ReadHeader();
+  }
+
+  ChunkStream(const string &filename, const char *data, size_t size) :
+    filename_(filename), data_(data), size_(size), pos_(0) {
+    ReadHeader();
+  }
+
+  const string &filename() const { return filename_; }
+  bool eof() const { return pos_ >= size_; }
+  size_t pos() const { return pos_; }
+  size_t remaining() const { return size_ - pos_; }
+
+  void Seek(size_t pos) {
+    if (pos > size_) Fail();
+    pos_ = pos;
+  }
+
+  void Read(void *dst, size_t num_bytes) {
+    if (num_bytes > size_ - pos_) Fail();
+    memcpy(dst, data_ + pos_, num_bytes);
+    pos_ += num_bytes;
+  }
+
+  template <class T> T Read() {
+    T value;
+    Read(&value, sizeof(value));
+    return value;
+  }
+
+  unsigned short ReadUShort() { return Read<unsigned short>(); }
+  unsigned int ReadUInt() { return Read<unsigned int>(); }
+  float ReadFloat() { return Read<float>(); }
+  bool ReadBool() { return Read<unsigned char>() != 0; }
+
+  // Strings are terminated by a newline
+  string ReadString() {
+    size_t end = pos_;
+    while (end < size_ && data_[end] != '\n') ++end;
+    if (end == size_) Fail();
+
+    string result(data_ + pos_, data_ + end);
+    pos_ = end + 1;
+    return result;
+  }
+
+  const char *Data(size_t num_bytes) {
+    if (num_bytes > size_ - pos_) Fail();
+    const char *result = data_ + pos_;
+    pos_ += num_bytes;
+    return result;
+  }
+
+  void Fail() const {
+    throw runtime_error(PrintFString("%s is truncated or corrupt",
+                                     filename_.c_str()));
+  }
+
+ private:
+  void ReadHeader() {
+    if (ReadUShort() != kChunkHeader)
+      throw runtime_error(PrintFString("%s is not a little-endian OGRE file",
+                                       filename_.c_str()));
+    ReadString();
+  }
+
+  string filename_;
+  vector<char> file_data_;
+  const char *data_;
+  size_t size_;
+  size_t pos_;
+};
+
+struct VertexElement {
+  unsigned short source, type, semantic, offset, index;
+};
+
+int NumFloats(const VertexElement &element) {
+  switch (element.type) {
+    case kVetFloat1: return 1;
+    case kVetFloat2: return 2;
+    case kVetFloat3: return 3;
+    case kVetFloat4: return 4;
+    default: return 0;
+  }
+}
+
+// Copies one element of the interleaved vertex buffer into a packed
+// array of num_components floats per vertex. The element has to lie
+// within the vertex, see ReadVertexBuffer().
+void Unpack(const char *buffer, size_t num_vertices, size_t vertex_size,
+            const VertexElement &element, int num_components,
+            vector<float> *dst) {
+  int num_floats = NumFloats(element);
+  int num_copied = min(num_floats, num_components);
+
+  dst->assign(num_vertices * num_components, 0);
+  for (size_t i = 0; i < num_vertices; ++i) {
+    memcpy(&(*dst)[i * num_components],
+           buffer + i * vertex_size + element.offset,
+           num_copied * sizeof(float));
+  }
+}
+
+void ReadVertexBuffer(ChunkStream *stream,
+                      const vector<VertexElement> &elements,
+                      VertexStreamData *vertices) {
+  unsigned short bind_index = stream->ReadUShort();
+  unsigned short vertex_size = stream->ReadUShort();
+
+  if (stream->ReadUShort() != kGeometryVertexBufferData) stream->Fail();
+  stream->ReadUInt();
+
+  const char *buffer = stream->Data(vertices->num_vertices * vertex_size);
+
+  for (size_t i = 0; i < elements.size(); ++i) {
+    const VertexElement &element = elements[i];
+    if (element.source != bind_index || !NumFloats(element)) continue;
+
+    // A bad declaration must not read past the vertex, or the buffer
+    if (element.offset + NumFloats(element) * sizeof(float) > vertex_size) {
+      stream->Fail();
+    }
+
+    if (element.semantic == kVesPosition) {
+      Unpack(buffer, vertices->num_vertices, vertex_size, element, 3,
+             &vertices->positions);
+    } else if (element.semantic == kVesNormal) {
+      Unpack(buffer, vertices->num_vertices, vertex_size, element, 3,
+             &vertices->normals);
+    } else if (element.semantic == kVesTextureCoordinates
+               && element.index == 0) {
+      Unpack(buffer, vertices->num_vertices, vertex_size, element, 2,
+             &vertices->uvs);
+    }
+  }
+}
+
+void ReadIndices(ChunkStream *stream, vector<unsigned int> *indices) {
+  unsigned int index_count = stream->ReadUInt();
+  bool indices_32_bit = stream->ReadBool();
+
+  // A corrupt count is caught before it is allocated
+  const size_t index_size = indices_32_bit ? 4 : 2;
+  if (index_count > stream->remaining() / index_size) stream->Fail();
+
+  indices->resize(index_count);
+  for (unsigned int i = 0; i < index_count; ++i) {
+    (*indices)[i] = indices_32_bit ?
+        stream->ReadUInt() : stream->ReadUShort();
+  }
+}
+
+// Turns the strips and fans into the triangle lists
+void ConvertToTriangleList(unsigned short operation_type,
+                           vector<unsigned int> *indices) {
+  if (operation_type == kOtTriangleList) return;
+  if (operation_type != kOtTriangleStrip && operation_type != kOtTriangleFan)
+    throw runtime_error(PrintFString("Unsupported render operation type %d",
+                                     (int) operation_type));
+
+  vector<unsigned int> list;
+  for (size_t i = 2; i < indices->size(); ++i) {
+    if (operation_type == kOtTriangleFan) {
+      list.push_back((*indices)[0]);
+      list.push_back((*indices)[i - 1]);
+    } else if (i % 2) {
+      list.push_back((*indices)[i - 1]);
+      list.push_back((*indices)[i - 2]);
+    } else {
+      list.push_back((*indices)[i - 2]);
+      list.push_back((*indices)[i - 1]);
+    }
+    list.push_back((*indices)[i]);
+  }
+  indices->swap(list);
+}
+
+VertexBoneAssignmentData ReadBoneAssignment(ChunkStream *stream) {
+  VertexBoneAssignmentData assignment;
+  assignment.vertex = stream->ReadUInt();
+  assignment.bone = stream->ReadUShort();
+  assignment.weight = stream->ReadFloat();
+  return assignment;
+}
+
+float Attribute(const TiXmlElement *element, const char *name,
+                float default_value) {
+  const char *value = element ? element->Attribute(name) : NULL;
+  return value ? (float) atof(value) : default_value;
+}
+
+// The local transform of a .scene node: scale, then rotate, then
+// translate
+AffineTransform NodeTransform(const TiXmlElement *node) {
+  const TiXmlElement *position = node->FirstChildElement("position");
+  const TiXmlElement *rotation = node->FirstChildElement("rotation");
+  const TiXmlElement *scale = node->FirstChildElement("scale");
+
+  const float p[3] = { Attribute(position, "x", 0),
+                       Attribute(position, "y", 0),
+                       Attribute(position, "z", 0) };
+  const float q[4] = { Attribute(rotation, "qw", 1),
+                       Attribute(rotation, "qx", 0),
+                       Attribute(rotation, "qy", 0),
+                       Attribute(rotation, "qz", 0) };
+  const float s[3] = { Attribute(scale, "x", 1), Attribute(scale, "y", 1),
+                       Attribute(scale, "z", 1) };
+
+  return MakeAffine(p, q, s);
+}
+
+// Looks for the entity under the node and its children
+bool FindEntity(const TiXmlElement *node, const AffineTransform &parent,
+                const string &entity_name, SceneEntityData *entity) {
+  const AffineTransform world = Multiply(parent, NodeTransform(node));
+
+  for (const TiXmlElement *element = node->FirstChildElement("entity");
+       element; element = element->NextSiblingElement("entity")) {
+    const char *name = element->Attribute("name");
+    if (!name || entity_name != name) continue;
+
+    const char *mesh_file = element->Attribute("meshFile");
+    if (!mesh_file) {
+      throw runtime_error(PrintFString("The entity %s has no mesh", name));
+    }
+
+    entity->mesh_file = mesh_file;
+    memcpy(entity->transform, world.m, sizeof(world.m));
+    return true;
+  }
+
+  for (const TiXmlElement *child = node->FirstChildElement("node");
+       child; child = child->NextSiblingElement("node")) {
+    if (FindEntity(child, world, entity_name, entity)) return true;
+  }
+
+  return false;
+}
+
+// The chunks are read sequentially, the same way the OGRE serializer
+// does it. The chunk sizes are only used to skip the unknown chunks:
+// the exporters do not always account for the nested chunks in the
+// size of their parent chunk.
+void ReadMesh(ChunkStream *stream, MeshData *mesh) {
+  *mesh = MeshData();
+
+  VertexStreamData *vertices = NULL;
+  vector<VertexElement> elements;
+  bool lod_is_manual = false;
+  size_t lod_sub_mesh = 0;
+
+  while (!stream->eof()) {
+    size_t chunk_start = stream->pos();
+    unsigned short id = stream->ReadUShort();
+    unsigned int size = stream->ReadUInt();
+
+    switch (id) {
+      case kMesh:
+        stream->ReadBool();  // Skeletally animated
+        break;
+      case kGeometry:
+        if (!mesh->sub_meshes.empty()
+            && !mesh->sub_meshes.back().use_shared_vertices) {
+          vertices = &mesh->sub_meshes.back().vertices;
+        } else {
+          vertices = &mesh->shared_vertices;
+        }
+        vertices->num_vertices = stream->ReadUInt();
+        elements.clear();
+        break;
+      case kGeometryVertexDeclaration:
+        break;  // The elements follow
+      case kGeometryVertexElement: {
+        VertexElement element;
+        element.source = stream->ReadUShort();
+        element.type = stream->ReadUShort();
+        element.semantic = stream->ReadUShort();
+        element.offset = stream->ReadUShort();
+        element.index = stream->ReadUShort();
+        elements.push_back(element);
+        break;
+      }
+      case kGeometryVertexBuffer:
+        if (!vertices) stream->Fail();
+        ReadVertexBuffer(stream, elements, vertices);
+        break;
+      case kSubMesh: {
+        mesh->sub_meshes.push_back(SubMeshData());
+        SubMeshData &sub_mesh = mesh->sub_meshes.back();
+        sub_mesh.material_name = stream->ReadString();
+        sub_mesh.use_shared_vertices = stream->ReadBool();
+        ReadIndices(stream, &sub_mesh.indices);
+        break;
+      }
+      case kSubMeshOperation:
+        if (mesh->sub_meshes.empty()) stream->Fail();
+        ConvertToTriangleList(stream->ReadUShort(),
+                              &mesh->sub_meshes.back().indices);
+        break;
+      case kSubMeshBoneAssignment:
+        if (mesh->sub_meshes.empty()) stream->Fail();
+        mesh->sub_meshes.back().bone_assignments.push_back(
+            ReadBoneAssignment(stream));
+        break;
+      case kMeshSkeletonLink:
+        mesh->skeleton_name = stream->ReadString();
+        break;
+      case kMeshBoneAssignment:
+        mesh->bone_assignments.push_back(ReadBoneAssignment(stream));
+        break;
+      case kMeshLod:
+        stream->ReadString();  // The LOD strategy
+        stream->ReadUShort();  // The number of levels, the full one included
+        lod_is_manual = stream->ReadBool();
+        break;
+      case kMeshLodUsage:
+        // The manual levels are other mesh files
+        if (lod_is_manual) {
+          if (size < kChunkHeaderSize) stream->Fail();
+          stream->Seek(chunk_start + size);
+          break;
+        }
+        mesh->lod_values.push_back(stream->ReadFloat());
+        for (size_t i = 0; i < mesh->sub_meshes.size(); ++i) {
+          mesh->sub_meshes[i].lod_indices.push_back(vector<unsigned int>());
+        }
+        lod_sub_mesh = 0;
+        break;
+      case kMeshLodGenerated:
+        // One per sub-mesh, in order
+        if (mesh->lod_values.empty()
+            || lod_sub_mesh >= mesh->sub_meshes.size()) {
+          stream->Fail();
+        }
+        ReadIndices(stream,
+                    &mesh->sub_meshes[lod_sub_mesh++].lod_indices.back());
+        break;
+      default:
+        if (size < kChunkHeaderSize) stream->Fail();
+        stream->Seek(chunk_start + size);
+        break;
+    }
+  }
+
+  if (mesh->shared_vertices.positions.empty() && mesh->sub_meshes.empty())
+    throw runtime_error(PrintFString("%s contains no geometry",
+                                     stream->filename().c_str()));
+}
+
+void ReadSkeleton(ChunkStream *stream, SkeletonData *skeleton) {
+  skeleton->bones.clear();
+  // The handles seen so far. A handle skipped over by a larger one would
+  // leave a bone that is not in the file.
+  vector<bool> is_read;
+
+  while (!stream->eof()) {
+    size_t chunk_start = stream->pos();
+    unsigned short id = stream->ReadUShort();
+    unsigned int size = stream->ReadUInt();
+
+    if (id == kSkeletonBone) {
+      SkeletonBoneData bone;
+      bone.name = stream->ReadString();
+      unsigned short handle = stream->ReadUShort();
+      for (int i = 0; i < 3; ++i) bone.position[i] = stream->ReadFloat();
+
+      // Stored as x, y, z, w
+      for (int i = 1; i <= 4; ++i) {
+        bone.orientation[i % 4] = stream->ReadFloat();
+      }
+
+      for (int i = 0; i < 3; ++i) bone.scale[i] = 1;
+      if (size > kBoneChunkSizeNoScale) {
+        for (int i = 0; i < 3; ++i) bone.scale[i] = stream->ReadFloat();
+      }
+
+      bone.parent = -1;
+      if (handle >= skeleton->bones.size()) {
+        skeleton->bones.resize(handle + 1);
+        is_read.resize(handle + 1, false);
+      }
+      skeleton->bones[handle] = bone;
+      is_read[handle] = true;
+    } else if (id == kSkeletonBoneParent) {
+      unsigned short child = stream->ReadUShort();
+      unsigned short parent = stream->ReadUShort();
+      if (child >= skeleton->bones.size() || parent >= skeleton->bones.size())
+        stream->Fail();
+      skeleton->bones[child].parent = parent;
+    } else {
+      if (size < kChunkHeaderSize) stream->Fail();
+      stream->Seek(chunk_start + size);
+    }
+  }
+
+  if (skeleton->bones.empty())
+    throw runtime_error(PrintFString("%s contains no bones",
+                                     stream->filename().c_str()));
+
+  if (find(is_read.begin(), is_read.end(), false) != is_read.end())
+    throw runtime_error(PrintFString("%s skips some of the bone handles",
+                                     stream->filename().c_str()));
+}
+
+}  // namespace
+
+int SkeletonData::bone_handle(const string &name) const {
+  for (size_t i = 0; i < bones.size(); ++i) {
+    if (bones[i].name == name) return i;
+  }
+
+  return -1;
+}
+
+bool SkeletonData::ParentsFirst(vector<int> *order) const {
+  const int num_bones = (int) bones.size();
+
+  order->clear();
+  vector<bool> ordered(num_bones, false);
+  while ((int) order->size() < num_bones) {
+    size_t num_ordered = order->size();
+
+    for (int handle = 0; handle < num_bones; ++handle) {
+      int parent = bones[handle].parent;
+      if (!ordered[handle] && (parent == -1 || ordered[parent])) {
+        order->push_back(handle);
+        ordered[handle] = true;
+      }
+    }
+
+    if (order->size() == num_ordered) return false;
+  }
+
+  return true;
+}
+
+void OgreFileReader::LoadMesh(const string &filename, MeshData *mesh) {
+  ChunkStream stream(filename);
+  ReadMesh(&stream, mesh);
+}
+
+void OgreFileReader::LoadMesh(const string &name, const char *data,
+                              size_t size, MeshData *mesh) {
+  ChunkStream stream(name, data, size);
+  ReadMesh(&stream, mesh);
+}
+
+void OgreFileReader::LoadSkeleton(const string &filename,
+                                  SkeletonData *skeleton) {
+  ChunkStream stream(filename);
+  ReadSkeleton(&stream, skeleton);
+}
+
+void OgreFileReader::LoadSkeleton(const string &name, const char *data,
+                                  size_t size, SkeletonData *skeleton) {
+  ChunkStream stream(name, data, size);
+  ReadSkeleton(&stream, skeleton);
+}
+
+void OgreFileReader::FindSceneEntity(const string &filename,
+                                     const string &entity_name,
+                                     SceneEntityData *entity) {
+  TiXmlDocument document(filename.c_str());
+  if (!document.LoadFile()) {
+    throw runtime_error(PrintFString("Could not open %s", filename.c_str()));
+  }
+
+  const TiXmlElement *scene = document.RootElement();
+  const TiXmlElement *nodes = scene ? scene->FirstChildElement("nodes") : NULL;
+  if (!nodes) {
+    throw runtime_error(PrintFString("%s is not a scene file",
+                                     filename.c_str()));
+  }
+
+  const AffineTransform identity = { { { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+                                       { 0, 0, 1, 0 } } };
+
+  for (const TiXmlElement *node = nodes->FirstChildElement("node"); node;
+       node = node->NextSiblingElement("node")) {
+    if (FindEntity(node, identity, entity_name, entity)) return;
+  }
+
+  throw runtime_error(PrintFString("The scene %s does not have the object %s",
+                                   filename.c_str(), entity_name.c_str()));
+}
+
+}  // namespace libhand
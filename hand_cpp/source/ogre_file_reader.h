@@ -0,0 +1,132 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// OgreFileReader
+//
+// The OgreFileReader class reads the binary OGRE .mesh and .skeleton
+// files straight into plain arrays, without the OGRE 3D engine. Parts
+// of LibHand that run without a render context (such as the software
+// renderer) use it to get to the hand geometry and its skeleton.
+//
+// Only the data needed to deform and draw the hand is read: vertex
+// positions, normals, the first set of 2D texture coordinates, the
+// triangles, the generated LOD levels, the bone assignments and the
+// bones in their binding pose. Everything else in the files (manual LOD
+// levels, edge lists, animations, etc.) is skipped.
+//
+// It also finds an entity, with its mesh file and its placement, in a
+// .scene file.
+
+#ifndef OGRE_FILE_READER_H
+#define OGRE_FILE_READER_H
+
+# include "hand_prereq.h"
+# include <string>
+# include <vector>
+
+namespace libhand {
+
+using namespace std;
+
+// A bone in its binding pose, relative to its parent bone
+struct SkeletonBoneData {
+  string name;
+  int parent;               // -1 for root bones
+  float position[3];
+  float orientation[4];     // A quaternion: w, x, y, z
+  float scale[3];
+};
+
+struct SkeletonData {
+  // Indexed by the bone handle
+  vector<SkeletonBoneData> bones;
+
+  // Returns -1 if a bone by the name does not exist
+  int bone_handle(const string &name) const;
+
+  // The bone handles ordered parents before children, the order in which
+  // a pose is built down the bone chain. Returns false if the parents
+  // form a cycle.
+  bool ParentsFirst(vector<int> *order) const;
+};
+
+struct VertexBoneAssignmentData {
+  unsigned int vertex;
+  unsigned short bone;
+  float weight;
+};
+
+struct VertexStreamData {
+  VertexStreamData() : num_vertices(0) {}
+
+  size_t num_vertices;
+  vector<float> positions;  // x, y, z per vertex
+  vector<float> normals;    // x, y, z per vertex, empty if not present
+  vector<float> uvs;        // u, v per vertex, empty if not present
+};
+
+struct SubMeshData {
+  SubMeshData() : use_shared_vertices(true) {}
+
+  string material_name;
+  bool use_shared_vertices;
+  vector<unsigned int> indices;  // A triangle list
+  VertexStreamData vertices;     // Only if !use_shared_vertices
+
+  // The triangle lists of the generated LOD levels 1, 2, ... (level 0
+  // is the full detail indices), made of the same vertices
+  vector<vector<unsigned int> > lod_indices;
+  vector<VertexBoneAssignmentData> bone_assignments;
+};
+
+struct MeshData {
+  string skeleton_name;
+  VertexStreamData shared_vertices;
+  vector<VertexBoneAssignmentData> bone_assignments;
+  vector<SubMeshData> sub_meshes;
+
+  // The LOD strategy values (such as distances) of the generated LOD
+  // levels 1, 2, ..., empty if the mesh has none
+  vector<float> lod_values;
+};
+
+// An entity of a .scene file
+struct SceneEntityData {
+  string mesh_file;
+  float transform[3][4];    // Row-major, from the entity to the world space
+};
+
+class HAND_EXPORT OgreFileReader {
+ public:
+  // All the methods throw a runtime_error if the file can't be read
+  static void LoadMesh(const string &filename, MeshData *mesh);
+  static void LoadSkeleton(const string &filename, SkeletonData *skeleton);
+
+  // Read the files from memory, such as a mapped SceneBundle. The name is
+  // used in the error messages only.
+  static void LoadMesh(const string &name, const char *data, size_t size,
+                       MeshData *mesh);
+  static void LoadSkeleton(const string &name, const char *data, size_t size,
+                           SkeletonData *skeleton);
+
+  // Also throws if the scene has no such entity
+  static void FindSceneEntity(const string &filename,
+                              const string &entity_name,
+                              SceneEntityData *entity);
+
+ private:
+  // Disallow
+  OgreFileReader();
+  OgreFileReader(const OgreFileReader &rhs);
+  OgreFileReader& operator= (const OgreFileReader &rhs);
+};
+
+}  // namespace libhand
+#endif  // OGRE_FILE_READER_H
@@ -0,0 +1,238 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// PoseDataset
+
+# include "pose_dataset.h"
+
+# include <algorithm>
+# include <stdexcept>
+
+# include "pose_set.h"
+# include "printfstring.h"
+
+namespace libhand {
+
+namespace {
+
+// The smallest storage allocated, in poses
+const size_t kMinCapacity = 16;
+
+// The number of poses PoseSet records are transposed by at a time
+const size_t kTransposeBlock = 256;
+
+}  // namespace
+
+void PoseDataset::PoseView::GetRotMatrix(float *rot_mtx) const {
+  for (int i = 0; i < FullHandPose::kRotMatrixElements; ++i) {
+    rot_mtx[i] = rotation(i);
+  }
+}
+
+void PoseDataset::PoseView::CopyTo(FullHandPose *hand_pose) const {
+  dataset_->GetPose(index_, hand_pose);
+}
+
+FullHandPose PoseDataset::PoseView::ToFullHandPose() const {
+  FullHandPose hand_pose(num_joints());
+  CopyTo(&hand_pose);
+  return hand_pose;
+}
+
+PoseDataset::PoseDataset(int num_joints)
+  : num_joints_(num_joints),
+    offset_(0),
+    size_(0) {
+}
+
+void PoseDataset::Reserve(size_t num_poses) {
+  PrepareWrite(num_poses);
+}
+
+void PoseDataset::Clear() {
+  if (!storage_.unique()) storage_.reset();
+  offset_ = 0;
+  size_ = 0;
+}
+
+void PoseDataset::Resize(size_t num_poses) {
+  if (num_poses > size_) {
+    PrepareWrite(num_poses);
+
+    // The identity rotation and straight joints
+    for (int c = 0; c < num_channels(); ++c) {
+      const bool diagonal = c < FullHandPose::kRotMatrixElements
+        && c % (FullHandPose::kRotMatrixN + 1) == 0;
+      fill(writable_channel(c) + size_, writable_channel(c) + num_poses,
+           diagonal ? 1.f : 0.f);
+    }
+  }
+
+  size_ = num_poses;
+}
+
+float *PoseDataset::mutable_channel(int index) {
+  PrepareWrite(size_);
+  return writable_channel(index);
+}
+
+void PoseDataset::GetPose(size_t index, FullHandPose *hand_pose) const {
+  if (hand_pose->num_joints() != num_joints_) {
+    *hand_pose = FullHandPose(num_joints_);
+  }
+
+  float *data = hand_pose->begin();
+  for (int c = 0; c < num_channels(); ++c) {
+    data[c] = channel(c)[index];
+  }
+}
+
+void PoseDataset::SetPose(size_t index, const FullHandPose &hand_pose) {
+  CheckJoints(hand_pose.num_joints());
+  PrepareWrite(size_);
+
+  const float *data = hand_pose.begin();
+  for (int c = 0; c < num_channels(); ++c) {
+    writable_channel(c)[index] = data[c];
+  }
+}
+
+void PoseDataset::Append(const FullHandPose &hand_pose) {
+  CheckJoints(hand_pose.num_joints());
+  PrepareWrite(size_ + 1);
+
+  const float *data = hand_pose.begin();
+  for (int c = 0; c < num_channels(); ++c) {
+    writable_channel(c)[size_] = data[c];
+  }
+  ++size_;
+}
+
+void PoseDataset::Append(const vector<FullHandPose> &hand_poses) {
+  for (size_t i = 0; i < hand_poses.size(); ++i) {
+    CheckJoints(hand_poses[i].num_joints());
+  }
+  PrepareWrite(size_ + hand_poses.size());
+
+  for (int c = 0; c < num_channels(); ++c) {
+    float *dst = writable_channel(c) + size_;
+    for (size_t i = 0; i < hand_poses.size(); ++i) {
+      dst[i] = hand_poses[i].begin()[c];
+    }
+  }
+  size_ += hand_poses.size();
+}
+
+void PoseDataset::Append(const PoseDataset &dataset) {
+  CheckJoints(dataset.num_joints());
+
+  // The dataset may be this one
+  const size_t num_poses = dataset.size();
+  PrepareWrite(size_ + num_poses);
+
+  for (int c = 0; c < num_channels() && num_poses; ++c) {
+    const float *src = dataset.channel(c);
+    copy(src, src + num_poses, writable_channel(c) + size_);
+  }
+  size_ += num_poses;
+}
+
+void PoseDataset::Append(const PoseSet &pose_set) {
+  CheckJoints(pose_set.num_bones());
+  PrepareWrite(size_ + pose_set.num_poses());
+
+  vector<float *> channels(num_channels());
+  for (int c = 0; c < num_channels(); ++c) {
+    channels[c] = writable_channel(c) + size_;
+  }
+
+  // Transposed a block of poses at a time, so that both the records and
+  // the channels are walked in order
+  const int record_size = pose_set.record_size();
+  for (size_t begin = 0; begin < pose_set.num_poses();
+       begin += kTransposeBlock) {
+    const size_t end = min(begin + kTransposeBlock, pose_set.num_poses());
+    const float *records = pose_set.pose_data(begin);
+    for (int c = 0; c < num_channels(); ++c) {
+      for (size_t i = begin; i < end; ++i) {
+        channels[c][i] = records[(i - begin) * record_size + c];
+      }
+    }
+  }
+  size_ += pose_set.num_poses();
+}
+
+PoseDataset PoseDataset::Slice(size_t begin, size_t end) const {
+  if (begin > end || end > size_) {
+    throw runtime_error(PrintFString("Cannot slice [%lu, %lu) out of %lu "
+                                     "poses", (unsigned long) begin,
+                                     (unsigned long) end,
+                                     (unsigned long) size_));
+  }
+
+  PoseDataset slice(*this);
+  slice.offset_ += begin;
+  slice.size_ = end - begin;
+  return slice;
+}
+
+PoseDataset PoseDataset::Gather(const vector<size_t> &indices) const {
+  for (size_t i = 0; i < indices.size(); ++i) {
+    if (indices[i] >= size_) {
+      throw runtime_error(PrintFString("Pose %lu is out of %lu poses",
+                                       (unsigned long) indices[i],
+                                       (unsigned long) size_));
+    }
+  }
+
+  PoseDataset result(num_joints_);
+  result.PrepareWrite(indices.size());
+
+  for (int c = 0; c < num_channels() && !indices.empty(); ++c) {
+    const float *src = channel(c);
+    float *dst = result.writable_channel(c);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      dst[i] = src[indices[i]];
+    }
+  }
+  result.size_ = indices.size();
+  return result;
+}
+
+void PoseDataset::PrepareWrite(size_t num_poses) {
+  const bool owned = storage_.unique();
+  if (owned && num_poses <= storage_->capacity - offset_) return;
+
+  // Grows geometrically, so that appending one pose at a time is cheap
+  size_t capacity = max(num_poses, size_);
+  if (owned) capacity = max(capacity, 2 * storage_->capacity);
+  capacity = max(capacity, kMinCapacity);
+
+  boost::shared_ptr<Storage> storage(new Storage);
+  storage->capacity = capacity;
+  storage->data.resize(capacity * num_channels());
+
+  for (int c = 0; c < num_channels() && size_; ++c) {
+    copy(channel(c), channel(c) + size_, &storage->data[c * capacity]);
+  }
+
+  storage_ = storage;
+  offset_ = 0;
+}
+
+void PoseDataset::CheckJoints(int num_joints) const {
+  if (num_joints != num_joints_) {
+    throw runtime_error(PrintFString("The pose has %d joints, while the "
+                                     "dataset has %d", num_joints,
+                                     num_joints_));
+  }
+}
+
+}  // namespace libhand
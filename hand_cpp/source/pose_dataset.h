@@ -0,0 +1,199 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// PoseDataset
+//
+// A PoseDataset holds many poses with the same number of joints as a
+// structure of arrays: every element of the FullHandPose layout (the 9
+// rotation matrix elements, then bend, side and twist per joint) is a
+// channel, a contiguous array with one float per pose. Scanning one joint
+// across all the poses reads one array, and appending a pose allocates
+// nothing once the capacity is there.
+//
+// Pose i is read through a PoseView, which has the accessors of
+// FullHandPose but copies nothing.
+//
+// Copies and slices share the storage. The storage is copied the first
+// time one of the sharers changes it, so slicing is free and a slice can
+// be changed without touching the dataset it came from.
+
+#ifndef POSE_DATASET_H
+#define POSE_DATASET_H
+
+# include "hand_prereq.h"
+# include <cstddef>
+# include <vector>
+
+# include "boost/shared_ptr.hpp"
+
+# include "hand_pose.h"
+
+namespace libhand {
+
+using namespace std;
+
+class PoseSet;
+
+class HAND_EXPORT PoseDataset {
+ public:
+  // A read-only view of one pose of a dataset. It is valid as long as
+  // the dataset is neither changed nor destroyed.
+  class PoseView {
+   public:
+    int num_joints() const { return dataset_->num_joints(); }
+    int total_elements() const { return dataset_->num_channels(); }
+
+    // Element i of the FullHandPose layout
+    float element(int index) const;
+
+    float rotation(int index) const { return element(index); }
+    void GetRotMatrix(float *rot_mtx) const;
+
+    float bend(int joint) const;
+    float side(int joint) const;
+    float twist(int joint) const;
+    HandJoint joint(int joint) const;
+
+    void CopyTo(FullHandPose *hand_pose) const;
+    FullHandPose ToFullHandPose() const;
+
+   private:
+    friend class PoseDataset;
+    PoseView(const PoseDataset *dataset, size_t index)
+      : dataset_(dataset), index_(index) {}
+
+    const PoseDataset *dataset_;
+    size_t index_;
+  };
+
+  explicit PoseDataset(int num_joints = 15);
+
+  int num_joints() const { return num_joints_; }
+
+  // The number of channels, FullHandPose::total_elements()
+  int num_channels() const;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Makes room for num_poses poses without reallocating
+  void Reserve(size_t num_poses);
+  void Clear();
+
+  // Grows or shrinks the dataset to num_poses poses. The new poses are
+  // cleared, like a new FullHandPose.
+  void Resize(size_t num_poses);
+
+  // The channels of the FullHandPose layout, size() floats each. May be
+  // NULL for an empty dataset.
+  const float *channel(int index) const;
+  const float *rotation_channel(int index) const;
+  const float *bend_channel(int joint) const;
+  const float *side_channel(int joint) const;
+  const float *twist_channel(int joint) const;
+
+  // The same channel, writable. Stops sharing the storage first.
+  float *mutable_channel(int index);
+
+  PoseView pose(size_t index) const { return PoseView(this, index); }
+  PoseView operator[](size_t index) const { return pose(index); }
+
+  void GetPose(size_t index, FullHandPose *hand_pose) const;
+  void SetPose(size_t index, const FullHandPose &hand_pose);
+
+  // The appends throw a runtime_error if the poses don't have
+  // num_joints() joints
+  void Append(const FullHandPose &hand_pose);
+  void Append(const vector<FullHandPose> &hand_poses);
+  void Append(const PoseDataset &dataset);
+  void Append(const PoseSet &pose_set);
+
+  // The poses [begin, end), sharing the storage
+  PoseDataset Slice(size_t begin, size_t end) const;
+
+  // The poses at the indices, in that order, e.g. for sampling
+  PoseDataset Gather(const vector<size_t> &indices) const;
+
+ private:
+  // Channel c holds the poses at data[c * capacity], the dataset sees
+  // [offset_, offset_ + size_) of every channel
+  struct Storage {
+    vector<float> data;
+    size_t capacity;
+  };
+
+  // Makes sure the storage is not shared and has room for the poses
+  void PrepareWrite(size_t num_poses);
+
+  // A channel of storage already prepared for writing
+  float *writable_channel(int index) {
+    return const_cast<float *>(channel(index));
+  }
+  void CheckJoints(int num_joints) const;
+
+  int num_joints_;
+  boost::shared_ptr<Storage> storage_;
+  size_t offset_;
+  size_t size_;
+};
+
+// Inline implementations
+
+inline int PoseDataset::num_channels() const {
+  return FullHandPose::kRotMatrixElements
+    + FullHandPose::kElementsPerJoint * num_joints_;
+}
+
+inline const float *PoseDataset::channel(int index) const {
+  if (!storage_) return NULL;
+  return &storage_->data[0] + index * storage_->capacity + offset_;
+}
+
+inline const float *PoseDataset::rotation_channel(int index) const {
+  return channel(index);
+}
+
+inline const float *PoseDataset::bend_channel(int joint) const {
+  return channel(FullHandPose::kRotMatrixElements
+                 + FullHandPose::kElementsPerJoint * joint);
+}
+
+inline const float *PoseDataset::side_channel(int joint) const {
+  return channel(FullHandPose::kRotMatrixElements
+                 + FullHandPose::kElementsPerJoint * joint + 1);
+}
+
+inline const float *PoseDataset::twist_channel(int joint) const {
+  return channel(FullHandPose::kRotMatrixElements
+                 + FullHandPose::kElementsPerJoint * joint + 2);
+}
+
+inline float PoseDataset::PoseView::element(int index) const {
+  return dataset_->channel(index)[index_];
+}
+
+inline float PoseDataset::PoseView::bend(int joint) const {
+  return dataset_->bend_channel(joint)[index_];
+}
+
+inline float PoseDataset::PoseView::side(int joint) const {
+  return dataset_->side_channel(joint)[index_];
+}
+
+inline float PoseDataset::PoseView::twist(int joint) const {
+  return dataset_->twist_channel(joint)[index_];
+}
+
+inline HandJoint PoseDataset::PoseView::joint(int joint) const {
+  return HandJoint(bend(joint), side(joint), twist(joint));
+}
+
+}  // namespace libhand
+#endif  // POSE_DATASET_H
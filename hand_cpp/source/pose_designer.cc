@@ -244,8 +244,7 @@ void PoseDesigner::RenderEverything() {
   // Render the hand
   hand_renderer_.set_camera_spec(camera_spec_);
   hand_renderer_.SetHandPose(*hand_pose_);
-  hand_renderer_.RenderHand();
-  display_ = hand_renderer_.pixel_buffer_cv().clone();
+  hand_renderer_.RenderHandInto(display_);
 
   if (render_hog_) RenderHog();
 
@@ -357,11 +356,13 @@ void PoseDesigner::ZeroJoints() {
 }
 
 void PoseDesigner::RenderHog() {
-  cv::Mat image_mask =
-    ImageUtils::MaskFromNonZero(hand_renderer_.pixel_buffer_cv());
+  // The HOG display is drawn on top of the rendered frame, so work on a
+  // copy of it.
+  cv::Mat hand_image = display_.clone();
+  cv::Mat image_mask = ImageUtils::MaskFromNonZero(hand_image);
 
   cv::Rect roi_box = ImageUtils::FindBoundingBox(image_mask);
-  cv::Mat roi_image(hand_renderer_.pixel_buffer_cv(), roi_box);
+  cv::Mat roi_image(hand_image, roi_box);
   cv::Mat roi_mask(image_mask, roi_box);
 
   cv::Rect hog_rect(kRenderWinWidth - kHogDispWidth,
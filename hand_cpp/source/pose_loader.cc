@@ -0,0 +1,325 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// PoseLoader
+
+# include "pose_loader.h"
+
+# include <algorithm>
+# include <cctype>
+# include <iostream>
+# include <stdexcept>
+
+# include <boost/bind.hpp>
+# include <boost/filesystem.hpp>
+# include <boost/thread.hpp>
+
+# include "opencv2/opencv.hpp"
+
+# include "printfstring.h"
+
+namespace libhand {
+
+namespace {
+
+// The number of files a thread takes at a time
+const size_t kFilesPerTask = 64;
+
+string ToLower(string text) {
+  transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+bool IsPoseFile(const string &extension) {
+  return extension == ".yml" || extension == ".yaml" || extension == ".xml";
+}
+
+double SecondsSince(int64 start_ticks) {
+  return (cv::getTickCount() - start_ticks) / cv::getTickFrequency();
+}
+
+}  // namespace
+
+struct PoseLoader::Load {
+  const vector<string> *filenames;
+  vector<float *> channels;   // At the first pose of the load
+  vector<char> failed;        // Per file
+  vector<string> errors;      // Per file
+
+  boost::mutex mutex;         // Guards the rest
+  size_t next_file;
+  size_t files_done;
+  size_t num_failed;
+  bool stop;
+  int64 start_ticks;
+  int64 report_ticks;
+};
+
+PoseLoader::PoseLoader(const SceneSpec &scene_spec)
+  : scene_spec_(scene_spec),
+    num_threads_(max(1, (int) boost::thread::hardware_concurrency())),
+    if_unknown_bone_do_(FullHandPose::WARN),
+    skip_failed_files_(false),
+    progress_interval_(1.0) {
+}
+
+void PoseLoader::set_num_threads(int num_threads) {
+  num_threads_ = max(1, num_threads);
+}
+
+void PoseLoader::set_progress_callback(const ProgressCallback &callback,
+                                       double interval) {
+  progress_callback_ = callback;
+  progress_interval_ = interval;
+}
+
+vector<string> PoseLoader::ListPoseFiles(const string &dir_name) {
+  namespace fs = boost::filesystem;
+
+  if (!fs::is_directory(dir_name)) {
+    throw runtime_error(PrintFString("%s is not a directory",
+                                     dir_name.c_str()));
+  }
+
+  vector<string> filenames;
+  for (fs::directory_iterator i(dir_name), end; i != end; ++i) {
+    if (fs::is_regular_file(i->status())
+        && IsPoseFile(ToLower(i->path().extension().string()))) {
+      filenames.push_back(i->path().string());
+    }
+  }
+  sort(filenames.begin(), filenames.end());
+
+  return filenames;
+}
+
+PoseLoader::Progress PoseLoader::LoadDirectory(const string &dir_name,
+                                               PoseDataset *dataset) {
+  return LoadFiles(ListPoseFiles(dir_name), dataset);
+}
+
+PoseLoader::Progress PoseLoader::LoadFiles(const vector<string> &filenames,
+                                           PoseDataset *dataset) {
+  if (dataset->num_joints() != scene_spec_.num_bones()) {
+    throw runtime_error(PrintFString("The dataset has %d joints, while the "
+                                     "scene spec has %d bones",
+                                     dataset->num_joints(),
+                                     scene_spec_.num_bones()));
+  }
+
+  failures_.clear();
+
+  // Every file gets its pose in advance, so that the threads can write
+  // the poses straight into the dataset
+  const size_t first_pose = dataset->size();
+  const size_t num_files = filenames.size();
+  dataset->Resize(first_pose + num_files);
+
+  Load load;
+  load.filenames = &filenames;
+  for (int c = 0; c < dataset->num_channels(); ++c) {
+    load.channels.push_back(dataset->mutable_channel(c) + first_pose);
+  }
+  load.failed.resize(num_files);
+  load.errors.resize(num_files);
+  load.next_file = 0;
+  load.files_done = 0;
+  load.num_failed = 0;
+  load.stop = false;
+  load.start_ticks = load.report_ticks = cv::getTickCount();
+
+  const int num_threads =
+    (int) min((size_t) num_threads_,
+              max((size_t) 1, (num_files + kFilesPerTask - 1)
+                  / kFilesPerTask));
+  boost::thread_group threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.create_thread(boost::bind(&PoseLoader::LoadThread, this,
+                                      &load));
+  }
+  LoadThread(&load);
+  threads.join_all();
+
+  if (load.num_failed && !skip_failed_files_) {
+    dataset->Resize(first_pose);
+
+    const size_t file_no = find(load.failed.begin(), load.failed.end(), 1)
+      - load.failed.begin();
+    throw runtime_error(PrintFString("Could not load %s: %s",
+                                     filenames[file_no].c_str(),
+                                     load.errors[file_no].c_str()));
+  }
+
+  // Closes the gaps left by the failed files
+  if (load.num_failed) {
+    for (size_t c = 0; c < load.channels.size(); ++c) {
+      float *channel = load.channels[c];
+      size_t pose = 0;
+      for (size_t i = 0; i < num_files; ++i) {
+        if (!load.failed[i]) channel[pose++] = channel[i];
+      }
+    }
+
+    for (size_t i = 0; i < num_files; ++i) {
+      if (!load.failed[i]) continue;
+
+      Failure failure;
+      failure.filename = filenames[i];
+      failure.error = load.errors[i];
+      failures_.push_back(failure);
+    }
+  }
+  dataset->Resize(first_pose + num_files - load.num_failed);
+
+  const Progress progress = MakeProgress(load);
+  if (progress_callback_) progress_callback_(progress);
+  return progress;
+}
+
+void PoseLoader::LoadThread(Load *load) {
+  const size_t num_files = load->filenames->size();
+  BoneRemap bone_remap;
+
+  for (;;) {
+    size_t begin, end;
+    {
+      boost::mutex::scoped_lock lock(load->mutex);
+      if (load->stop || load->next_file == num_files) return;
+
+      begin = load->next_file;
+      end = min(begin + kFilesPerTask, num_files);
+      load->next_file = end;
+    }
+
+    size_t num_failed = 0;
+    for (size_t i = begin; i < end; ++i) {
+      if (!LoadFile(load, i, &bone_remap)) ++num_failed;
+    }
+
+    boost::mutex::scoped_lock lock(load->mutex);
+    load->files_done += end - begin;
+    load->num_failed += num_failed;
+    if (num_failed && !skip_failed_files_) load->stop = true;
+
+    if (progress_callback_
+        && SecondsSince(load->report_ticks) >= progress_interval_) {
+      load->report_ticks = cv::getTickCount();
+      progress_callback_(MakeProgress(*load));
+    }
+  }
+}
+
+bool PoseLoader::LoadFile(Load *load, size_t file_no,
+                          BoneRemap *bone_remap) {
+  FullHandPose hand_pose(scene_spec_.num_bones());
+
+  try {
+    ParsePose(load, file_no, bone_remap, &hand_pose);
+  } catch (const std::exception &e) {
+    load->failed[file_no] = 1;
+    load->errors[file_no] = e.what();
+    return false;
+  }
+
+  const float *data = hand_pose.begin();
+  for (size_t c = 0; c < load->channels.size(); ++c) {
+    load->channels[c][file_no] = data[c];
+  }
+
+  return true;
+}
+
+// The same as FullHandPose::Load, apart from the bone lookup
+void PoseLoader::ParsePose(Load *load, size_t file_no, BoneRemap *bone_remap,
+                           FullHandPose *hand_pose) {
+  const string &filename = (*load->filenames)[file_no];
+
+  cv::FileStorage store(filename, cv::FileStorage::READ);
+  if (!store.isOpened()) {
+    throw runtime_error(PrintFString("Can't open file \"%s\" for reading",
+                                     filename.c_str()));
+  }
+
+  cv::FileNode rot_node = store["rotation"];
+  if (rot_node.empty()) {
+    throw runtime_error("No rotation information present!");
+  }
+
+  if ((rot_node.type() != cv::FileNode::SEQ) ||
+      ((int) rot_node.size() != FullHandPose::kRotMatrixElements)) {
+    throw runtime_error(PrintFString
+                        ("A rotation must be a %d element sequence",
+                         FullHandPose::kRotMatrixElements));
+  }
+
+  for (int i = 0; i < FullHandPose::kRotMatrixElements; ++i) {
+    hand_pose->rotation(i) = rot_node[i];
+  }
+
+  cv::FileNode joints_node = store["hand_joints"];
+  if (joints_node.empty()) {
+    throw runtime_error("No hand joint informaton present!");
+  }
+
+  if (joints_node.type() != cv::FileNode::MAP) {
+    throw runtime_error("Hand joints are supposed to be "
+                        "specified as a mapping");
+  }
+
+  vector<string> bone_names;
+  for (cv::FileNodeIterator i = joints_node.begin(), e = joints_node.end();
+       i != e;
+       ++i) {
+    bone_names.push_back((*i).name());
+  }
+
+  if (!bone_remap->Matches(bone_names)) {
+    *bone_remap = BoneRemap(scene_spec_, bone_names);
+  }
+
+  int position = 0;
+  for (cv::FileNodeIterator i = joints_node.begin(), e = joints_node.end();
+       i != e;
+       ++i, ++position) {
+    const int bone_idx = bone_remap->bone_index(position);
+
+    if (bone_idx == -1) {
+      const string &bone_name = bone_remap->bone_name(position);
+
+      switch (if_unknown_bone_do_) {
+      case FullHandPose::FAIL:
+        throw runtime_error(PrintFString("Unknown bone: %s",
+                                         bone_name.c_str()));
+      case FullHandPose::WARN: {
+        boost::mutex::scoped_lock lock(load->mutex);
+        cout << "Warning: Unknown bone " << bone_name << " in "
+             << filename << endl;
+        break;
+      }
+      case FullHandPose::NOTHING: break;
+      }
+    } else {
+      HandJoint hand_joint;
+      (*i) >> hand_joint;
+      hand_pose->set_joint(bone_idx, hand_joint);
+    }
+  }
+}
+
+PoseLoader::Progress PoseLoader::MakeProgress(const Load &load) const {
+  Progress progress;
+  progress.num_files = load.filenames->size();
+  progress.files_done = load.files_done;
+  progress.num_failed = load.num_failed;
+  progress.seconds = SecondsSince(load.start_ticks);
+  return progress;
+}
+
+}  // namespace libhand
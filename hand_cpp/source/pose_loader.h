@@ -0,0 +1,119 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// PoseLoader
+//
+// Loads whole directories of pose files, as written by
+// FullHandPose::Save, PoseDesigner or the MATLAB save_hand_pose, into a
+// PoseDataset. The files are parsed in parallel on a number of threads,
+// every thread writing its poses straight into their place in the
+// dataset. The joints of a file are matched to the bones through a
+// BoneRemap, which a thread makes again only when a file lists its bones
+// in another order than the file before. A callback can follow the
+// progress of long loads.
+
+#ifndef POSE_LOADER_H
+#define POSE_LOADER_H
+
+# include "hand_prereq.h"
+# include <cstddef>
+# include <string>
+# include <vector>
+
+# include "boost/function.hpp"
+
+# include "hand_pose.h"
+# include "pose_dataset.h"
+# include "scene_spec.h"
+
+namespace libhand {
+
+using namespace std;
+
+class HAND_EXPORT PoseLoader {
+ public:
+  struct Progress {
+    size_t num_files;     // In the load
+    size_t files_done;    // Loaded or failed
+    size_t num_failed;
+    double seconds;       // Since the start of the load
+
+    double files_per_second() const {
+      return seconds > 0 ? files_done / seconds : 0;
+    }
+  };
+
+  struct Failure {
+    string filename;
+    string error;
+  };
+
+  typedef boost::function<void (const Progress &progress)> ProgressCallback;
+
+  // Loads the poses of the scene spec, one joint per bone
+  explicit PoseLoader(const SceneSpec &scene_spec);
+
+  // The number of loading threads, by default one per CPU core
+  void set_num_threads(int num_threads);
+  int num_threads() const { return num_threads_; }
+
+  // What to do about the bones of a file that are not in the scene spec.
+  // WARN by default, as in FullHandPose::Load.
+  void set_if_unknown_bone_do(FullHandPose::IfUnknownBoneDo do_what) {
+    if_unknown_bone_do_ = do_what;
+  }
+
+  // If set, files that can't be loaded are left out and listed in
+  // failures(). Otherwise the first of them makes the load throw.
+  void set_skip_failed_files(bool skip) { skip_failed_files_ = skip; }
+  bool skip_failed_files() const { return skip_failed_files_; }
+
+  // The callback is called about every interval seconds during a load,
+  // and once at the end. It is called from the loading threads, one
+  // call at a time, and must not throw.
+  void set_progress_callback(const ProgressCallback &callback,
+                             double interval = 1.0);
+
+  // The pose files of the directory (.yml, .yaml and .xml), sorted by
+  // name
+  static vector<string> ListPoseFiles(const string &dir_name);
+
+  // Appends the poses of the files to the dataset, in the order of the
+  // files, and returns the final progress. Throws a runtime_error if a
+  // file can't be loaded, unless the failed files are skipped, or if the
+  // dataset does not have a joint per bone of the scene spec. The
+  // dataset is left as it was when the load throws.
+  Progress LoadDirectory(const string &dir_name, PoseDataset *dataset);
+  Progress LoadFiles(const vector<string> &filenames, PoseDataset *dataset);
+
+  // The files left out by the last load
+  const vector<Failure> &failures() const { return failures_; }
+
+ private:
+  struct Load;
+
+  void LoadThread(Load *load);
+  bool LoadFile(Load *load, size_t file_no, BoneRemap *bone_remap);
+  void ParsePose(Load *load, size_t file_no, BoneRemap *bone_remap,
+                 FullHandPose *hand_pose);
+  Progress MakeProgress(const Load &load) const;
+
+  SceneSpec scene_spec_;
+  int num_threads_;
+  FullHandPose::IfUnknownBoneDo if_unknown_bone_do_;
+  bool skip_failed_files_;
+  ProgressCallback progress_callback_;
+  double progress_interval_;
+
+  vector<Failure> failures_;
+};
+
+}  // namespace libhand
+#endif  // POSE_LOADER_H
@@ -0,0 +1,269 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// PoseSet
+
+# include "pose_set.h"
+
+# include <algorithm>
+# include <cstdio>
+# include <cstring>
+# include <sstream>
+# include <stdexcept>
+
+# include <boost/cstdint.hpp>
+
+# include "mapped_file.h"
+# include "printfstring.h"
+
+namespace libhand {
+
+namespace {
+
+using boost::uint32_t;
+using boost::uint64_t;
+
+// The layout of a pose set file (little-endian, as written by the
+// machine that made it):
+//    the header
+//    the bone names, one per line
+//    the pose records, 16 byte aligned, record_size() floats each
+const char kMagic[8] = { 'L', 'H', 'P', 'O', 'S', 'E', 'S', 0 };
+const uint32_t kVersion = 1;
+const size_t kAlignment = 16;
+
+struct PoseSetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_bones;
+  uint64_t num_poses;
+  uint64_t names_offset;
+  uint64_t names_size;
+  uint64_t records_offset;
+};
+
+int RecordSize(int num_bones) {
+  return FullHandPose::kRotMatrixElements
+    + num_bones * FullHandPose::kElementsPerJoint;
+}
+
+}  // namespace
+
+struct PoseSet::Mapping {
+  string filename;
+  MappedFile file;
+
+  vector<string> bone_names;
+  size_t num_poses;
+  int record_size;
+  const char *records;
+};
+
+PoseSet::PoseSet() {}
+
+PoseSet::PoseSet(const string &filename) {
+  Open(filename);
+}
+
+void PoseSet::Open(const string &filename) {
+  boost::shared_ptr<Mapping> mapping(new Mapping);
+  mapping->filename = filename;
+  mapping->file.Open(filename);
+
+  const char *data_begin = mapping->file.data();
+  const size_t size = mapping->file.size();
+
+  PoseSetHeader header;
+  if (size < sizeof(header)) {
+    throw runtime_error(PrintFString("%s is not a pose set",
+                                     filename.c_str()));
+  }
+  memcpy(&header, data_begin, sizeof(header));
+
+  if (memcmp(header.magic, kMagic, sizeof(kMagic))) {
+    throw runtime_error(PrintFString("%s is not a pose set",
+                                     filename.c_str()));
+  }
+  if (header.version != kVersion) {
+    throw runtime_error(PrintFString("The pose set %s has version %d, "
+                                     "while version %d is supported",
+                                     filename.c_str(), (int) header.version,
+                                     (int) kVersion));
+  }
+
+  const uint64_t record_bytes =
+    sizeof(float) * (uint64_t) RecordSize(header.num_bones);
+  if (header.names_offset > size
+      || header.names_size > size - header.names_offset
+      || header.records_offset > size
+      || header.records_offset % kAlignment
+      || header.num_poses > (size - header.records_offset) / record_bytes) {
+    throw runtime_error(PrintFString("The pose set %s is truncated",
+                                     filename.c_str()));
+  }
+
+  istringstream names(string(data_begin + header.names_offset,
+                             header.names_size));
+  string line;
+  while (getline(names, line)) mapping->bone_names.push_back(line);
+
+  if (mapping->bone_names.size() != header.num_bones) {
+    throw runtime_error(PrintFString("The pose set %s is corrupt",
+                                     filename.c_str()));
+  }
+
+  mapping->num_poses = header.num_poses;
+  mapping->record_size = RecordSize(header.num_bones);
+  mapping->records = data_begin + header.records_offset;
+
+  mapping_ = mapping;
+}
+
+const string &PoseSet::filename() const {
+  if (!mapping_) throw runtime_error("The pose set is not open");
+  return mapping_->filename;
+}
+
+int PoseSet::num_bones() const {
+  return mapping_ ? (int) mapping_->bone_names.size() : 0;
+}
+
+const string &PoseSet::bone_name(int index) const {
+  return mapping_->bone_names[index];
+}
+
+bool PoseSet::MatchesSceneSpec(const SceneSpec &scene_spec) const {
+  if (scene_spec.num_bones() != num_bones()) return false;
+
+  for (int i = 0; i < num_bones(); ++i) {
+    if (scene_spec.bone_name(i) != bone_name(i)) return false;
+  }
+
+  return true;
+}
+
+size_t PoseSet::num_poses() const {
+  return mapping_ ? mapping_->num_poses : 0;
+}
+
+int PoseSet::record_size() const {
+  return mapping_ ? mapping_->record_size : 0;
+}
+
+const float *PoseSet::pose_data(size_t index) const {
+  return (const float *) mapping_->records + index * mapping_->record_size;
+}
+
+void PoseSet::GetPose(size_t index, FullHandPose *hand_pose) const {
+  if (hand_pose->num_joints() != num_bones()) {
+    *hand_pose = FullHandPose(num_bones());
+  }
+
+  const float *data = pose_data(index);
+  copy(data, data + mapping_->record_size, hand_pose->begin());
+}
+
+FullHandPose PoseSet::pose(size_t index) const {
+  FullHandPose hand_pose(num_bones());
+  GetPose(index, &hand_pose);
+  return hand_pose;
+}
+
+PoseSetWriter::PoseSetWriter(const string &filename,
+                             const SceneSpec &scene_spec)
+  : filename_(filename),
+    temp_filename_(filename + ".tmp"),
+    num_bones_(scene_spec.num_bones()),
+    names_size_(0),
+    records_offset_(0),
+    num_poses_(0) {
+  file_.open(temp_filename_.c_str(), ios::out | ios::binary);
+  if (!file_.is_open()) {
+    throw runtime_error(PrintFString("Could not write %s",
+                                     temp_filename_.c_str()));
+  }
+
+  // The header is written again by Close(), with the number of poses
+  PoseSetHeader header;
+  memset(&header, 0, sizeof(header));
+  file_.write((const char *) &header, sizeof(header));
+
+  ostringstream names;
+  for (int i = 0; i < num_bones_; ++i) {
+    names << scene_spec.bone_name(i) << "\n";
+  }
+  const string names_text = names.str();
+  file_.write(names_text.data(), names_text.size());
+  names_size_ = names_text.size();
+
+  static const char kZeros[kAlignment] = { 0 };
+  const size_t names_end = sizeof(header) + names_size_;
+  const size_t padding = (kAlignment - names_end % kAlignment) % kAlignment;
+  file_.write(kZeros, padding);
+  records_offset_ = names_end + padding;
+}
+
+PoseSetWriter::~PoseSetWriter() {
+  if (!file_.is_open()) return;
+
+  file_.close();
+  remove(temp_filename_.c_str());
+}
+
+void PoseSetWriter::Append(const FullHandPose &hand_pose) {
+  if (!file_.is_open()) {
+    throw runtime_error(PrintFString("The pose set %s is closed",
+                                     filename_.c_str()));
+  }
+  if (hand_pose.num_joints() != num_bones_) {
+    throw runtime_error(PrintFString("The pose has %d joints, while the "
+                                     "pose set %s has %d bones",
+                                     hand_pose.num_joints(),
+                                     filename_.c_str(), num_bones_));
+  }
+
+  file_.write((const char *) hand_pose.begin(),
+              sizeof(float) * hand_pose.total_elements());
+  ++num_poses_;
+}
+
+void PoseSetWriter::Close() {
+  if (!file_.is_open()) return;
+
+  PoseSetHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_bones = num_bones_;
+  header.num_poses = num_poses_;
+  header.names_offset = sizeof(header);
+  header.names_size = names_size_;
+  header.records_offset = records_offset_;
+
+  file_.seekp(0);
+  file_.write((const char *) &header, sizeof(header));
+  file_.close();
+
+  if (!file_) {
+    remove(temp_filename_.c_str());
+    throw runtime_error(PrintFString("Could not write %s",
+                                     temp_filename_.c_str()));
+  }
+
+  // rename() does not replace an existing file on Windows
+#ifdef WIN32
+  remove(filename_.c_str());
+#endif
+  if (rename(temp_filename_.c_str(), filename_.c_str())) {
+    remove(temp_filename_.c_str());
+    throw runtime_error(PrintFString("Could not write %s", filename_.c_str()));
+  }
+}
+
+}  // namespace libhand
@@ -0,0 +1,123 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// PoseSet
+//
+// A pose set is a single binary file with many hand poses, meant for
+// datasets far too large to keep as one YAML file per pose. The file
+// starts with the names of the bones, taken from the scene spec it was
+// written with, followed by a packed record of floats per pose in the
+// FullHandPose layout: the 9 elements of the rotation matrix and then
+// the bend, side and twist of every bone, in the order of the bone names.
+//
+// Opening a pose set maps the file into memory and reads the header
+// only. Pose i is then found at a fixed offset, so random access costs
+// the same as reading the floats, whatever the size of the set.
+//
+// PoseSetWriter (or the build_pose_set tool) writes a pose set one pose
+// at a time.
+//
+// A PoseSet is a light handle. Copies share the mapping, which is
+// released with the last of them.
+
+#ifndef POSE_SET_H
+#define POSE_SET_H
+
+# include "hand_prereq.h"
+# include <cstddef>
+# include <fstream>
+# include <string>
+# include <vector>
+
+# include "boost/shared_ptr.hpp"
+
+# include "hand_pose.h"
+# include "scene_spec.h"
+
+namespace libhand {
+
+using namespace std;
+
+class HAND_EXPORT PoseSet {
+ public:
+  PoseSet();
+
+  // Opens the pose set file, throws a runtime_error if it can't be read
+  explicit PoseSet(const string &filename);
+  void Open(const string &filename);
+
+  bool is_open() const { return mapping_.get() != NULL; }
+  const string &filename() const;
+
+  // The bones of the scene spec the set was written with. Joint i of
+  // every pose belongs to bone i.
+  int num_bones() const;
+  const string &bone_name(int index) const;
+
+  // True if the scene spec has the same bones in the same order, i.e.
+  // the poses can be used with its scene as they are
+  bool MatchesSceneSpec(const SceneSpec &scene_spec) const;
+
+  size_t num_poses() const;
+
+  // The number of floats per pose, FullHandPose::total_elements()
+  int record_size() const;
+
+  // The floats of the pose, straight from the mapped file. The index
+  // must be below num_poses().
+  const float *pose_data(size_t index) const;
+
+  // Copies the pose out, resizing hand_pose to num_bones() joints if
+  // needed. The index must be below num_poses().
+  void GetPose(size_t index, FullHandPose *hand_pose) const;
+  FullHandPose pose(size_t index) const;
+
+ private:
+  struct Mapping;
+  boost::shared_ptr<Mapping> mapping_;
+};
+
+class HAND_EXPORT PoseSetWriter {
+ public:
+  // Starts a pose set with the bones of the scene spec. Throws a
+  // runtime_error if the file can't be created.
+  PoseSetWriter(const string &filename, const SceneSpec &scene_spec);
+
+  // Deletes the unfinished set, unless Close() has been called. A set
+  // given up on, e.g. by an exception while it is written, never
+  // replaces the target file.
+  ~PoseSetWriter();
+
+  // Throws a runtime_error if the pose does not have a joint per bone
+  void Append(const FullHandPose &hand_pose);
+
+  size_t num_poses() const { return num_poses_; }
+
+  // Finishes the file. The set is written next to the target and moved
+  // into place here, so readers never see a partially written set.
+  // Throws a runtime_error on failure.
+  void Close();
+
+ private:
+  string filename_;
+  string temp_filename_;
+  ofstream file_;
+  int num_bones_;
+  size_t names_size_;
+  size_t records_offset_;
+  size_t num_poses_;
+
+  // Disallow
+  PoseSetWriter(const PoseSetWriter &rhs);
+  PoseSetWriter& operator= (const PoseSetWriter &rhs);
+};
+
+}  // namespace libhand
+#endif  // POSE_SET_H
@@ -0,0 +1,429 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// RenderFarm
+
+# include "render_farm.h"
+
+# include <cerrno>
+# include <cstring>
+# include <exception>
+# include <stdexcept>
+
+#ifndef WIN32
+# include <poll.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+#endif
+
+# include "printfstring.h"
+
+namespace libhand {
+
+#ifndef WIN32
+
+namespace {
+
+const int kMaxErrorLength = 256;
+
+// Messages on the job pipe: a slot index, or
+const int kStopWorker = -1;
+
+// Messages on the result pipe: a slot index, or
+const int kWorkerReady = -1;
+const int kWorkerFailed = -2;
+
+// How often a waiting parent checks whether the workers are still alive
+const int kWorkerCheckMs = 1000;
+
+// The slots are cache line aligned
+const size_t kSlotAlignment = 64;
+
+// A slot starts with this header, followed by the pose elements and
+// then the frame
+struct SlotHeader {
+  bool failed;
+  float camera[4];    // r, theta, phi, tilt
+  char error[kMaxErrorLength];
+};
+
+size_t Align(size_t size) {
+  return (size + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+}
+
+void SetError(char *dst, const char *message) {
+  strncpy(dst, message, kMaxErrorLength - 1);
+  dst[kMaxErrorLength - 1] = 0;
+}
+
+// Pipe messages are single ints, which pipes transfer atomically, so
+// that the workers can share the job pipe.
+bool ReadMessage(int fd, int *message) {
+  for (;;) {
+    ssize_t result = read(fd, message, sizeof(*message));
+    if (result == sizeof(*message)) return true;
+    if (result < 0 && errno == EINTR) continue;
+    return false;
+  }
+}
+
+bool WriteMessage(int fd, int message) {
+  for (;;) {
+    ssize_t result = write(fd, &message, sizeof(message));
+    if (result == sizeof(message)) return true;
+    if (result < 0 && errno == EINTR) continue;
+    return false;
+  }
+}
+
+}  // namespace
+
+RenderFarm::RenderFarm() :
+  width_(0),
+  height_(0),
+  num_joints_(0),
+  num_slots_(0),
+  slot_size_(0),
+  frame_offset_(0),
+  shm_(NULL),
+  shm_size_(0) {
+  job_pipe_[0] = job_pipe_[1] = -1;
+  result_pipe_[0] = result_pipe_[1] = -1;
+}
+
+RenderFarm::~RenderFarm() {
+  Stop();
+}
+
+char *RenderFarm::worker_error(int worker_no) const {
+  return shm_ + num_slots_ * slot_size_ + worker_no * kMaxErrorLength;
+}
+
+void RenderFarm::Start(const SceneSpec &scene_spec,
+                       int num_workers,
+                       int width, int height,
+                       HandRenderer::Backend backend,
+                       int num_slots) {
+  if (is_started()) {
+    throw runtime_error("The RenderFarm is already started");
+  }
+
+  if (num_workers <= 0 || width <= 0 || height <= 0 || num_slots < 0) {
+    throw runtime_error(PrintFString("Bad RenderFarm parameters: %d workers, "
+                                     "%dx%d frames, %d slots",
+                                     num_workers, width, height, num_slots));
+  }
+
+  width_ = width;
+  height_ = height;
+  num_joints_ = scene_spec.num_bones();
+  num_slots_ = num_slots ? num_slots : 2 * num_workers;
+
+  frame_offset_ = Align(sizeof(SlotHeader)
+                        + FullHandPose(num_joints_).total_elements()
+                        * sizeof(float));
+  slot_size_ = Align(frame_offset_ + frame_bytes());
+  shm_size_ = num_slots_ * slot_size_ + num_workers * kMaxErrorLength;
+
+  void *shm = mmap(NULL, shm_size_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANON, -1, 0);
+  if (shm == MAP_FAILED) {
+    throw runtime_error(PrintFString("Could not map %d bytes of shared "
+                                     "memory for the RenderFarm",
+                                     (int) shm_size_));
+  }
+  shm_ = (char *) shm;
+
+  if (pipe(job_pipe_) || pipe(result_pipe_)) {
+    Stop();
+    throw runtime_error("Could not create the RenderFarm pipes");
+  }
+
+  for (int i = 0; i < num_workers; ++i) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+      Stop();
+      throw runtime_error("Could not fork a RenderFarm worker");
+    }
+
+    if (!pid) {
+      WorkerMain(i, scene_spec, backend);
+      // Not reached
+    }
+
+    workers_.push_back(pid);
+  }
+
+  // The parent only writes jobs and reads results. It keeps the read
+  // end of the job pipe open, so that writing jobs to dead workers
+  // never raises SIGPIPE.
+  close(result_pipe_[1]);
+  result_pipe_[1] = -1;
+
+  bool failed = false;
+  for (int i = 0; i < num_workers; ++i) {
+    if (WaitForResult() == kWorkerFailed) failed = true;
+  }
+
+  if (failed) {
+    string errors;
+    for (int i = 0; i < num_workers; ++i) {
+      if (!*worker_error(i)) continue;
+      if (!errors.empty()) errors += "; ";
+      errors += worker_error(i);
+    }
+
+    Stop();
+    throw runtime_error("A RenderFarm worker failed to start: " + errors);
+  }
+}
+
+void RenderFarm::Stop() {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    if (!WriteMessage(job_pipe_[1], kStopWorker)) break;
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    if (job_pipe_[i] != -1) close(job_pipe_[i]);
+    if (result_pipe_[i] != -1) close(result_pipe_[i]);
+    job_pipe_[i] = result_pipe_[i] = -1;
+  }
+
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    while (waitpid(workers_[i], NULL, 0) < 0 && errno == EINTR) {}
+  }
+  workers_.clear();
+
+  if (shm_) munmap(shm_, shm_size_);
+  shm_ = NULL;
+  shm_size_ = 0;
+}
+
+void RenderFarm::RenderBatch(const vector<FullHandPose> &hand_poses,
+                             const vector<HandCameraSpec> &camera_specs,
+                             char *batch_buffer) {
+  if (!is_started()) {
+    throw runtime_error("The RenderFarm is not started");
+  }
+
+  if (camera_specs.size() != 1 && camera_specs.size() != hand_poses.size()) {
+    throw runtime_error(PrintFString("RenderBatch needs either one camera "
+                                     "spec or one per pose (%d poses, "
+                                     "%d camera specs)",
+                                     (int) hand_poses.size(),
+                                     (int) camera_specs.size()));
+  }
+
+  if (hand_poses.empty()) return;
+
+  if (!batch_buffer) {
+    throw runtime_error("No output buffer given to RenderBatch");
+  }
+
+  for (size_t i = 0; i < hand_poses.size(); ++i) {
+    if (hand_poses[i].num_joints() != num_joints_) {
+      throw runtime_error(PrintFString("The pose %d has %d joints, while "
+                                       "the scene has %d bones",
+                                       (int) i, hand_poses[i].num_joints(),
+                                       num_joints_));
+    }
+  }
+
+  vector<int> free_slots;
+  for (int i = num_slots_ - 1; i >= 0; --i) free_slots.push_back(i);
+
+  vector<size_t> slot_pose(num_slots_);
+  size_t next_pose = 0;
+  int num_in_flight = 0;
+  string error;
+
+  // After a failed frame no more jobs are handed out, but the frames
+  // still in flight are collected, so that the ring is empty again when
+  // the error is reported.
+  while (num_in_flight
+         || (next_pose < hand_poses.size() && error.empty())) {
+    while (next_pose < hand_poses.size() && error.empty()
+           && !free_slots.empty()) {
+      const int slot = free_slots.back();
+      free_slots.pop_back();
+
+      const HandCameraSpec &camera_spec =
+        camera_specs.size() == 1 ? camera_specs[0] : camera_specs[next_pose];
+      const FullHandPose &hand_pose = hand_poses[next_pose];
+
+      SlotHeader *header = (SlotHeader *) slot_data(slot);
+      header->failed = false;
+      header->camera[0] = camera_spec.r;
+      header->camera[1] = camera_spec.theta;
+      header->camera[2] = camera_spec.phi;
+      header->camera[3] = camera_spec.tilt;
+      copy(hand_pose.begin(), hand_pose.end(),
+           (float *) (slot_data(slot) + sizeof(SlotHeader)));
+
+      slot_pose[slot] = next_pose++;
+      ++num_in_flight;
+
+      if (!WriteMessage(job_pipe_[1], slot)) {
+        Stop();
+        throw runtime_error("Could not send a job to the RenderFarm");
+      }
+    }
+
+    const int slot = WaitForResult();
+    if (slot < 0 || slot >= num_slots_) {
+      Stop();
+      throw runtime_error("A bad message from a RenderFarm worker");
+    }
+
+    const SlotHeader *header = (const SlotHeader *) slot_data(slot);
+    if (header->failed) {
+      if (error.empty()) error = header->error;
+    } else {
+      memcpy(batch_buffer + slot_pose[slot] * frame_bytes(),
+             slot_data(slot) + frame_offset_, frame_bytes());
+    }
+
+    free_slots.push_back(slot);
+    --num_in_flight;
+  }
+
+  if (!error.empty()) {
+    throw runtime_error("A RenderFarm worker failed to render a frame: "
+                        + error);
+  }
+}
+
+int RenderFarm::WaitForResult() {
+  for (;;) {
+    pollfd result_poll;
+    result_poll.fd = result_pipe_[0];
+    result_poll.events = POLLIN;
+    result_poll.revents = 0;
+
+    int ready = poll(&result_poll, 1, kWorkerCheckMs);
+    if (ready < 0 && errno != EINTR) break;
+
+    if (ready > 0) {
+      int message;
+      if (ReadMessage(result_pipe_[0], &message)) return message;
+      break;
+    }
+
+    CheckWorkers();
+  }
+
+  Stop();
+  throw runtime_error("Lost the connection to the RenderFarm workers");
+}
+
+void RenderFarm::CheckWorkers() {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    int status;
+    if (waitpid(workers_[i], &status, WNOHANG) == workers_[i]) {
+      // Already reaped, so Stop() must not wait for it
+      workers_.erase(workers_.begin() + i);
+      Stop();
+      throw runtime_error(PrintFString("RenderFarm worker %d died",
+                                       (int) i));
+    }
+  }
+}
+
+void RenderFarm::WorkerMain(int worker_no, const SceneSpec &scene_spec,
+                            HandRenderer::Backend backend) {
+  close(job_pipe_[1]);
+  close(result_pipe_[0]);
+
+  // A parent that went away should take its workers along
+  signal(SIGPIPE, SIG_DFL);
+
+  int exit_code = 0;
+
+  try {
+    HandRenderer renderer;
+    renderer.Setup(width_, height_, backend);
+    renderer.LoadScene(scene_spec);
+
+    WriteMessage(result_pipe_[1], kWorkerReady);
+
+    int slot;
+    while (ReadMessage(job_pipe_[0], &slot) && slot != kStopWorker) {
+      RenderJob(&renderer, slot);
+      if (!WriteMessage(result_pipe_[1], slot)) break;
+    }
+  } catch (const std::exception &e) {
+    SetError(worker_error(worker_no), e.what());
+    WriteMessage(result_pipe_[1], kWorkerFailed);
+    exit_code = 1;
+  }
+
+  // The worker is a copy of the parent process, which must not run the
+  // parent's exit handlers and static destructors.
+  _exit(exit_code);
+}
+
+void RenderFarm::RenderJob(HandRenderer *renderer, int slot) {
+  SlotHeader *header = (SlotHeader *) slot_data(slot);
+
+  try {
+    FullHandPose hand_pose(num_joints_);
+    const float *pose_data = (const float *) (slot_data(slot)
+                                              + sizeof(SlotHeader));
+    copy(pose_data, pose_data + hand_pose.total_elements(),
+         hand_pose.begin());
+
+    renderer->SetHandPose(hand_pose);
+    renderer->set_camera_spec(HandCameraSpec(header->camera[0],
+                                             header->camera[1],
+                                             header->camera[2],
+                                             header->camera[3]));
+    renderer->RenderHandInto(slot_data(slot) + frame_offset_,
+                             3 * width_);
+  } catch (const std::exception &e) {
+    header->failed = true;
+    SetError(header->error, e.what());
+  }
+}
+
+#else  // WIN32
+
+RenderFarm::RenderFarm() :
+  width_(0),
+  height_(0),
+  num_joints_(0),
+  num_slots_(0),
+  slot_size_(0),
+  frame_offset_(0),
+  shm_(NULL),
+  shm_size_(0) {
+}
+
+RenderFarm::~RenderFarm() {}
+
+void RenderFarm::Start(const SceneSpec &, int, int, int,
+                       HandRenderer::Backend, int) {
+  throw runtime_error("The RenderFarm needs a POSIX system");
+}
+
+void RenderFarm::Stop() {}
+
+void RenderFarm::RenderBatch(const vector<FullHandPose> &,
+                             const vector<HandCameraSpec> &,
+                             char *) {
+  throw runtime_error("The RenderFarm is not started");
+}
+
+#endif  // WIN32
+
+}  // namespace libhand
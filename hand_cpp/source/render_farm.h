@@ -0,0 +1,125 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// RenderFarm
+//
+// The RenderFarm class spreads hand rendering over a number of worker
+// processes on the same machine. Every worker is a forked child process
+// with its own HandRenderer and its own copy of the scene, so the
+// workers don't share the 3D engine or the OpenGL context and render
+// truly in parallel.
+//
+// The poses, the cameras and the rendered frames are passed through a
+// ring of slots in shared memory. The jobs and their completions are
+// signalled over pipes: an idle worker picks the next job from a pipe
+// shared by all the workers, so the load balances itself.
+//
+// The workers are forked from the process calling Start(), so Start()
+// should be called early, before the process sets up a HandRenderer or
+// starts any threads of its own. The RenderFarm is only available on
+// POSIX systems.
+
+#ifndef RENDER_FARM_H
+#define RENDER_FARM_H
+
+# include "hand_prereq.h"
+# include <string>
+# include <vector>
+
+# include "hand_camera_spec.h"
+# include "hand_pose.h"
+# include "hand_renderer.h"
+# include "scene_spec.h"
+
+namespace libhand {
+
+using namespace std;
+
+class HAND_EXPORT RenderFarm {
+ public:
+  RenderFarm();
+  ~RenderFarm();
+
+  // Forks the worker processes, sets up a HandRenderer in each of them
+  // and loads the scene. Returns when all the workers are ready to
+  // render. Throws a runtime_error if any of the workers fails to start.
+  //    scene_spec - the scene every worker renders
+  //    num_workers - the number of worker processes, usually one per
+  //                  CPU core
+  //    width, height - the size of the rendered frames
+  //    backend - the HandRenderer backend of the workers
+  //    num_slots - the number of frames in flight in the shared memory
+  //                ring, 0 for twice the number of workers
+  void Start(const SceneSpec &scene_spec,
+             int num_workers,
+             int width = HandRenderer::kDefaultWidth,
+             int height = HandRenderer::kDefaultHeight,
+             HandRenderer::Backend backend = HandRenderer::OGRE_BACKEND,
+             int num_slots = 0);
+
+  // Shuts the workers down and frees the shared memory. Called by the
+  // destructor if needed.
+  void Stop();
+
+  bool is_started() const { return !workers_.empty(); }
+  int num_workers() const { return (int) workers_.size(); }
+  int num_slots() const { return num_slots_; }
+
+  int render_width() const { return width_; }
+  int render_height() const { return height_; }
+
+  // The size of a single rendered BGR888 frame in bytes
+  size_t frame_bytes() const { return (size_t) 3 * width_ * height_; }
+
+  // Renders a whole batch of hand poses on the workers. Same semantics
+  // as HandRenderer::RenderBatch(): either one camera spec per pose or a
+  // single one for all of them, frame i is written at offset
+  // i * frame_bytes() of batch_buffer. The frames are rendered in any
+  // order, but the call returns only once all of them are in place.
+  //
+  // Throws a runtime_error if a worker fails to render a frame or dies.
+  // The farm is stopped in the latter case.
+  void RenderBatch(const vector<FullHandPose> &hand_poses,
+                   const vector<HandCameraSpec> &camera_specs,
+                   char *batch_buffer);
+
+ private:
+  void WorkerMain(int worker_no, const SceneSpec &scene_spec,
+                  HandRenderer::Backend backend);
+  void RenderJob(HandRenderer *renderer, int slot);
+  int WaitForResult();
+  void CheckWorkers();
+
+  char *slot_data(int slot) const { return shm_ + slot * slot_size_; }
+  char *worker_error(int worker_no) const;
+
+  int width_, height_;
+  int num_joints_;
+  int num_slots_;
+  size_t slot_size_;
+  size_t frame_offset_;   // Of the frame within a slot
+
+  // The shared memory: the slots, followed by a startup error message
+  // per worker
+  char *shm_;
+  size_t shm_size_;
+
+  int job_pipe_[2];
+  int result_pipe_[2];
+
+  vector<int> workers_;   // The process ids
+
+  // Disallow
+  RenderFarm(const RenderFarm &rhs);
+  RenderFarm& operator= (const RenderFarm &rhs);
+};
+
+}  // namespace libhand
+#endif  // RENDER_FARM_H
@@ -0,0 +1,356 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// SceneBundle
+
+# include "scene_bundle.h"
+
+# include <algorithm>
+# include <cctype>
+# include <cstdio>
+# include <cstring>
+# include <fstream>
+# include <iterator>
+# include <sstream>
+# include <stdexcept>
+
+# include <boost/cstdint.hpp>
+# include <boost/filesystem.hpp>
+
+# include "opencv2/opencv.hpp"
+
+# include "mapped_file.h"
+# include "printfstring.h"
+
+namespace libhand {
+
+namespace {
+
+using boost::uint32_t;
+using boost::uint64_t;
+
+// The layout of a bundle file (little-endian, as written by the machine
+// that made it):
+//    the header
+//    the entry data, each entry 16 byte aligned and followed by a zero
+//    the scene spec, one line per field
+//    the index: an IndexEntry followed by the name, per entry
+const char kMagic[8] = { 'L', 'H', 'B', 'U', 'N', 'D', 'L', 'E' };
+const uint32_t kVersion = 1;
+const size_t kAlignment = 16;
+
+struct BundleHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_entries;
+  uint64_t spec_offset;
+  uint64_t spec_size;
+  uint64_t index_offset;
+};
+
+struct IndexEntry {
+  uint32_t type;
+  uint32_t width;
+  uint32_t height;
+  uint32_t name_size;
+  uint64_t offset;
+  uint64_t size;
+};
+
+string ToLower(string text) {
+  transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+bool IsSceneFile(const string &extension) {
+  return extension == ".scene" || extension == ".mesh"
+    || extension == ".skeleton" || extension == ".material";
+}
+
+bool IsImageFile(const string &extension) {
+  return extension == ".png" || extension == ".jpg" || extension == ".jpeg"
+    || extension == ".bmp" || extension == ".tif" || extension == ".tiff";
+}
+
+// Appends the data to the bundle, aligned and zero terminated
+uint64_t AppendData(ofstream &file, const char *data, size_t size) {
+  static const char kZeros[kAlignment] = { 0 };
+
+  uint64_t offset = (uint64_t) file.tellp();
+  size_t padding = (kAlignment - offset % kAlignment) % kAlignment;
+  file.write(kZeros, padding);
+  offset += padding;
+
+  file.write(data, size);
+  file.write(kZeros, 1);
+  return offset;
+}
+
+// Removes the half-written bundle when Write() gives up, unless the
+// bundle has been renamed to its place
+class TempFileRemover {
+ public:
+  explicit TempFileRemover(const string &filename) :
+    filename_(filename), is_kept_(false) {}
+  ~TempFileRemover() { if (!is_kept_) remove(filename_.c_str()); }
+
+  void Keep() { is_kept_ = true; }
+
+ private:
+  string filename_;
+  bool is_kept_;
+
+  // Disallow
+  TempFileRemover(const TempFileRemover &);
+  TempFileRemover &operator=(const TempFileRemover &);
+};
+
+}  // namespace
+
+struct SceneBundle::Mapping {
+  string filename;
+  MappedFile file;
+
+  SceneSpec scene_spec;
+  vector<Entry> entries;
+};
+
+SceneBundle::SceneBundle() {}
+
+SceneBundle::SceneBundle(const string &filename) {
+  Open(filename);
+}
+
+void SceneBundle::Open(const string &filename) {
+  boost::shared_ptr<Mapping> mapping(new Mapping);
+  mapping->filename = filename;
+
+  mapping->file.Open(filename);
+
+  const char *data_begin = mapping->file.data();
+  const size_t size = mapping->file.size();
+
+  BundleHeader header;
+  if (size < sizeof(header)) {
+    throw runtime_error(PrintFString("%s is not a scene bundle",
+                                     filename.c_str()));
+  }
+  memcpy(&header, data_begin, sizeof(header));
+
+  if (memcmp(header.magic, kMagic, sizeof(kMagic))) {
+    throw runtime_error(PrintFString("%s is not a scene bundle",
+                                     filename.c_str()));
+  }
+  if (header.version != kVersion) {
+    throw runtime_error(PrintFString("The scene bundle %s has version %d, "
+                                     "while version %d is supported",
+                                     filename.c_str(), (int) header.version,
+                                     (int) kVersion));
+  }
+  if (header.spec_offset > size || header.spec_size > size - header.spec_offset
+      || header.index_offset > size) {
+    throw runtime_error(PrintFString("The scene bundle %s is truncated",
+                                     filename.c_str()));
+  }
+
+  // The scene spec: the scene file, the hand object and the bone map
+  SceneSpec &scene_spec = mapping->scene_spec;
+  istringstream spec(string(data_begin + header.spec_offset,
+                            header.spec_size));
+  string line;
+  if (getline(spec, line)) scene_spec.set_scene_file(line);
+  if (getline(spec, line)) scene_spec.set_hand_object_name(line);
+  while (getline(spec, line)) scene_spec.AddBoneToMap(line);
+
+  boost::filesystem::path path(filename);
+  scene_spec.set_scene_spec_dir(path.has_parent_path() ?
+                                path.parent_path().string() : ".");
+  scene_spec.set_scene_dir(path.filename().string());
+
+  // The index
+  size_t pos = header.index_offset;
+  for (uint32_t i = 0; i < header.num_entries; ++i) {
+    IndexEntry index_entry;
+    if (sizeof(index_entry) > size - pos) break;
+    memcpy(&index_entry, data_begin + pos, sizeof(index_entry));
+    pos += sizeof(index_entry);
+
+    if (index_entry.name_size > size - pos
+        || index_entry.offset > size
+        || index_entry.size >= size - index_entry.offset) {
+      break;
+    }
+
+    Entry entry;
+    entry.name.assign(data_begin + pos, index_entry.name_size);
+    entry.type = index_entry.type == TEXTURE_ENTRY ? TEXTURE_ENTRY :
+      FILE_ENTRY;
+    entry.data = data_begin + index_entry.offset;
+    entry.size = index_entry.size;
+    entry.width = index_entry.width;
+    entry.height = index_entry.height;
+    pos += index_entry.name_size;
+
+    if (entry.type == TEXTURE_ENTRY
+        && (size_t) 3 * entry.width * entry.height != entry.size) {
+      break;
+    }
+    mapping->entries.push_back(entry);
+  }
+
+  if (mapping->entries.size() != header.num_entries) {
+    throw runtime_error(PrintFString("The scene bundle %s is truncated",
+                                     filename.c_str()));
+  }
+
+  mapping_ = mapping;
+}
+
+const string &SceneBundle::filename() const {
+  if (!mapping_) throw runtime_error("The scene bundle is not open");
+  return mapping_->filename;
+}
+
+const SceneSpec &SceneBundle::scene_spec() const {
+  if (!mapping_) throw runtime_error("The scene bundle is not open");
+  return mapping_->scene_spec;
+}
+
+int SceneBundle::num_entries() const {
+  return mapping_ ? (int) mapping_->entries.size() : 0;
+}
+
+const SceneBundle::Entry &SceneBundle::entry(int index) const {
+  return mapping_->entries[index];
+}
+
+const SceneBundle::Entry *SceneBundle::FindEntry(const string &name) const {
+  for (int i = 0; i < num_entries(); ++i) {
+    if (mapping_->entries[i].name == name) return &mapping_->entries[i];
+  }
+
+  return NULL;
+}
+
+void SceneBundle::Write(const SceneSpec &scene_spec, const string &filename) {
+  if (!scene_spec.IsComplete()) {
+    throw runtime_error("The scene spec is not complete");
+  }
+
+  namespace fs = boost::filesystem;
+  const string scene_dir = scene_spec.SceneDirFullPath();
+
+  // Sorted, so that the same scene always gives the same bundle
+  vector<fs::path> paths;
+  for (fs::directory_iterator i(scene_dir), end; i != end; ++i) {
+    if (!fs::is_regular_file(i->status())) continue;
+
+    const string extension = ToLower(i->path().extension().string());
+    if (IsSceneFile(extension) || IsImageFile(extension)) {
+      paths.push_back(i->path());
+    }
+  }
+  sort(paths.begin(), paths.end());
+
+  // Written next to the target first, so that readers of an existing
+  // bundle never see a partially written one
+  const string temp_filename = filename + ".tmp";
+  // Declared before the file, so that the file is closed first
+  TempFileRemover temp_file_remover(temp_filename);
+  ofstream file(temp_filename.c_str(), ios::out | ios::binary);
+  if (!file.is_open()) {
+    throw runtime_error(PrintFString("Could not write %s",
+                                     temp_filename.c_str()));
+  }
+
+  BundleHeader header;
+  memset(&header, 0, sizeof(header));
+  file.write((const char *) &header, sizeof(header));
+
+  vector<IndexEntry> index;
+  vector<string> names;
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const string path = paths[i].string();
+    IndexEntry index_entry;
+    memset(&index_entry, 0, sizeof(index_entry));
+
+    if (IsImageFile(ToLower(paths[i].extension().string()))) {
+      cv::Mat image = cv::imread(path, 1);
+      if (image.empty()) {
+        throw runtime_error(PrintFString("Could not read the image %s",
+                                         path.c_str()));
+      }
+      if (!image.isContinuous()) image = image.clone();
+
+      index_entry.type = TEXTURE_ENTRY;
+      index_entry.width = image.cols;
+      index_entry.height = image.rows;
+      index_entry.size = (uint64_t) 3 * image.cols * image.rows;
+      index_entry.offset = AppendData(file, (const char *) image.data,
+                                      index_entry.size);
+    } else {
+      ifstream in(path.c_str(), ios::in | ios::binary);
+      if (!in.is_open()) {
+        throw runtime_error(PrintFString("Could not open %s", path.c_str()));
+      }
+      vector<char> data((istreambuf_iterator<char>(in)),
+                        istreambuf_iterator<char>());
+
+      index_entry.type = FILE_ENTRY;
+      index_entry.size = data.size();
+      index_entry.offset = AppendData(file, data.empty() ? "" : &data[0],
+                                      data.size());
+    }
+
+    names.push_back(paths[i].filename().string());
+    index_entry.name_size = names.back().size();
+    index.push_back(index_entry);
+  }
+
+  ostringstream spec;
+  spec << scene_spec.scene_file() << "\n"
+       << scene_spec.hand_object_name() << "\n";
+  for (int i = 0; i < scene_spec.num_bones(); ++i) {
+    spec << scene_spec.bone_name(i) << "\n";
+  }
+  const string spec_text = spec.str();
+  header.spec_size = spec_text.size();
+  header.spec_offset = AppendData(file, spec_text.data(), spec_text.size());
+
+  header.index_offset = file.tellp();
+  for (size_t i = 0; i < index.size(); ++i) {
+    file.write((const char *) &index[i], sizeof(index[i]));
+    file.write(names[i].data(), names[i].size());
+  }
+
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_entries = index.size();
+  file.seekp(0);
+  file.write((const char *) &header, sizeof(header));
+  file.close();
+
+  if (!file) {
+    throw runtime_error(PrintFString("Could not write %s",
+                                     temp_filename.c_str()));
+  }
+
+  // rename() does not replace an existing file on Windows
+#ifdef WIN32
+  remove(filename.c_str());
+#endif
+  if (rename(temp_filename.c_str(), filename.c_str())) {
+    throw runtime_error(PrintFString("Could not write %s", filename.c_str()));
+  }
+  temp_file_remover.Keep();
+}
+
+}  // namespace libhand
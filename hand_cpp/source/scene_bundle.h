@@ -0,0 +1,93 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// SceneBundle
+//
+// A scene bundle is a single precompiled binary file with everything
+// HandRenderer::LoadScene() reads from a scene directory: the scene spec,
+// the .scene file, the meshes, the skeletons and the material scripts,
+// and the textures, already decoded into raw BGR888 pixels.
+//
+// SceneBundle::Write() (or the bundle_scene tool) creates a bundle out of
+// a scene spec. Opening a bundle maps the file into memory, and loading
+// it then needs no directory scans, no file opens and no image decoding:
+// the renderers read the meshes and the pixels straight from the mapped
+// memory.
+//
+// A SceneBundle is a light handle. Copies share the mapping, which is
+// released with the last of them, so a bundle can be handed around
+// freely and dropped once the scene is loaded.
+
+#ifndef SCENE_BUNDLE_H
+#define SCENE_BUNDLE_H
+
+# include "hand_prereq.h"
+# include <string>
+# include <vector>
+
+# include "boost/shared_ptr.hpp"
+
+# include "scene_spec.h"
+
+namespace libhand {
+
+using namespace std;
+
+class HAND_EXPORT SceneBundle {
+ public:
+  // A file of the scene directory
+  //    FILE_ENTRY - stored as it is
+  //    TEXTURE_ENTRY - an image, decoded into width x height BGR888
+  //                    pixels without row padding
+  enum EntryType {
+    FILE_ENTRY,
+    TEXTURE_ENTRY
+  };
+
+  struct Entry {
+    string name;
+    EntryType type;
+    const char *data;     // 16 byte aligned, followed by a zero byte
+    size_t size;
+    int width, height;    // Of a texture
+  };
+
+  SceneBundle();
+
+  // Opens the bundle file, throws a runtime_error if it can't be read
+  explicit SceneBundle(const string &filename);
+  void Open(const string &filename);
+
+  bool is_open() const { return mapping_.get() != NULL; }
+  const string &filename() const;
+
+  // The scene spec the bundle was made from. Its scene directory is the
+  // bundle file, for the resource names only.
+  const SceneSpec &scene_spec() const;
+
+  int num_entries() const;
+  const Entry &entry(int index) const;
+
+  // Returns NULL if the bundle has no entry by the name
+  const Entry *FindEntry(const string &name) const;
+
+  // Precompiles the scene directory of the scene spec into a bundle.
+  // The .scene, .mesh, .skeleton and .material files are stored as they
+  // are, the images (.png, .jpg, .jpeg, .bmp, .tif, .tiff) are decoded.
+  // Throws a runtime_error on failure.
+  static void Write(const SceneSpec &scene_spec, const string &filename);
+
+ private:
+  struct Mapping;
+  boost::shared_ptr<Mapping> mapping_;
+};
+
+}  // namespace libhand
+#endif  // SCENE_BUNDLE_H
@@ -110,4 +110,13 @@ void SceneSpec::SaveToFile(const string &filename,
   fs.release();
 }
 
+BoneRemap::BoneRemap(const SceneSpec &scene_spec,
+                     const vector<string> &bone_names)
+  : bone_names_(bone_names),
+    indices_(bone_names.size()) {
+  for (size_t i = 0; i < bone_names.size(); ++i) {
+    indices_[i] = scene_spec.bone_index(bone_names[i]);
+  }
+}
+
 }  // namespace libhand
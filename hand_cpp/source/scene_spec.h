@@ -23,6 +23,8 @@
 # include <string>
 # include <vector>
 
+# include "boost/unordered_map.hpp"
+
 namespace libhand {
 
 using namespace std;
@@ -75,7 +77,7 @@ class HAND_EXPORT SceneSpec {
   // Returns an empty string if the index is invalid
   string bone_name(int index) const;
 
-  // Retrieveing a bone index by its name
+  // Retrieveing a bone index by its name, through a hash table
   // Returns -1 if a bone by the name does not exist
   int bone_index(const string &bone_name) const;
 
@@ -85,6 +87,44 @@ class HAND_EXPORT SceneSpec {
   string scene_file_;
   string hand_object_name_;
   vector<string> bone_map_;
+
+  // The index of every bone name, kept in step with bone_map_. A name
+  // that is in the map twice has the first index, as in bone_map_.
+  boost::unordered_map<string, int> bone_indices_;
+};
+
+// BoneRemap
+//
+// Maps bone names listed in some order, e.g. the joints of a pose file,
+// to the bone indices of a scene spec. The names are looked up once,
+// when the remap is made; after that, mapping position i is an array
+// read. Files written by the same tool list their bones in the same
+// order, so a loader can make the remap for the first file and keep
+// using it for as long as Matches() says the order is the same.
+
+class HAND_EXPORT BoneRemap {
+ public:
+  BoneRemap() {}
+  BoneRemap(const SceneSpec &scene_spec, const vector<string> &bone_names);
+
+  int size() const { return (int) indices_.size(); }
+
+  // The scene spec index of the bone at the position, -1 if the scene
+  // spec has no such bone
+  int bone_index(int position) const { return indices_[position]; }
+
+  const string &bone_name(int position) const {
+    return bone_names_[position];
+  }
+
+  // True if the names are the ones of the remap, in the same order
+  bool Matches(const vector<string> &bone_names) const {
+    return bone_names == bone_names_;
+  }
+
+ private:
+  vector<string> bone_names_;
+  vector<int> indices_;
 };
 
 // Inlined methods follow
@@ -119,12 +159,18 @@ inline void SceneSpec::set_hand_object_name(const string &hand_object_name) {
 
 inline int SceneSpec::num_bones() const { return (int) bone_map_.size(); }
 
-inline void SceneSpec::ClearBoneMap() { bone_map_.clear(); }
+inline void SceneSpec::ClearBoneMap() {
+  bone_map_.clear();
+  bone_indices_.clear();
+}
+
 inline void SceneSpec::SetBoneMap(const vector<string> &bone_map) {
-  bone_map_ = bone_map;
+  ClearBoneMap();
+  for (size_t i = 0; i < bone_map.size(); ++i) AddBoneToMap(bone_map[i]);
 }
 
 inline void SceneSpec::AddBoneToMap(const string &bone) {
+  bone_indices_.insert(make_pair(bone, num_bones()));
   bone_map_.push_back(bone);
 }
 
@@ -137,11 +183,10 @@ inline string SceneSpec::bone_name(int index) const {
 }
 
 inline int SceneSpec::bone_index(const string &bone_name) const {
-  for (int i = 0; i < num_bones(); ++i) {
-    if (bone_name == bone_map_[i]) return i;
-  }
+  boost::unordered_map<string, int>::const_iterator bone =
+    bone_indices_.find(bone_name);
 
-  return -1;
+  return bone == bone_indices_.end() ? -1 : bone->second;
 }
 
 }  // namespace libhand
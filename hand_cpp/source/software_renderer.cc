@@ -0,0 +1,1649 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// SoftwareRenderer
+
+# include "software_renderer.h"
+
+# include <algorithm>
+# include <cmath>
+# include <cstdlib>
+# include <cstring>
+# include <fstream>
+# include <iostream>
+# include <sstream>
+# include <stdexcept>
+
+# include <boost/bind.hpp>
+# include <boost/filesystem.hpp>
+# include <boost/function.hpp>
+# include <boost/thread.hpp>
+
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
+# include "OGRE/OgreQuaternion.h"
+# include "OGRE/OgreVector3.h"
+
+# include "tinyxml/tinyxml.h"
+
+# include "opencv2/opencv.hpp"
+
+# include "printfstring.h"
+
+namespace libhand {
+
+using namespace std;
+
+static const float kPi = 3.14159265358979f;
+
+// The scene defaults, as in the DotSceneLoader
+static const float kDefaultFovDegrees = 45;
+static const float kDefaultAspectRatio = 1.3333f;
+static const float kDefaultNearClip = 100;
+static const float kDefaultFarClip = 100000;
+
+static const int kMaxBonesPerVertex = 4;
+
+// Bands of rows are handed out to the threads round-robin, several
+// bands per thread, so that a thread drawing the middle of the hand
+// doesn't do all the work.
+static const int kBandsPerThread = 8;
+
+namespace {
+
+typedef float Quat[4];  // w, x, y, z
+
+void Normalize(float *v) {
+  float length = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+  if (length > 0) {
+    v[0] /= length; v[1] /= length; v[2] /= length;
+  }
+}
+
+float Dot(const float *a, const float *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+float ParseFloat(const char *str, float default_value) {
+  return str ? (float) atof(str) : default_value;
+}
+
+float Attribute(const TiXmlElement *element, const char *name,
+                float default_value) {
+  return element ? ParseFloat(element->Attribute(name), default_value)
+    : default_value;
+}
+
+void ParseVector(const TiXmlElement *element, const char *x, const char *y,
+                 const char *z, float default_value, float *v) {
+  v[0] = Attribute(element, x, default_value);
+  v[1] = Attribute(element, y, default_value);
+  v[2] = Attribute(element, z, default_value);
+}
+
+// Splits a line of a material script into tokens, braces are tokens of
+// their own
+vector<string> Tokenize(const string &line) {
+  string spaced;
+  for (size_t i = 0; i < line.size(); ++i) {
+    if (line[i] == '/' && i + 1 < line.size() && line[i + 1] == '/') break;
+    if (line[i] == '{' || line[i] == '}') {
+      spaced += string(" ") + line[i] + " ";
+    } else {
+      spaced += line[i];
+    }
+  }
+
+  vector<string> tokens;
+  istringstream stream(spaced);
+  string token;
+  while (stream >> token) tokens.push_back(token);
+  return tokens;
+}
+
+void ParseColour(const vector<string> &tokens, float *colour) {
+  for (int i = 0; i < 3; ++i) {
+    colour[i] = i + 1 < (int) tokens.size() ?
+      ParseFloat(tokens[i + 1].c_str(), 0) : 0;
+  }
+}
+
+// Reorders the elements of the array, num_components per vertex, so
+// that the vertex order[i] becomes the vertex i
+template <class T> void PermuteVertices(const vector<int> &order,
+                                        int num_components,
+                                        vector<T> *data) {
+  vector<T> permuted(data->size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    copy(data->begin() + num_components * order[i],
+         data->begin() + num_components * (order[i] + 1),
+         permuted.begin() + num_components * i);
+  }
+  data->swap(permuted);
+}
+
+const SceneBundle::Entry &BundleFile(const SceneBundle &bundle,
+                                     const string &name) {
+  const SceneBundle::Entry *entry = bundle.FindEntry(name);
+  if (!entry || entry->type != SceneBundle::FILE_ENTRY) {
+    throw runtime_error(PrintFString("The scene bundle %s has no file %s",
+                                     bundle.filename().c_str(),
+                                     name.c_str()));
+  }
+
+  return *entry;
+}
+
+}  // namespace
+
+SoftwareRenderer::Material::Material() :
+  shininess(0),
+  lighting(true),
+  cull_sign(1),
+  texture(-1),
+  texture_replace(false),
+  texture_wrap(true) {
+  for (int i = 0; i < 3; ++i) {
+    ambient[i] = diffuse[i] = 1;
+    specular[i] = emissive[i] = 0;
+  }
+}
+
+// Worker w runs job(w) of every job posted while it is waiting. A job
+// is posted by bumping the generation, so a worker never runs the same
+// job twice or misses one.
+class SoftwareRenderer::WorkerPool {
+ public:
+  explicit WorkerPool(int num_workers);
+  ~WorkerPool();
+
+  int num_workers() const { return num_workers_; }
+
+  // Returns when all the jobs are done. An exception thrown by job(0) is
+  // passed on once the workers are done with theirs.
+  void Run(int num_jobs, const boost::function<void (int)> &job);
+
+ private:
+  void WorkerLoop(int worker_no);
+  void WaitForWorkers();
+
+  int num_workers_;
+  boost::thread_group threads_;
+
+  boost::mutex mutex_;
+  boost::condition_variable job_posted_;
+  boost::condition_variable job_done_;
+
+  // Guarded by mutex_
+  boost::function<void (int)> job_;
+  int num_jobs_;
+  int num_running_;
+  unsigned int generation_;
+  bool stopping_;
+
+  // Disallow
+  WorkerPool(const WorkerPool &rhs);
+  WorkerPool& operator= (const WorkerPool &rhs);
+};
+
+SoftwareRenderer::WorkerPool::WorkerPool(int num_workers) :
+  num_workers_(num_workers),
+  num_jobs_(0),
+  num_running_(0),
+  generation_(0),
+  stopping_(false) {
+  for (int i = 1; i <= num_workers_; ++i) {
+    threads_.create_thread(boost::bind(&WorkerPool::WorkerLoop, this, i));
+  }
+}
+
+SoftwareRenderer::WorkerPool::~WorkerPool() {
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  job_posted_.notify_all();
+  threads_.join_all();
+}
+
+void SoftwareRenderer::WorkerPool::Run(int num_jobs,
+                                       const boost::function<void (int)>
+                                       &job) {
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    job_ = job;
+    num_jobs_ = num_jobs;
+    num_running_ = min(num_jobs - 1, num_workers_);
+    ++generation_;
+  }
+  job_posted_.notify_all();
+
+  try {
+    job(0);
+  } catch (...) {
+    WaitForWorkers();
+    throw;
+  }
+  WaitForWorkers();
+}
+
+void SoftwareRenderer::WorkerPool::WaitForWorkers() {
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  while (num_running_ > 0) job_done_.wait(lock);
+}
+
+void SoftwareRenderer::WorkerPool::WorkerLoop(int worker_no) {
+  unsigned int generation = 0;
+
+  boost::unique_lock<boost::mutex> lock(mutex_);
+  for (;;) {
+    while (!stopping_ && generation_ == generation) job_posted_.wait(lock);
+    if (stopping_) return;
+    generation = generation_;
+    if (worker_no >= num_jobs_) continue;
+
+    // job_ stays put until every worker is done with it
+    lock.unlock();
+    job_(worker_no);
+    lock.lock();
+
+    if (--num_running_ == 0) job_done_.notify_one();
+  }
+}
+
+SoftwareRenderer::SoftwareRenderer() :
+  num_threads_(max(1, (int) boost::thread::hardware_concurrency())),
+  width_(0),
+  height_(0),
+  fov_y_(0),
+  aspect_ratio_(kDefaultAspectRatio),
+  near_clip_(kDefaultNearClip),
+  far_clip_(kDefaultFarClip),
+  initial_cam_distance_(0),
+  num_vertices_(0),
+  lod_level_(0),
+  need_colours_(false),
+  materials_need_colours_(false),
+  silhouette_(false),
+  with_depth_(false),
+  with_labels_(false),
+  band_height_(1),
+  skinning_to_world_(false),
+  skin_is_cached_(false),
+  skin_was_rendered_(false),
+  frame_is_current_(false) {
+  for (int i = 0; i < 3; ++i) hand_position_[i] = ambient_light_[i] = 0;
+  window_[0] = window_[2] = -1;
+  window_[1] = window_[3] = 1;
+  SetRenderSize(1, 1);
+}
+
+void SoftwareRenderer::SetRenderSize(int width, int height) {
+  if (width <= 0 || height <= 0) {
+    throw runtime_error("Bad SoftwareRenderer render width or height");
+  }
+
+  width_ = width;
+  height_ = height;
+  frame_is_current_ = false;
+
+  frame_.assign(3 * width * height, 0);
+  inverse_w_.assign(width * height, 0);
+  depth_.assign(width * height, 0);
+  labels_.assign(width * height, 0);
+}
+
+SoftwareRenderer::~SoftwareRenderer() {
+  // Joins the workers
+  workers_.reset();
+}
+
+void SoftwareRenderer::set_num_threads(int num_threads) {
+  num_threads_ = max(1, num_threads);
+
+  // The pool is started again, at the new size, by the next job
+  if (workers_ && workers_->num_workers() != num_threads_ - 1) {
+    workers_.reset();
+  }
+}
+
+// The .scene file is read the same way the DotSceneLoader reads it, but
+// only the nodes, the hand entity, the first camera, the lights and the
+// ambient light are used.
+void SoftwareRenderer::LoadScene(const SceneSpec &scene_spec) {
+  LoadScene(scene_spec, NULL);
+}
+
+void SoftwareRenderer::LoadScene(const SceneBundle &bundle) {
+  LoadScene(bundle.scene_spec(), &bundle);
+}
+
+// Reads the scene files from the bundle if there is one, otherwise from
+// the scene directory
+void SoftwareRenderer::LoadScene(const SceneSpec &scene_spec,
+                                 const SceneBundle *bundle) {
+  const string scene_dir = scene_spec.SceneDirFullPath();
+  const string scene_path = scene_dir + "/" + scene_spec.scene_file();
+
+  frame_is_current_ = false;
+  skin_is_cached_ = false;
+  skin_was_rendered_ = false;
+  posed_joints_.clear();
+
+  TiXmlDocument document(scene_path.c_str());
+  bool is_loaded = false;
+  if (bundle) {
+    const SceneBundle::Entry *entry =
+      bundle->FindEntry(scene_spec.scene_file());
+    if (entry) {
+      document.Parse(entry->data);
+      is_loaded = !document.Error();
+    }
+  } else {
+    is_loaded = document.LoadFile();
+  }
+
+  if (!is_loaded) {
+    throw runtime_error(PrintFString("The scene file %s does not appear to "
+                                     "exist in directory %s",
+                                     scene_spec.scene_file().c_str(),
+                                     scene_dir.c_str()));
+  }
+
+  const TiXmlElement *scene = document.RootElement();
+  const TiXmlElement *nodes = scene ? scene->FirstChildElement("nodes") : NULL;
+  if (!nodes) {
+    throw runtime_error(PrintFString("%s is not a scene file",
+                                     scene_path.c_str()));
+  }
+
+  lights_.clear();
+  for (int i = 0; i < 3; ++i) ambient_light_[i] = 0;
+
+  const TiXmlElement *environment = scene->FirstChildElement("environment");
+  if (environment) {
+    ParseVector(environment->FirstChildElement("colourAmbient"),
+                "r", "g", "b", 0, ambient_light_);
+  }
+
+  // Walk the node tree depth first, keeping the world transforms
+  AffineTransform identity;
+  memset(&identity, 0, sizeof(identity));
+  for (int i = 0; i < 3; ++i) identity.m[i][i] = 1;
+
+  vector<const TiXmlElement *> node_stack;
+  vector<AffineTransform> parent_stack;
+  for (const TiXmlElement *node = nodes->FirstChildElement("node"); node;
+       node = node->NextSiblingElement("node")) {
+    node_stack.push_back(node);
+    parent_stack.push_back(identity);
+  }
+
+  string mesh_file;
+  bool found_camera = false;
+  float camera_position[3] = { 0, 0, 0 };
+
+  while (!node_stack.empty()) {
+    const TiXmlElement *node = node_stack.back();
+    const AffineTransform parent = parent_stack.back();
+    node_stack.pop_back();
+    parent_stack.pop_back();
+
+    float position[3], scale[3];
+    Quat rotation = { 1, 0, 0, 0 };
+    ParseVector(node->FirstChildElement("position"),
+                "x", "y", "z", 0, position);
+    ParseVector(node->FirstChildElement("scale"),
+                "x", "y", "z", 1, scale);
+
+    const TiXmlElement *rotation_element =
+      node->FirstChildElement("rotation");
+    if (rotation_element && rotation_element->Attribute("qx")) {
+      rotation[0] = Attribute(rotation_element, "qw", 1);
+      rotation[1] = Attribute(rotation_element, "qx", 0);
+      rotation[2] = Attribute(rotation_element, "qy", 0);
+      rotation[3] = Attribute(rotation_element, "qz", 0);
+    }
+
+    AffineTransform world = Multiply(parent, MakeAffine(position, rotation,
+                                                        scale));
+
+    for (const TiXmlElement *child = node->FirstChildElement("node");
+         child; child = child->NextSiblingElement("node")) {
+      node_stack.push_back(child);
+      parent_stack.push_back(world);
+    }
+
+    for (const TiXmlElement *entity = node->FirstChildElement("entity");
+         entity; entity = entity->NextSiblingElement("entity")) {
+      const char *name = entity->Attribute("name");
+      if (!name || scene_spec.hand_object_name() != name) continue;
+
+      if (!entity->Attribute("meshFile")) {
+        throw runtime_error(PrintFString("The hand object %s has no mesh",
+                                         name));
+      }
+      mesh_file = entity->Attribute("meshFile");
+      hand_transform_ = world;
+    }
+
+    const TiXmlElement *camera = node->FirstChildElement("camera");
+    if (camera && !found_camera) {
+      found_camera = true;
+
+      float camera_offset[3];
+      ParseVector(camera->FirstChildElement("position"), "x", "y", "z", 0,
+                  camera_offset);
+      TransformPoint(world, camera_offset, camera_position);
+
+      fov_y_ = Attribute(camera, "fov", kDefaultFovDegrees) * kPi / 180;
+      aspect_ratio_ = Attribute(camera, "aspectRatio", kDefaultAspectRatio);
+
+      const TiXmlElement *clipping = camera->FirstChildElement("clipping");
+      near_clip_ = Attribute(clipping, "near", -1);
+      far_clip_ = Attribute(clipping, "far", -1);
+      if (near_clip_ <= 0) {
+        near_clip_ = Attribute(clipping, "nearPlaneDist", kDefaultNearClip);
+      }
+      if (far_clip_ <= 0) {
+        far_clip_ = Attribute(clipping, "farPlaneDist", kDefaultFarClip);
+      }
+    }
+
+    for (const TiXmlElement *light_element =
+           node->FirstChildElement("light");
+         light_element;
+         light_element = light_element->NextSiblingElement("light")) {
+      const char *type = light_element->Attribute("type");
+      if (type && string(type) == "spot") continue;
+
+      Light light;
+      light.directional = type && string(type) == "directional";
+
+      float local[3];
+      if (light.directional) {
+        ParseVector(light_element->FirstChildElement("normal"),
+                    "x", "y", "z", 0, local);
+        if (!light_element->FirstChildElement("normal")) local[2] = -1;
+        TransformVector(world, local, light.position);
+        Normalize(light.position);
+      } else {
+        ParseVector(light_element->FirstChildElement("position"),
+                    "x", "y", "z", 0, local);
+        TransformPoint(world, local, light.position);
+      }
+
+      ParseVector(light_element->FirstChildElement("colourDiffuse"),
+                  "r", "g", "b", 1, light.diffuse);
+      ParseVector(light_element->FirstChildElement("colourSpecular"),
+                  "r", "g", "b", 0, light.specular);
+
+      const TiXmlElement *attenuation =
+        light_element->FirstChildElement("lightAttenuation");
+      light.range = Attribute(attenuation, "range", 100000);
+      light.constant = Attribute(attenuation, "constant", 1);
+      light.linear = Attribute(attenuation, "linear", 0);
+      light.quadratic = Attribute(attenuation, "quadratic", 0);
+
+      lights_.push_back(light);
+    }
+  }
+
+  if (!found_camera) {
+    throw runtime_error("The scene does not have a camera!");
+  }
+
+  if (mesh_file.empty()) {
+    throw runtime_error(PrintFString("The scene does not have the object %s",
+                                     scene_spec.hand_object_name().c_str()));
+  }
+
+  for (int i = 0; i < 3; ++i) hand_position_[i] = hand_transform_.m[i][3];
+
+  float distance[3];
+  for (int i = 0; i < 3; ++i) {
+    distance[i] = camera_position[i] - hand_position_[i];
+  }
+  initial_cam_distance_ = sqrt(Dot(distance, distance));
+
+  LoadMaterials(scene_dir, bundle);
+  LoadMesh(scene_dir, bundle, mesh_file, scene_spec);
+
+  // Lighting is only computed if some material is not a plain texture
+  materials_need_colours_ = false;
+  for (size_t i = 0; i < batches_.size(); ++i) {
+    const Material &material = materials_[batches_[i].material];
+    if (material.texture < 0 || !material.texture_replace) {
+      materials_need_colours_ = true;
+    }
+  }
+  need_colours_ = materials_need_colours_ && !silhouette_;
+}
+
+// Like the OGRE resource groups, every .material script in the scene
+// directory is parsed
+void SoftwareRenderer::LoadMaterials(const string &scene_dir,
+                                     const SceneBundle *bundle) {
+  materials_.clear();
+  material_names_.clear();
+  textures_.clear();
+  texture_names_.clear();
+
+  namespace fs = boost::filesystem;
+  if (bundle) {
+    for (int i = 0; i < bundle->num_entries(); ++i) {
+      const SceneBundle::Entry &entry = bundle->entry(i);
+
+      if (fs::path(entry.name).extension() == ".material") {
+        istringstream script(string(entry.data, entry.size));
+        ParseMaterialScript(script);
+      }
+    }
+  } else {
+    for (fs::directory_iterator i(scene_dir), end; i != end; ++i) {
+      if (fs::is_regular_file(i->status())
+          && i->path().extension() == ".material") {
+        ifstream script(i->path().string().c_str());
+        if (!script.is_open()) {
+          throw runtime_error(PrintFString("Could not open %s",
+                                           i->path().string().c_str()));
+        }
+        ParseMaterialScript(script);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < materials_.size(); ++i) {
+    if (materials_[i].texture < 0) continue;
+    // The texture index holds the index into texture_names_ until here
+    materials_[i].texture =
+      LoadTexture(scene_dir, bundle, texture_names_[materials_[i].texture]);
+  }
+}
+
+// Reads the first pass of the first technique of every material, and
+// its first texture unit
+void SoftwareRenderer::ParseMaterialScript(istream &file) {
+  vector<string> blocks;      // The enclosing blocks
+  vector<int> num_children;   // Per enclosing block
+  string block_name;          // The block opened by the next brace
+  bool in_first = false;      // In the first technique/pass/texture unit
+  Material *material = NULL;
+
+  string line;
+  while (getline(file, line)) {
+    vector<string> tokens = Tokenize(line);
+
+    for (size_t t = 0; t < tokens.size(); ++t) {
+      const string &token = tokens[t];
+
+      if (token == "{") {
+        if (!num_children.empty()) ++num_children.back();
+        blocks.push_back(block_name);
+        num_children.push_back(0);
+      } else if (token == "}") {
+        if (blocks.empty()) break;
+        blocks.pop_back();
+        num_children.pop_back();
+      }
+
+      // Only the first technique, pass and texture unit matter
+      in_first = true;
+      for (size_t i = 1; i < blocks.size(); ++i) {
+        if (num_children[i - 1] != 1) in_first = false;
+      }
+    }
+
+    if (tokens.empty() || tokens[0] == "{" || tokens[0] == "}") continue;
+
+    const string &keyword = tokens[0];
+    block_name = keyword;
+
+    if (keyword == "material" && blocks.empty() && tokens.size() > 1) {
+      materials_.push_back(Material());
+      material_names_.push_back(tokens[1]);
+      material = &materials_.back();
+      continue;
+    }
+
+    if (!material || !in_first) continue;
+
+    if (blocks.size() == 3 && blocks[1] == "technique"
+        && blocks[2] == "pass") {
+      if (keyword == "ambient") {
+        ParseColour(tokens, material->ambient);
+      } else if (keyword == "diffuse") {
+        ParseColour(tokens, material->diffuse);
+      } else if (keyword == "emissive") {
+        ParseColour(tokens, material->emissive);
+      } else if (keyword == "specular") {
+        ParseColour(tokens, material->specular);
+        material->shininess = (float) atof(tokens.back().c_str());
+      } else if (keyword == "lighting" && tokens.size() > 1) {
+        material->lighting = tokens[1] != "off";
+      } else if (keyword == "cull_hardware" && tokens.size() > 1) {
+        material->cull_sign = tokens[1] == "clockwise" ? 1 :
+          tokens[1] == "anticlockwise" ? -1 : 0;
+      }
+    } else if (blocks.size() == 4 && blocks[3] == "texture_unit") {
+      if (keyword == "texture" && tokens.size() > 1) {
+        material->texture = texture_names_.size();
+        texture_names_.push_back(tokens[1]);
+      } else if (keyword == "colour_op" && tokens.size() > 1) {
+        material->texture_replace = tokens[1] == "replace";
+      } else if (keyword == "tex_address_mode" && tokens.size() > 1) {
+        material->texture_wrap = tokens[1] == "wrap";
+      }
+    }
+  }
+}
+
+// A texture that can't be read is left out, like OGRE does
+int SoftwareRenderer::LoadTexture(const string &scene_dir,
+                                  const SceneBundle *bundle,
+                                  const string &name) {
+  if (bundle) {
+    const SceneBundle::Entry *entry = bundle->FindEntry(name);
+    if (!entry || entry->type != SceneBundle::TEXTURE_ENTRY) {
+      cerr << "SoftwareRenderer: could not read the texture " << name << endl;
+      return -1;
+    }
+
+    // Already decoded
+    Texture texture;
+    texture.width = entry->width;
+    texture.height = entry->height;
+    texture.bgr.assign(entry->data, entry->data + entry->size);
+
+    textures_.push_back(texture);
+    return textures_.size() - 1;
+  }
+
+  cv::Mat image = cv::imread(scene_dir + "/" + name, 1);
+  if (image.empty()) {
+    cerr << "SoftwareRenderer: could not read the texture " << name << endl;
+    return -1;
+  }
+
+  Texture texture;
+  texture.width = image.cols;
+  texture.height = image.rows;
+  texture.bgr.resize(3 * image.cols * image.rows);
+  for (int row = 0; row < image.rows; ++row) {
+    memcpy(&texture.bgr[3 * row * image.cols], image.ptr(row),
+           3 * image.cols);
+  }
+
+  textures_.push_back(texture);
+  return textures_.size() - 1;
+}
+
+void SoftwareRenderer::LoadMesh(const string &scene_dir,
+                                const SceneBundle *bundle,
+                                const string &mesh_file,
+                                const SceneSpec &scene_spec) {
+  MeshData mesh;
+  if (bundle) {
+    const SceneBundle::Entry &entry = BundleFile(*bundle, mesh_file);
+    OgreFileReader::LoadMesh(mesh_file, entry.data, entry.size, &mesh);
+  } else {
+    OgreFileReader::LoadMesh(scene_dir + "/" + mesh_file, &mesh);
+  }
+
+  if (mesh.skeleton_name.empty()) {
+    throw runtime_error(PrintFString
+                        ("The hand object %s does not have a skeleton.",
+                         scene_spec.hand_object_name().c_str()));
+  }
+  if (bundle) {
+    const SceneBundle::Entry &entry =
+      BundleFile(*bundle, mesh.skeleton_name);
+    OgreFileReader::LoadSkeleton(mesh.skeleton_name, entry.data, entry.size,
+                                 &skeleton_);
+  } else {
+    OgreFileReader::LoadSkeleton(scene_dir + "/" + mesh.skeleton_name,
+                                 &skeleton_);
+  }
+
+  const int num_bones = skeleton_.bones.size();
+
+  handle_by_index_.clear();
+  for (int i = 0; i < scene_spec.num_bones(); ++i) {
+    int handle = skeleton_.bone_handle(scene_spec.bone_name(i));
+
+    if (handle == -1) {
+      throw runtime_error(PrintFString
+                          ("The hand object %s does not have a "
+                           "bone named %s",
+                           scene_spec.hand_object_name().c_str(),
+                           scene_spec.bone_name(i).c_str()));
+    }
+    handle_by_index_.push_back(handle);
+  }
+
+  // Parents first, so that the labels and the posed transforms can be
+  // built in order. Nothing walks up the parent links before this check.
+  if (!skeleton_.ParentsFirst(&bone_order_)) {
+    throw runtime_error(PrintFString("The skeleton %s has a cycle",
+                                     mesh.skeleton_name.c_str()));
+  }
+
+  // Every skeleton bone is labelled by its closest ancestor (or itself)
+  // in the bone map, like the OGRE backend does it
+  vector<unsigned char> bone_labels(num_bones, 0);
+  for (size_t i = 0; i < bone_order_.size(); ++i) {
+    const int handle = bone_order_[i];
+    const SkeletonBoneData &bone = skeleton_.bones[handle];
+    const int bone_idx = scene_spec.bone_index(bone.name);
+
+    if (bone_idx != -1) {
+      bone_labels[handle] = (unsigned char) min(bone_idx + 1, 255);
+    } else if (bone.parent != -1) {
+      bone_labels[handle] = bone_labels[bone.parent];
+    }
+  }
+
+  joint_parent_labels_.clear();
+  for (size_t i = 0; i < handle_by_index_.size(); ++i) {
+    int parent = skeleton_.bones[handle_by_index_[i]].parent;
+    joint_parent_labels_.push_back(parent == -1 ? 0 : bone_labels[parent]);
+  }
+
+  // The binding pose
+  bone_transforms_.resize(num_bones);
+  inverse_binding_.resize(num_bones);
+  for (size_t i = 0; i < bone_order_.size(); ++i) {
+    int handle = bone_order_[i];
+    const SkeletonBoneData &bone = skeleton_.bones[handle];
+
+    AffineTransform local = MakeAffine(bone.position, bone.orientation,
+                                       bone.scale);
+    bone_transforms_[handle] = bone.parent == -1 ? local :
+      Multiply(bone_transforms_[bone.parent], local);
+    inverse_binding_[handle] = Inverse(bone_transforms_[handle]);
+  }
+  skin_matrices_.assign(16 * num_bones, 0);
+
+  // Merge the vertices of all the sub-meshes into one array
+  vector<const VertexStreamData *> streams;
+  vector<const vector<VertexBoneAssignmentData> *> assignments;
+  vector<int> first_vertex;
+
+  streams.push_back(&mesh.shared_vertices);
+  assignments.push_back(&mesh.bone_assignments);
+  first_vertex.push_back(0);
+  num_vertices_ = mesh.shared_vertices.num_vertices;
+
+  batches_.clear();
+  for (size_t i = 0; i < mesh.sub_meshes.size(); ++i) {
+    const SubMeshData &sub_mesh = mesh.sub_meshes[i];
+    int offset = 0;
+
+    if (!sub_mesh.use_shared_vertices) {
+      offset = num_vertices_;
+      streams.push_back(&sub_mesh.vertices);
+      assignments.push_back(&sub_mesh.bone_assignments);
+      first_vertex.push_back(offset);
+      num_vertices_ += sub_mesh.vertices.num_vertices;
+    }
+
+    Batch batch;
+    batch.material = -1;
+    for (size_t m = 0; m < material_names_.size(); ++m) {
+      if (material_names_[m] == sub_mesh.material_name) batch.material = m;
+    }
+    if (batch.material == -1) {
+      // OGRE falls back to the BaseWhite material
+      batch.material = materials_.size();
+      materials_.push_back(Material());
+      material_names_.push_back(sub_mesh.material_name);
+    }
+
+    batch.indices.resize(sub_mesh.indices.size());
+    for (size_t j = 0; j < sub_mesh.indices.size(); ++j) {
+      batch.indices[j] = sub_mesh.indices[j] + offset;
+    }
+
+    batch.lod_indices.resize(mesh.lod_values.size());
+    for (size_t level = 0; level < batch.lod_indices.size(); ++level) {
+      const vector<unsigned int> &indices = sub_mesh.lod_indices[level];
+      batch.lod_indices[level].resize(indices.size());
+      for (size_t j = 0; j < indices.size(); ++j) {
+        batch.lod_indices[level][j] = indices[j] + offset;
+      }
+    }
+    batches_.push_back(batch);
+  }
+
+  positions_.assign(3 * num_vertices_, 0);
+  normals_.assign(3 * num_vertices_, 0);
+  uvs_.assign(2 * num_vertices_, 0);
+  bone_indices_.assign(kMaxBonesPerVertex * num_vertices_, 0);
+  bone_weights_.assign(kMaxBonesPerVertex * num_vertices_, 0);
+  vertex_labels_.assign(num_vertices_, 0);
+
+  vector<float> best_weight(num_vertices_, 0);
+
+  for (size_t s = 0; s < streams.size(); ++s) {
+    const VertexStreamData &stream = *streams[s];
+    const int first = first_vertex[s];
+    const int n = stream.num_vertices;
+
+    if (n && stream.positions.empty()) {
+      throw runtime_error(PrintFString("The mesh %s has no vertex positions",
+                                       mesh_file.c_str()));
+    }
+
+    copy(stream.positions.begin(), stream.positions.end(),
+         positions_.begin() + 3 * first);
+    copy(stream.normals.begin(), stream.normals.end(),
+         normals_.begin() + 3 * first);
+    copy(stream.uvs.begin(), stream.uvs.end(), uvs_.begin() + 2 * first);
+
+    // Keep the largest weights of every vertex, sorted
+    const vector<VertexBoneAssignmentData> &vertex_bones = *assignments[s];
+    for (size_t i = 0; i < vertex_bones.size(); ++i) {
+      const VertexBoneAssignmentData &assignment = vertex_bones[i];
+      if ((int) assignment.vertex >= n || assignment.bone >= num_bones) {
+        continue;
+      }
+
+      int vertex = first + assignment.vertex;
+      if (assignment.weight > best_weight[vertex]) {
+        best_weight[vertex] = assignment.weight;
+        vertex_labels_[vertex] = bone_labels[assignment.bone];
+      }
+
+      unsigned short *bones = &bone_indices_[kMaxBonesPerVertex * vertex];
+      float *weights = &bone_weights_[kMaxBonesPerVertex * vertex];
+
+      int slot = kMaxBonesPerVertex;
+      while (slot > 0 && weights[slot - 1] < assignment.weight) {
+        if (slot < kMaxBonesPerVertex) {
+          weights[slot] = weights[slot - 1];
+          bones[slot] = bones[slot - 1];
+        }
+        --slot;
+      }
+      if (slot < kMaxBonesPerVertex) {
+        weights[slot] = assignment.weight;
+        bones[slot] = assignment.bone;
+      }
+    }
+  }
+
+  for (int vertex = 0; vertex < num_vertices_; ++vertex) {
+    float *weights = &bone_weights_[kMaxBonesPerVertex * vertex];
+
+    float sum = 0;
+    for (int i = 0; i < kMaxBonesPerVertex; ++i) sum += weights[i];
+
+    if (sum > 0) {
+      for (int i = 0; i < kMaxBonesPerVertex; ++i) weights[i] /= sum;
+    } else {
+      // Unassigned vertices follow the root bone
+      weights[0] = 1;
+    }
+  }
+
+  OrderVerticesByLod(mesh_file, mesh.lod_values.size() + 1);
+}
+
+// The vertices used by the coarser levels go first, the vertices no
+// triangle uses go last
+void SoftwareRenderer::OrderVerticesByLod(const string &mesh_file,
+                                          int num_levels) {
+  vector<int> coarsest_level(num_vertices_, -1);
+  for (int level = 0; level < num_levels; ++level) {
+    for (size_t b = 0; b < batches_.size(); ++b) {
+      const vector<unsigned int> &indices = batches_[b].level_indices(level);
+      for (size_t i = 0; i < indices.size(); ++i) {
+        if (indices[i] >= (unsigned int) num_vertices_) {
+          throw runtime_error(PrintFString("The mesh %s has an index out "
+                                           "of range", mesh_file.c_str()));
+        }
+        coarsest_level[indices[i]] = level;
+      }
+    }
+  }
+
+  vector<int> order;
+  lod_num_vertices_.assign(num_levels, 0);
+  for (int level = num_levels - 1; level >= -1; --level) {
+    for (int vertex = 0; vertex < num_vertices_; ++vertex) {
+      if (coarsest_level[vertex] == level) order.push_back(vertex);
+    }
+    if (level >= 0) lod_num_vertices_[level] = order.size();
+  }
+
+  vector<unsigned int> new_index(num_vertices_);
+  for (int i = 0; i < num_vertices_; ++i) new_index[order[i]] = i;
+
+  for (size_t b = 0; b < batches_.size(); ++b) {
+    for (int level = 0; level < num_levels; ++level) {
+      vector<unsigned int> &indices = level ?
+        batches_[b].lod_indices[level - 1] : batches_[b].indices;
+      for (size_t i = 0; i < indices.size(); ++i) {
+        indices[i] = new_index[indices[i]];
+      }
+    }
+  }
+
+  PermuteVertices(order, 3, &positions_);
+  PermuteVertices(order, 3, &normals_);
+  PermuteVertices(order, 2, &uvs_);
+  PermuteVertices(order, kMaxBonesPerVertex, &bone_indices_);
+  PermuteVertices(order, kMaxBonesPerVertex, &bone_weights_);
+  PermuteVertices(order, 1, &vertex_labels_);
+
+  lod_level_ = 0;
+}
+
+size_t SoftwareRenderer::lod_num_triangles(int level) const {
+  size_t num_triangles = 0;
+  for (size_t b = 0; b < batches_.size(); ++b) {
+    num_triangles += batches_[b].level_indices(level).size() / 3;
+  }
+  return num_triangles;
+}
+
+void SoftwareRenderer::set_lod_level(int level) {
+  if (level < 0 || level >= num_lod_levels()) {
+    throw runtime_error(PrintFString("The mesh has no LOD level %d", level));
+  }
+
+  if (level == lod_level_) return;
+  lod_level_ = level;
+  frame_is_current_ = false;
+  skin_is_cached_ = false;
+  skin_was_rendered_ = false;
+}
+
+void SoftwareRenderer::set_silhouette(bool silhouette) {
+  if (silhouette == silhouette_) return;
+  silhouette_ = silhouette;
+  need_colours_ = materials_need_colours_ && !silhouette_;
+  frame_is_current_ = false;
+  // A hand skinned without the normals can't be lit
+  skin_is_cached_ = false;
+  skin_was_rendered_ = false;
+}
+
+void SoftwareRenderer::SetHandPose(const FullHandPose &hand_pose) {
+  if ((int) handle_by_index_.size() != hand_pose.num_joints()) {
+    throw runtime_error(PrintFString("The bone map has %d bones, while "
+                                     "the number of joints in the hand pose "
+                                     "is %d", (int) handle_by_index_.size(),
+                                     hand_pose.num_joints()));
+  }
+
+  // Nothing to do if the joints did not move since the last pose
+  if (posed_joints_.size() == (size_t) hand_pose.total_joint_elements()
+      && equal(posed_joints_.begin(), posed_joints_.end(),
+               hand_pose.joints_begin())) {
+    return;
+  }
+  posed_joints_.assign(hand_pose.joints_begin(), hand_pose.joints_end());
+  frame_is_current_ = false;
+  skin_is_cached_ = false;
+  skin_was_rendered_ = false;
+
+  vector<float> rotations(4 * skeleton_.bones.size(), 0);
+  for (size_t handle = 0; handle < skeleton_.bones.size(); ++handle) {
+    rotations[4 * handle] = 1;
+  }
+  for (size_t i = 0; i < handle_by_index_.size(); ++i) {
+    const HandJoint joint = hand_pose.joint(i);
+    JointQuaternion(joint.bend, joint.twist, joint.side,
+                    &rotations[4 * handle_by_index_[i]]);
+  }
+
+  // Each bone is reset to its binding pose and rotated in its local space
+  for (size_t i = 0; i < bone_order_.size(); ++i) {
+    int handle = bone_order_[i];
+    const SkeletonBoneData &bone = skeleton_.bones[handle];
+
+    Quat orientation;
+    QuatMultiply(bone.orientation, &rotations[4 * handle], orientation);
+
+    AffineTransform local = MakeAffine(bone.position, orientation,
+                                       bone.scale);
+    bone_transforms_[handle] = bone.parent == -1 ? local :
+      Multiply(bone_transforms_[bone.parent], local);
+  }
+}
+
+void SoftwareRenderer::Render(const HandCameraSpec &camera_spec,
+                              bool with_depth, bool with_labels) {
+  if (!num_vertices_) {
+    throw runtime_error("No scene loaded...");
+  }
+
+  // The last frame is reused if neither the pose nor the camera changed
+  // and it has all the outputs asked for
+  if (frame_is_current_
+      && camera_spec.r == frame_camera_.r
+      && camera_spec.theta == frame_camera_.theta
+      && camera_spec.phi == frame_camera_.phi
+      && camera_spec.tilt == frame_camera_.tilt
+      && (with_depth_ || !with_depth) && (with_labels_ || !with_labels)) {
+    return;
+  }
+
+  with_depth_ = with_depth;
+  with_labels_ = with_labels;
+
+  AffineTransform view = ViewTransform(camera_spec);
+  view_ = view;
+
+  // The projection window is zoomed and shifted to fill the frame
+  const float focal = 1 / tan(fov_y_ / 2);
+  const float window_width = window_[1] - window_[0];
+  const float window_height = window_[3] - window_[2];
+  projection_[0] = 2 * focal / aspect_ratio_ / window_width;
+  projection_[1] = 2 * focal / window_height;
+  projection_offset_[0] = -(window_[0] + window_[1]) / window_width;
+  projection_offset_[1] = -(window_[2] + window_[3]) / window_height;
+
+  view_lights_ = lights_;
+  for (size_t i = 0; i < view_lights_.size(); ++i) {
+    Light &light = view_lights_[i];
+    float world[3] = { light.position[0], light.position[1],
+                       light.position[2] };
+    if (light.directional) {
+      TransformVector(view, world, light.position);
+    } else {
+      TransformPoint(view, world, light.position);
+    }
+  }
+
+  screen_.resize(3 * num_vertices_);
+  if (need_colours_) {
+    view_positions_.resize(3 * num_vertices_);
+    view_normals_.resize(3 * num_vertices_);
+  }
+
+  // A frame that only moved the camera reuses the skinned hand: the
+  // first such frame skins it into the world space, and from then on
+  // the frames only transform it into their view
+  if (skin_was_rendered_) SkinHand();
+
+  if (skin_is_cached_) {
+    ToColumns(view, view_columns_);
+    RunInThreads(num_threads_,
+                 boost::bind(&SoftwareRenderer::ViewVertices, this, _1));
+  } else {
+    UpdateSkinMatrices(view);
+    RunInThreads(num_threads_,
+                 boost::bind(&SoftwareRenderer::TransformVertices, this, _1));
+  }
+
+  fill(frame_.begin(), frame_.end(), 0);
+  fill(inverse_w_.begin(), inverse_w_.end(), 0.f);
+  if (with_depth_) fill(depth_.begin(), depth_.end(), 0.f);
+  if (with_labels_) fill(labels_.begin(), labels_.end(), 0);
+
+  band_height_ = max(1, (height_ + num_threads_ * kBandsPerThread - 1)
+                     / (num_threads_ * kBandsPerThread));
+
+  RunInThreads(num_threads_,
+               boost::bind(&SoftwareRenderer::RasterizeBands, this, _1));
+
+  frame_is_current_ = true;
+  frame_camera_ = camera_spec;
+  skin_was_rendered_ = true;
+}
+
+void SoftwareRenderer::ProjectSkeleton(const HandCameraSpec &camera_spec,
+                                       vector<float> *points) const {
+  const AffineTransform view_hand = Multiply(ViewTransform(camera_spec),
+                                             hand_transform_);
+  const float focal = 1 / tan(fov_y_ / 2);
+  const int num_bones = skeleton_.bones.size();
+
+  vector<bool> is_leaf(num_bones, true);
+  for (int handle = 0; handle < num_bones; ++handle) {
+    int parent = skeleton_.bones[handle].parent;
+    if (parent != -1) is_leaf[parent] = false;
+  }
+
+  points->clear();
+  for (int handle = 0; handle < num_bones; ++handle) {
+    const AffineTransform bone = Multiply(view_hand,
+                                          bone_transforms_[handle]);
+    const float *offset = skeleton_.bones[handle].position;
+    const float tip[3] = { 0, sqrt(offset[0] * offset[0]
+                                   + offset[1] * offset[1]
+                                   + offset[2] * offset[2]), 0 };
+    const float head[3] = { 0, 0, 0 };
+
+    for (int end = 0; end < (is_leaf[handle] ? 2 : 1); ++end) {
+      float position[3];
+      TransformPoint(bone, end ? tip : head, position);
+
+      const float w = -position[2];
+      if (w < near_clip_) continue;
+
+      points->push_back(position[0] * focal / aspect_ratio_ / w);
+      points->push_back(position[1] * focal / w);
+    }
+  }
+}
+
+void SoftwareRenderer::SetProjectionWindow(float left, float right,
+                                           float bottom, float top) {
+  if (right <= left || top <= bottom) {
+    throw runtime_error("Bad SoftwareRenderer projection window");
+  }
+
+  if (left != window_[0] || right != window_[1]
+      || bottom != window_[2] || top != window_[3]) {
+    window_[0] = left;
+    window_[1] = right;
+    window_[2] = bottom;
+    window_[3] = top;
+    frame_is_current_ = false;
+  }
+}
+
+void SoftwareRenderer::ProjectJoints(float *joints) const {
+  const AffineTransform view_hand = Multiply(view_, hand_transform_);
+
+  for (size_t i = 0; i < handle_by_index_.size(); ++i) {
+    const AffineTransform &bone = bone_transforms_[handle_by_index_[i]];
+    const float head[3] = { bone.m[0][3], bone.m[1][3], bone.m[2][3] };
+    float position[3];
+    TransformPoint(view_hand, head, position);
+
+    float *joint = joints + 3 * i;
+    const float w = -position[2];
+    if (w < near_clip_) {
+      joint[0] = joint[1] = joint[2] = 0;
+    } else {
+      joint[0] = (1 + projection_offset_[0] + position[0] * projection_[0] / w)
+        * (0.5f * width_);
+      joint[1] = (1 - projection_offset_[1] - position[1] * projection_[1] / w)
+        * (0.5f * height_);
+      joint[2] = w;
+    }
+  }
+}
+
+void SoftwareRenderer::CopyFrame(char *dst, size_t stride) const {
+  const size_t row_bytes = 3 * width_;
+
+  for (int row = 0; row < height_; ++row) {
+    memcpy(dst + row * stride, &frame_[row * row_bytes], row_bytes);
+  }
+}
+
+// The camera sits at the camera spec position relative to the hand,
+// looking down its negative z axis
+AffineTransform
+SoftwareRenderer::ViewTransform(const HandCameraSpec &camera_spec) const {
+  Ogre::Vector3 offset = camera_spec.GetPosition();
+  Ogre::Quaternion orientation = camera_spec.GetQuaternion();
+
+  Quat camera_orientation = { orientation.w, orientation.x, orientation.y,
+                              orientation.z };
+  float camera_position[3] = { hand_position_[0] + offset.x,
+                               hand_position_[1] + offset.y,
+                               hand_position_[2] + offset.z };
+  float unit_scale[3] = { 1, 1, 1 };
+
+  return Inverse(MakeAffine(camera_position, camera_orientation,
+                            unit_scale));
+}
+
+void SoftwareRenderer::ToColumns(const AffineTransform &a, float *columns) {
+  for (int j = 0; j < 4; ++j) {
+    for (int i = 0; i < 3; ++i) columns[4 * j + i] = a.m[i][j];
+    columns[4 * j + 3] = 0;
+  }
+}
+
+// The skin matrix of a bone takes a vertex from the binding pose of the
+// mesh straight into the view space. It is stored column by column, with
+// every column padded to four floats for SSE.
+void SoftwareRenderer::SkinHand() {
+  if (!num_vertices_) {
+    throw runtime_error("No scene loaded...");
+  }
+
+  if (skin_is_cached_) return;
+
+  // Skinning with the identity view leaves the vertices in the world
+  // space
+  static const float kOrigin[3] = { 0, 0, 0 };
+  static const float kIdentity[4] = { 1, 0, 0, 0 };
+  static const float kUnitScale[3] = { 1, 1, 1 };
+  UpdateSkinMatrices(MakeAffine(kOrigin, kIdentity, kUnitScale));
+
+  world_positions_.resize(4 * num_vertices_);
+  if (need_colours_) world_normals_.resize(4 * num_vertices_);
+
+  skinning_to_world_ = true;
+  RunInThreads(num_threads_,
+               boost::bind(&SoftwareRenderer::TransformVertices, this, _1));
+  skinning_to_world_ = false;
+
+  skin_is_cached_ = true;
+}
+
+void SoftwareRenderer::UpdateSkinMatrices(const AffineTransform &view) {
+  const AffineTransform view_hand = Multiply(view, hand_transform_);
+
+  for (size_t bone = 0; bone < bone_transforms_.size(); ++bone) {
+    AffineTransform skin = Multiply(view_hand,
+                                    Multiply(bone_transforms_[bone],
+                                             inverse_binding_[bone]));
+    ToColumns(skin, &skin_matrices_[16 * bone]);
+  }
+}
+
+void SoftwareRenderer::TransformVertices(int thread_no) {
+  const int num_vertices = lod_num_vertices_[lod_level_];
+  const int begin = (int) ((long long) num_vertices * thread_no
+                           / num_threads_);
+  const int end = (int) ((long long) num_vertices * (thread_no + 1)
+                         / num_threads_);
+
+  for (int vertex = begin; vertex < end; ++vertex) {
+    const unsigned short *bones = &bone_indices_[kMaxBonesPerVertex * vertex];
+    const float *weights = &bone_weights_[kMaxBonesPerVertex * vertex];
+    const float *p = &positions_[3 * vertex];
+    const float *n = &normals_[3 * vertex];
+
+    float position[4], normal[4];
+
+#ifdef __SSE__
+    __m128 c0 = _mm_setzero_ps(), c1 = c0, c2 = c0, c3 = c0;
+
+    for (int i = 0; i < kMaxBonesPerVertex && weights[i] > 0; ++i) {
+      const float *columns = &skin_matrices_[16 * bones[i]];
+      const __m128 weight = _mm_set1_ps(weights[i]);
+
+      c0 = _mm_add_ps(c0, _mm_mul_ps(weight, _mm_loadu_ps(columns)));
+      c1 = _mm_add_ps(c1, _mm_mul_ps(weight, _mm_loadu_ps(columns + 4)));
+      c2 = _mm_add_ps(c2, _mm_mul_ps(weight, _mm_loadu_ps(columns + 8)));
+      c3 = _mm_add_ps(c3, _mm_mul_ps(weight, _mm_loadu_ps(columns + 12)));
+    }
+
+    __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])),
+                                          _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                               _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])),
+                                          c3));
+    _mm_storeu_ps(position, result);
+
+    if (need_colours_) {
+      result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])),
+                                     _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+                          _mm_mul_ps(c2, _mm_set1_ps(n[2])));
+      _mm_storeu_ps(normal, result);
+    }
+#else
+    float c[16] = { 0 };
+
+    for (int i = 0; i < kMaxBonesPerVertex && weights[i] > 0; ++i) {
+      const float *columns = &skin_matrices_[16 * bones[i]];
+      for (int j = 0; j < 16; ++j) c[j] += weights[i] * columns[j];
+    }
+
+    for (int j = 0; j < 4; ++j) {
+      position[j] = c[j] * p[0] + c[4 + j] * p[1] + c[8 + j] * p[2]
+        + c[12 + j];
+      normal[j] = c[j] * n[0] + c[4 + j] * n[1] + c[8 + j] * n[2];
+    }
+#endif
+
+    if (skinning_to_world_) {
+      memcpy(&world_positions_[4 * vertex], position, 4 * sizeof(float));
+      if (need_colours_) {
+        memcpy(&world_normals_[4 * vertex], normal, 4 * sizeof(float));
+      }
+    } else {
+      ProjectVertex(vertex, position, normal);
+    }
+  }
+}
+
+// Same as TransformVertices(), for the vertices already skinned by
+// SkinHand(), so that only the view transform is left
+void SoftwareRenderer::ViewVertices(int thread_no) {
+  const int num_vertices = lod_num_vertices_[lod_level_];
+  const int begin = (int) ((long long) num_vertices * thread_no
+                           / num_threads_);
+  const int end = (int) ((long long) num_vertices * (thread_no + 1)
+                         / num_threads_);
+
+  const float *c = view_columns_;
+
+  for (int vertex = begin; vertex < end; ++vertex) {
+    const float *p = &world_positions_[4 * vertex];
+    const float *n = need_colours_ ? &world_normals_[4 * vertex] : NULL;
+
+    float position[4], normal[4];
+
+#ifdef __SSE__
+    const __m128 c0 = _mm_loadu_ps(c), c1 = _mm_loadu_ps(c + 4);
+    const __m128 c2 = _mm_loadu_ps(c + 8), c3 = _mm_loadu_ps(c + 12);
+
+    __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])),
+                                          _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                               _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])),
+                                          c3));
+    _mm_storeu_ps(position, result);
+
+    if (n) {
+      result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])),
+                                     _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+                          _mm_mul_ps(c2, _mm_set1_ps(n[2])));
+      _mm_storeu_ps(normal, result);
+    }
+#else
+    for (int j = 0; j < 4; ++j) {
+      position[j] = c[j] * p[0] + c[4 + j] * p[1] + c[8 + j] * p[2]
+        + c[12 + j];
+      if (n) normal[j] = c[j] * n[0] + c[4 + j] * n[1] + c[8 + j] * n[2];
+    }
+#endif
+
+    ProjectVertex(vertex, position, normal);
+  }
+}
+
+void SoftwareRenderer::ProjectVertex(int vertex, const float *position,
+                                     float *normal) {
+  // The clip space w is the distance along the viewing direction.
+  // Vertices in front of the near plane are marked by 1 / w = 0.
+  float *screen = &screen_[3 * vertex];
+  const float w = -position[2];
+
+  if (w < near_clip_) {
+    screen[0] = screen[1] = screen[2] = 0;
+  } else {
+    const float inverse_w = 1 / w;
+    screen[0] = (1 + projection_offset_[0]
+                 + position[0] * projection_[0] * inverse_w)
+      * (0.5f * width_);
+    screen[1] = (1 - projection_offset_[1]
+                 - position[1] * projection_[1] * inverse_w)
+      * (0.5f * height_);
+    screen[2] = inverse_w;
+  }
+
+  if (need_colours_) {
+    Normalize(normal);
+    memcpy(&view_positions_[3 * vertex], position, 3 * sizeof(float));
+    memcpy(&view_normals_[3 * vertex], normal, 3 * sizeof(float));
+  }
+}
+
+// The fixed function lighting model of OpenGL, per vertex
+void SoftwareRenderer::ShadeVertex(int vertex, const Material &material,
+                                   float *colour) const {
+  if (!material.lighting) {
+    colour[0] = colour[1] = colour[2] = 1;
+    return;
+  }
+
+  const float *position = &view_positions_[3 * vertex];
+  const float *normal = &view_normals_[3 * vertex];
+
+  for (int i = 0; i < 3; ++i) {
+    colour[i] = material.emissive[i] + material.ambient[i] * ambient_light_[i];
+  }
+
+  float to_eye[3] = { -position[0], -position[1], -position[2] };
+  Normalize(to_eye);
+
+  for (size_t l = 0; l < view_lights_.size(); ++l) {
+    const Light &light = view_lights_[l];
+
+    float to_light[3];
+    float attenuation = 1;
+
+    if (light.directional) {
+      for (int i = 0; i < 3; ++i) to_light[i] = -light.position[i];
+    } else {
+      for (int i = 0; i < 3; ++i) to_light[i] = light.position[i] - position[i];
+      float distance = sqrt(Dot(to_light, to_light));
+      if (distance > light.range) continue;
+
+      attenuation = 1 / (light.constant + light.linear * distance
+                         + light.quadratic * distance * distance);
+      Normalize(to_light);
+    }
+
+    float diffuse = Dot(normal, to_light);
+    if (diffuse <= 0) continue;
+
+    float half_vector[3] = { to_light[0] + to_eye[0],
+                             to_light[1] + to_eye[1],
+                             to_light[2] + to_eye[2] };
+    Normalize(half_vector);
+    float specular = pow(max(0.f, Dot(normal, half_vector)),
+                         material.shininess);
+
+    for (int i = 0; i < 3; ++i) {
+      colour[i] += attenuation
+        * (material.diffuse[i] * light.diffuse[i] * diffuse
+           + material.specular[i] * light.specular[i] * specular);
+    }
+  }
+
+  for (int i = 0; i < 3; ++i) colour[i] = min(1.f, max(0.f, colour[i]));
+}
+
+// Draws the triangles into the bands of rows belonging to the thread.
+// The threads write into disjoint rows, so they don't need any locking.
+void SoftwareRenderer::RasterizeBands(int thread_no) {
+  const int band_stride = band_height_ * num_threads_;
+
+  for (size_t b = 0; b < batches_.size(); ++b) {
+    const Batch &batch = batches_[b];
+    const Material &material = materials_[batch.material];
+    const Texture *texture = material.texture < 0 || silhouette_ ? NULL :
+      &textures_[material.texture];
+    const bool shaded = !silhouette_ && (!texture || !material.texture_replace);
+    // Nothing but the coverage matters for a silhouette drawn alone
+    const bool coverage_only = silhouette_ && !with_depth_ && !with_labels_;
+
+    const vector<unsigned int> &indices = batch.level_indices(lod_level_);
+
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+      unsigned int vertices[3] = { indices[t], indices[t + 1],
+                                   indices[t + 2] };
+
+      const float *s0 = &screen_[3 * vertices[0]];
+      const float *s1 = &screen_[3 * vertices[1]];
+      const float *s2 = &screen_[3 * vertices[2]];
+
+      // Triangles crossing the near plane are dropped, not clipped
+      if (s0[2] == 0 || s1[2] == 0 || s2[2] == 0) continue;
+
+      int min_y = max(0, (int) ceil(min(s0[1], min(s1[1], s2[1])) - 0.5f));
+      int max_y = min(height_ - 1,
+                      (int) floor(max(s0[1], max(s1[1], s2[1])) - 0.5f));
+      if (min_y > max_y) continue;
+
+      // Skip the triangles that don't touch any band of this thread
+      int first_band_start = (min_y / band_stride) * band_stride
+        + thread_no * band_height_;
+      if (first_band_start + band_height_ <= min_y) {
+        first_band_start += band_stride;
+      }
+      if (first_band_start > max_y) continue;
+
+      // The area is positive for the triangles that are clockwise on
+      // the screen (the y axis points down)
+      float area = (s1[0] - s0[0]) * (s2[1] - s0[1])
+        - (s1[1] - s0[1]) * (s2[0] - s0[0]);
+      if (area == 0) continue;
+
+      const int winding = area > 0 ? 1 : -1;
+      if (winding == material.cull_sign) continue;
+
+      // OpenGL takes the flat shaded colour from the last vertex
+      const unsigned char label = vertex_labels_[vertices[2]];
+
+      if (area < 0) {
+        swap(vertices[1], vertices[2]);
+        swap(s1, s2);
+        area = -area;
+      }
+
+      int min_x = max(0, (int) ceil(min(s0[0], min(s1[0], s2[0])) - 0.5f));
+      int max_x = min(width_ - 1,
+                      (int) floor(max(s0[0], max(s1[0], s2[0])) - 0.5f));
+      if (min_x > max_x) continue;
+
+      float colours[3][3];
+      if (shaded) {
+        for (int i = 0; i < 3; ++i) {
+          ShadeVertex(vertices[i], material, colours[i]);
+        }
+      }
+
+      const float *uv[3] = { NULL, NULL, NULL };
+      if (texture) {
+        for (int i = 0; i < 3; ++i) uv[i] = &uvs_[2 * vertices[i]];
+      }
+
+      const float inverse_area = 1 / area;
+
+      // Edge functions: e_i is the (scaled) barycentric weight of vertex i
+      const float *s[3] = { s0, s1, s2 };
+      float step_x[3], step_y[3], offset[3];
+      for (int i = 0; i < 3; ++i) {
+        const float *a = s[(i + 1) % 3];
+        const float *c = s[(i + 2) % 3];
+        step_x[i] = -(c[1] - a[1]) * inverse_area;
+        step_y[i] = (c[0] - a[0]) * inverse_area;
+        offset[i] = -(step_x[i] * a[0] + step_y[i] * a[1]);
+      }
+
+      for (int band_start = first_band_start; band_start <= max_y;
+           band_start += band_stride) {
+        const int row_begin = max(min_y, band_start);
+        const int row_end = min(max_y, band_start + band_height_ - 1);
+
+        for (int y = row_begin; y <= row_end; ++y) {
+          const float py = y + 0.5f;
+          float e[3];
+          for (int i = 0; i < 3; ++i) {
+            e[i] = step_x[i] * (min_x + 0.5f) + step_y[i] * py + offset[i];
+          }
+
+          for (int x = min_x; x <= max_x; ++x,
+                 e[0] += step_x[0], e[1] += step_x[1], e[2] += step_x[2]) {
+            if (e[0] < 0 || e[1] < 0 || e[2] < 0) continue;
+
+            const int pixel = y * width_ + x;
+            const float inverse_w =
+              e[0] * s0[2] + e[1] * s1[2] + e[2] * s2[2];
+
+            if (coverage_only) {
+              if (inverse_w * far_clip_ >= 1) {
+                memset(&frame_[3 * pixel], 255, 3);
+              }
+              continue;
+            }
+
+            // less_equal depth test
+            if (inverse_w < inverse_w_[pixel]) continue;
+            const float w = 1 / inverse_w;
+            if (w > far_clip_) continue;
+            inverse_w_[pixel] = inverse_w;
+
+            // The perspective correct barycentric weights
+            const float q[3] = { e[0] * s0[2] * w, e[1] * s1[2] * w,
+                                 e[2] * s2[2] * w };
+
+            float bgr[3] = { 1, 1, 1 };
+            if (texture) {
+              float u = q[0] * uv[0][0] + q[1] * uv[1][0] + q[2] * uv[2][0];
+              float v = q[0] * uv[0][1] + q[1] * uv[1][1] + q[2] * uv[2][1];
+              Sample(*texture, material.texture_wrap, u, v, bgr);
+            }
+
+            if (shaded) {
+              for (int i = 0; i < 3; ++i) {
+                bgr[i] *= q[0] * colours[0][2 - i] + q[1] * colours[1][2 - i]
+                  + q[2] * colours[2][2 - i];
+              }
+            }
+
+            unsigned char *out = &frame_[3 * pixel];
+            for (int i = 0; i < 3; ++i) {
+              out[i] = (unsigned char) (min(1.f, max(0.f, bgr[i]))
+                                        * 255 + 0.5f);
+            }
+
+            if (with_depth_) depth_[pixel] = w;
+            if (with_labels_) labels_[pixel] = label;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Bilinear filtering, the texture coordinates (0, 0) are at the top left
+// corner of the image
+void SoftwareRenderer::Sample(const Texture &texture, bool wrap,
+                              float u, float v, float *bgr) {
+  float x = u * texture.width - 0.5f;
+  float y = v * texture.height - 0.5f;
+  int x0 = (int) floor(x), y0 = (int) floor(y);
+  float fx = x - x0, fy = y - y0;
+
+  int xs[2] = { x0, x0 + 1 }, ys[2] = { y0, y0 + 1 };
+  for (int i = 0; i < 2; ++i) {
+    if (wrap) {
+      xs[i] %= texture.width;
+      if (xs[i] < 0) xs[i] += texture.width;
+      ys[i] %= texture.height;
+      if (ys[i] < 0) ys[i] += texture.height;
+    } else {
+      xs[i] = min(texture.width - 1, max(0, xs[i]));
+      ys[i] = min(texture.height - 1, max(0, ys[i]));
+    }
+  }
+
+  const unsigned char *t00 = &texture.bgr[3 * (ys[0] * texture.width + xs[0])];
+  const unsigned char *t01 = &texture.bgr[3 * (ys[0] * texture.width + xs[1])];
+  const unsigned char *t10 = &texture.bgr[3 * (ys[1] * texture.width + xs[0])];
+  const unsigned char *t11 = &texture.bgr[3 * (ys[1] * texture.width + xs[1])];
+
+  for (int i = 0; i < 3; ++i) {
+    float top = t00[i] + fx * (t01[i] - t00[i]);
+    float bottom = t10[i] + fx * (t11[i] - t10[i]);
+    bgr[i] = (top + fy * (bottom - top)) / 255;
+  }
+}
+
+template <class Function>
+void SoftwareRenderer::RunInThreads(int num_jobs, Function job) {
+  if (num_jobs <= 1) {
+    job(0);
+    return;
+  }
+
+  if (!workers_ || workers_->num_workers() < num_jobs - 1) {
+    workers_.reset();
+    workers_.reset(new WorkerPool(num_jobs - 1));
+  }
+  workers_->Run(num_jobs, job);
+}
+
+}  // namespace libhand
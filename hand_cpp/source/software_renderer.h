@@ -0,0 +1,282 @@
+// Copyright (c) 2011, Marin Saric <marin.saric@gmail.com>
+// All rights reserved.
+//
+// This file is a part of LibHand. LibHand is open-source software. You can
+// redistribute it and/or modify it under the terms of the LibHand
+// license. The LibHand license is the BSD license with an added clause that
+// requires academic citation. You should have received a copy of the
+// LibHand license (the license.txt file) along with LibHand. If not, see
+// <http://www.libhand.org/>
+//
+// SoftwareRenderer
+//
+// The SoftwareRenderer class renders the hand scene on the CPU alone. It
+// needs no GPU, no OpenGL and no window system, which makes it usable on
+// headless machines. HandRenderer uses it as its SOFTWARE_BACKEND.
+//
+// The renderer reads the same scene directory as the OGRE 3D engine: the
+// .scene file, the binary .mesh and .skeleton files, the .material
+// scripts and the textures, or the same files from a SceneBundle. It
+// supports what the LibHand hand models use: one skinned hand entity, a
+// perspective camera, point and directional lights, and single pass
+// materials with at most one texture.
+//
+// The hand mesh is skinned (linear blend skinning, up to four bones per
+// vertex, using SSE when available) and rasterized with a z-buffer by a
+// number of worker threads, each of them drawing its own bands of rows.
+
+#ifndef SOFTWARE_RENDERER_H
+#define SOFTWARE_RENDERER_H
+
+# include "hand_prereq.h"
+# include <iosfwd>
+# include <string>
+# include <vector>
+
+# include "boost/shared_ptr.hpp"
+
+# include "affine_transform.h"
+# include "hand_camera_spec.h"
+# include "hand_pose.h"
+# include "ogre_file_reader.h"
+# include "scene_bundle.h"
+# include "scene_spec.h"
+
+namespace libhand {
+
+using namespace std;
+
+class HAND_EXPORT SoftwareRenderer {
+ public:
+  SoftwareRenderer();
+  ~SoftwareRenderer();
+
+  void SetRenderSize(int width, int height);
+
+  // The number of worker threads, by default one per CPU core
+  void set_num_threads(int num_threads);
+  int num_threads() const { return num_threads_; }
+
+  // Throws a runtime_error if the scene can't be loaded
+  void LoadScene(const SceneSpec &scene_spec);
+  void LoadScene(const SceneBundle &bundle);
+
+  // Poses the hand skeleton. The pose has to have one joint per bone in
+  // the bone map of the loaded scene. A pose with the same joints as the
+  // current one is skipped.
+  void SetHandPose(const FullHandPose &hand_pose);
+
+  // Skins the posed hand once, in the world space. The following Render()
+  // calls, until the pose changes, then only transform the skinned
+  // vertices into the view of their camera. Pays off when the same pose
+  // is rendered from several cameras. Render() does it on its own for
+  // the second frame of a pose.
+  void SkinHand();
+
+  // Projects the posed skeleton, as seen by the camera, into normalized
+  // device coordinates (-1 to 1 over the full frame, y up). Writes x, y
+  // of the head of every bone and of the tip of every leaf bone (see
+  // HandKinematics), skipping the points in front of the near plane.
+  void ProjectSkeleton(const HandCameraSpec &camera_spec,
+                       vector<float> *points) const;
+
+  // Renders only the window of the full frame between left and right,
+  // bottom and top (in normalized device coordinates) into the whole
+  // frame, like OGRE frustum extents do. -1, 1, -1, 1 is the full frame.
+  void SetProjectionWindow(float left, float right, float bottom, float top);
+
+  // Renders the posed hand as seen by the camera. The depth map and the
+  // label image are only produced if asked for. If neither the pose nor
+  // the camera changed since the last frame, the last frame is kept.
+  void Render(const HandCameraSpec &camera_spec,
+              bool with_depth, bool with_labels);
+
+  // Copies the last frame, in the BGR888 format, to dst. Row r is
+  // written at dst + r * stride.
+  void CopyFrame(char *dst, size_t stride) const;
+
+  // The last frame, BGR888 with rows of 3 * width bytes
+  const unsigned char *frame_buffer() const { return &frame_[0]; }
+
+  // The last depth map and the label image, same semantics as the
+  // HandRenderer outputs
+  const float *depth_buffer() const { return &depth_[0]; }
+  const unsigned char *label_buffer() const { return &labels_[0]; }
+
+  // Projects the joints (the heads) of the bone map bones, as posed for
+  // the last frame, into that frame. Writes x, y in pixels and the
+  // distance along the viewing direction per joint, or three zeros for
+  // joints in front of the near plane.
+  void ProjectJoints(float *joints) const;
+
+  // The label of the part the joint of every bone map bone connects to,
+  // i.e. of its closest ancestor in the bone map, 0 for a root
+  const vector<unsigned char> &joint_parent_labels() const {
+    return joint_parent_labels_;
+  }
+
+  // The distance of the scene camera from the hand
+  float initial_cam_distance() const { return initial_cam_distance_; }
+
+  // The LOD levels of the mesh (see MeshLodBuilder), 0 being the full
+  // detail. Only the vertices of the level in use are skinned.
+  int num_lod_levels() const { return (int) lod_num_vertices_.size(); }
+  size_t lod_num_triangles(int level) const;
+  void set_lod_level(int level);
+  int lod_level() const { return lod_level_; }
+
+  // In the silhouette mode the hand is drawn plain white, with no
+  // texturing or lighting, and no normals are transformed. Without the
+  // depth map and the labels there is no depth test either.
+  void set_silhouette(bool silhouette);
+  bool silhouette() const { return silhouette_; }
+
+ private:
+  struct Material {
+    Material();
+
+    float ambient[3], diffuse[3], specular[3], emissive[3];
+    float shininess;
+    bool lighting;
+    int cull_sign;          // Triangles with this winding are culled
+    int texture;            // Index into textures_, -1 if none
+    bool texture_replace;   // Otherwise the texture modulates the colour
+    bool texture_wrap;      // Otherwise the texture coordinates clamp
+  };
+
+  struct Texture {
+    int width, height;
+    vector<unsigned char> bgr;
+  };
+
+  struct Light {
+    bool directional;
+    float position[3];      // Direction, for the directional lights
+    float diffuse[3], specular[3];
+    float range, constant, linear, quadratic;
+  };
+
+  // The triangles of a material
+  struct Batch {
+    int material;
+    vector<unsigned int> indices;
+    vector<vector<unsigned int> > lod_indices;  // Of the levels 1, 2, ...
+
+    const vector<unsigned int> &level_indices(int level) const {
+      return level ? lod_indices[level - 1] : indices;
+    }
+  };
+
+  void LoadScene(const SceneSpec &scene_spec, const SceneBundle *bundle);
+  void LoadMaterials(const string &scene_dir, const SceneBundle *bundle);
+  void ParseMaterialScript(istream &file);
+  int LoadTexture(const string &scene_dir, const SceneBundle *bundle,
+                  const string &name);
+  void LoadMesh(const string &scene_dir, const SceneBundle *bundle,
+                const string &mesh_file, const SceneSpec &scene_spec);
+  void OrderVerticesByLod(const string &mesh_file, int num_levels);
+
+  AffineTransform ViewTransform(const HandCameraSpec &camera_spec) const;
+  void UpdateSkinMatrices(const AffineTransform &view);
+  void TransformVertices(int thread_no);
+  void ViewVertices(int thread_no);
+  void ProjectVertex(int vertex, const float *position, float *normal);
+  void RasterizeBands(int thread_no);
+  void ShadeVertex(int vertex, const Material &material,
+                   float *colour) const;
+
+  // Runs job(0) .. job(num_jobs - 1) at the same time, job(0) on the
+  // calling thread and the rest on the worker pool
+  template <class Function> void RunInThreads(int num_jobs, Function job);
+
+  static void ToColumns(const AffineTransform &a,
+                        float *columns);   // 4x4
+  static void Sample(const Texture &texture, bool wrap, float u, float v,
+                     float *bgr);
+
+  int num_threads_;
+  int width_, height_;
+
+  // The worker threads are started by the first job that needs them and
+  // wait for the next job in between, until the renderer is destroyed
+  class WorkerPool;
+  boost::shared_ptr<WorkerPool> workers_;
+
+  // The scene
+  float hand_position_[3];
+  AffineTransform hand_transform_;
+  float fov_y_, aspect_ratio_, near_clip_, far_clip_;
+  float ambient_light_[3];
+  vector<Light> lights_;
+  vector<Light> view_lights_;    // The lights in the view space
+  float initial_cam_distance_;
+
+  vector<Material> materials_;
+  vector<string> material_names_;
+  vector<Texture> textures_;
+  vector<string> texture_names_;
+
+  // The mesh. The sub-meshes with their own vertices are merged into
+  // one vertex array.
+  int num_vertices_;
+  vector<float> positions_, normals_, uvs_;
+  vector<unsigned short> bone_indices_;   // 4 per vertex
+  vector<float> bone_weights_;            // 4 per vertex
+  vector<unsigned char> vertex_labels_;
+  vector<Batch> batches_;
+
+  // The vertices are ordered by the coarsest LOD level using them, so
+  // the vertices of a level are the first lod_num_vertices_[level] ones
+  vector<int> lod_num_vertices_;
+  int lod_level_;
+
+  // The skeleton
+  SkeletonData skeleton_;
+  vector<int> bone_order_;               // Parents before children
+  vector<AffineTransform> inverse_binding_;
+  vector<AffineTransform> bone_transforms_;  // Posed, in the mesh space
+  vector<int> handle_by_index_;          // For the bone map bones
+  vector<unsigned char> joint_parent_labels_;
+  vector<float> posed_joints_;           // The joints of the current pose
+  vector<float> skin_matrices_;          // Column-major, 16 per bone
+
+  // The per-frame data
+  float window_[4];                      // left, right, bottom, top
+  AffineTransform view_;
+  float projection_[2];
+  float projection_offset_[2];
+  vector<float> screen_;                 // x, y, 1 / w per vertex
+  vector<float> view_positions_;         // For the lighting only
+  vector<float> view_normals_;
+  bool need_colours_;                    // Also false in the silhouette mode
+  bool materials_need_colours_;
+  bool silhouette_;
+  bool with_depth_, with_labels_;
+  int band_height_;
+
+  // The hand skinned by SkinHand(), x, y, z, w per vertex
+  bool skinning_to_world_;
+  bool skin_is_cached_;
+  // Set once a frame has been rendered from the current pose, LOD level
+  // and silhouette mode
+  bool skin_was_rendered_;
+  vector<float> world_positions_;
+  vector<float> world_normals_;
+  float view_columns_[16];
+
+  vector<unsigned char> frame_;
+  vector<float> inverse_w_;
+  vector<float> depth_;
+  vector<unsigned char> labels_;
+
+  // Set while the buffers hold the current pose, seen by frame_camera_
+  bool frame_is_current_;
+  HandCameraSpec frame_camera_;
+
+  // Disallow
+  SoftwareRenderer(const SoftwareRenderer &rhs);
+  SoftwareRenderer& operator= (const SoftwareRenderer &rhs);
+};
+
+}  // namespace libhand
+#endif  // SOFTWARE_RENDERER_H